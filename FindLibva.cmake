@@ -0,0 +1,58 @@
+# Copyright (C) 2019  Christian Berger
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+###########################################################################
+# Find libva and libva-drm.
+FIND_PATH(VA_INCLUDE_DIR
+          NAMES va/va_drm.h
+          PATHS /usr/local/include/
+                /usr/include/)
+MARK_AS_ADVANCED(VA_INCLUDE_DIR)
+FIND_LIBRARY(VA_LIBRARY
+             NAMES va
+             PATHS ${LIBVADIR}/lib/
+                    /usr/lib/x86_64-linux-gnu/
+                    /usr/local/lib/
+                    /usr/local/lib64/
+                    /usr/lib64/
+                    /usr/lib/)
+MARK_AS_ADVANCED(VA_LIBRARY)
+FIND_LIBRARY(VA_DRM_LIBRARY
+             NAMES va-drm
+             PATHS ${LIBVADIR}/lib/
+                    /usr/lib/x86_64-linux-gnu/
+                    /usr/local/lib/
+                    /usr/local/lib64/
+                    /usr/lib64/
+                    /usr/lib/)
+MARK_AS_ADVANCED(VA_DRM_LIBRARY)
+
+###########################################################################
+IF (VA_INCLUDE_DIR
+    AND VA_LIBRARY
+    AND VA_DRM_LIBRARY)
+    SET(VA_FOUND 1)
+    SET(VA_LIBRARIES ${VA_DRM_LIBRARY} ${VA_LIBRARY})
+    SET(VA_INCLUDE_DIRS ${VA_INCLUDE_DIR})
+ENDIF()
+
+MARK_AS_ADVANCED(VA_LIBRARIES)
+MARK_AS_ADVANCED(VA_INCLUDE_DIRS)
+
+IF (VA_FOUND)
+    MESSAGE(STATUS "Found libva: ${VA_INCLUDE_DIRS}, ${VA_LIBRARIES}")
+ELSE ()
+    MESSAGE(STATUS "Could not find libva")
+ENDIF()
@@ -0,0 +1,48 @@
+# Copyright (C) 2019  Christian Berger
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+###########################################################################
+# Find liblz4.
+FIND_PATH(LZ4_INCLUDE_DIR
+          NAMES lz4.h
+          PATHS /usr/local/include/
+                /usr/include/)
+MARK_AS_ADVANCED(LZ4_INCLUDE_DIR)
+FIND_LIBRARY(LZ4_LIBRARY
+             NAMES lz4
+             PATHS ${LIBLZ4DIR}/lib/
+                    /usr/lib/x86_64-linux-gnu/
+                    /usr/local/lib/
+                    /usr/local/lib64/
+                    /usr/lib64/
+                    /usr/lib/)
+MARK_AS_ADVANCED(LZ4_LIBRARY)
+
+###########################################################################
+IF (LZ4_INCLUDE_DIR
+    AND LZ4_LIBRARY)
+    SET(LZ4_FOUND 1)
+    SET(LZ4_LIBRARIES ${LZ4_LIBRARY})
+    SET(LZ4_INCLUDE_DIRS ${LZ4_INCLUDE_DIR})
+ENDIF()
+
+MARK_AS_ADVANCED(LZ4_LIBRARIES)
+MARK_AS_ADVANCED(LZ4_INCLUDE_DIRS)
+
+IF (LZ4_FOUND)
+    MESSAGE(STATUS "Found liblz4: ${LZ4_INCLUDE_DIRS}, ${LZ4_LIBRARIES}")
+ELSE ()
+    MESSAGE(STATUS "Could not find liblz4")
+ENDIF()
@@ -0,0 +1,48 @@
+# Copyright (C) 2019  Christian Berger
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+###########################################################################
+# Find libzstd.
+FIND_PATH(ZSTD_INCLUDE_DIR
+          NAMES zstd.h
+          PATHS /usr/local/include/
+                /usr/include/)
+MARK_AS_ADVANCED(ZSTD_INCLUDE_DIR)
+FIND_LIBRARY(ZSTD_LIBRARY
+             NAMES zstd
+             PATHS ${LIBZSTDDIR}/lib/
+                    /usr/lib/x86_64-linux-gnu/
+                    /usr/local/lib/
+                    /usr/local/lib64/
+                    /usr/lib64/
+                    /usr/lib/)
+MARK_AS_ADVANCED(ZSTD_LIBRARY)
+
+###########################################################################
+IF (ZSTD_INCLUDE_DIR
+    AND ZSTD_LIBRARY)
+    SET(ZSTD_FOUND 1)
+    SET(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+    SET(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+ENDIF()
+
+MARK_AS_ADVANCED(ZSTD_LIBRARIES)
+MARK_AS_ADVANCED(ZSTD_INCLUDE_DIRS)
+
+IF (ZSTD_FOUND)
+    MESSAGE(STATUS "Found libzstd: ${ZSTD_INCLUDE_DIRS}, ${ZSTD_LIBRARIES}")
+ELSE ()
+    MESSAGE(STATUS "Could not find libzstd")
+ENDIF()
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "bench.hpp"
+#include "encoder-backends.hpp"
+#include "frame.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures the encoding throughput of the lossy and the lossless (archival) path from 640x480 to 3840x2160 and prints one JSON object per result." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--encoders=<list of encoders>] [--threads=<encoder threads>] [--duration=<ms per benchmark>] [--gop=<GOP>]" << std::endl;
+        std::cerr << "         --encoders: comma-separated list of encoders to run the lossy path with (default: vpx); the lossless path uses vpx" << std::endl;
+        std::cerr << "         --threads:  encoder threads (default: all cores)" << std::endl;
+        return 1;
+    }
+    const std::string ENCODERS{(commandlineArguments["encoders"].size() != 0) ? commandlineArguments["encoders"] : "vpx"};
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 0};
+    const std::chrono::milliseconds DURATION{(commandlineArguments["duration"].size() != 0) ? std::stoi(commandlineArguments["duration"]) : 2000};
+    const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : 1};
+
+    struct Mode {
+        std::string name;
+        std::string encoder;
+        bool lossless;
+    };
+    std::vector<Mode> modes;
+    {
+        std::stringstream sstr(ENCODERS);
+        std::string encoder;
+        while (std::getline(sstr, encoder, ',')) {
+            modes.push_back(Mode{"encode.lossy." + encoder, encoder, false});
+        }
+        modes.push_back(Mode{"encode.lossless.vpx", "vpx", true});
+    }
+
+    const uint32_t SEQUENCE_LENGTH{8};
+    for (const auto &resolution : benchResolutions()) {
+        const uint32_t W{resolution.first};
+        const uint32_t H{resolution.second};
+        std::vector<std::vector<uint8_t>> sequence{createSequence(W, H, SEQUENCE_LENGTH)};
+
+        for (const auto &mode : modes) {
+            std::unique_ptr<EncoderBackend> encoder{createEncoderBackend(mode.encoder)};
+            if (!encoder) {
+                std::cerr << "[bench-encoding]: Unknown encoder '" << mode.encoder << "'." << std::endl;
+                continue;
+            }
+            EncoderSettings settings;
+            settings.width = W;
+            settings.height = H;
+            settings.gop = GOP;
+            settings.threads = THREADS;
+            settings.lossless = mode.lossless;
+            if (!encoder->open(settings)) {
+                std::cerr << "[bench-encoding]: Skipping " << mode.name << " at " << W << "x" << H << "." << std::endl;
+                continue;
+            }
+
+            uint64_t n{0};
+            uint64_t bytes{0};
+            uint64_t frames{0};
+            EncodedFrame encodedFrame;
+            BenchResult r = measure(mode.name, W, H, [&]() {
+                Frame f{describeFrame(FOURCC_I420, W, H, sequence[n % SEQUENCE_LENGTH].data())};
+                f.timeStamp = static_cast<int64_t>(n++) * 33333;
+                if (encoder->encode(f)) {
+                    bool withWait{true};
+                    while (EncoderStatus::Ok == encoder->getOutput(encodedFrame, withWait)) {
+                        bytes += encodedFrame.size;
+                        frames++;
+                        withWait = false;
+                    }
+                }
+            }, DURATION);
+            encoder->close();
+
+            r.metrics.emplace_back("fps", 1000.0 * 1000.0 / r.microsecondsPerIteration);
+            r.metrics.emplace_back("bytes_per_frame", (0 < frames) ? static_cast<double>(bytes) / static_cast<double>(frames) : 0.0);
+            r.metrics.emplace_back("compression_ratio", (0 < bytes) ? static_cast<double>(frames) * frameSize(FOURCC_I420, W, H) / static_cast<double>(bytes) : 0.0);
+            r.metrics.emplace_back("threads", (0 < THREADS) ? THREADS : std::max(std::thread::hardware_concurrency(), 1u));
+            printJSON(r);
+        }
+    }
+    return 0;
+}
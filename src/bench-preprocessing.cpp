@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "bench.hpp"
+#include "encoder-backend.hpp"
+#include "frame.hpp"
+#include "frame-preprocessor.hpp"
+#include "thread-pool.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Stands in for an encoder that accepts I420 (and optionally NV12) so that only the preprocessing is measured.
+class BenchBackend : public EncoderBackend {
+   public:
+    explicit BenchBackend(uint32_t preferredFourcc) noexcept
+        : m_preferredFourcc(preferredFourcc) {}
+    const char *name() const noexcept override { return "bench"; }
+    std::string fourcc() const noexcept override { return ""; }
+    bool accepts(uint32_t fourcc) const noexcept override { return (FOURCC_I420 == fourcc) || (m_preferredFourcc == fourcc); }
+    uint32_t preferredFourcc() const noexcept override { return m_preferredFourcc; }
+    bool open(const EncoderSettings &) noexcept override { return true; }
+    bool encode(const Frame &) noexcept override { return true; }
+    EncoderStatus getOutput(EncodedFrame &, bool) noexcept override { return EncoderStatus::NoMore; }
+    void flush() noexcept override {}
+    void close() noexcept override {}
+
+   private:
+    uint32_t m_preferredFourcc{FOURCC_I420};
+};
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures each preprocessing operation (conversion, crop, flip, scale) from 640x480 to 3840x2160 and prints one JSON object per result." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--threads=<threads>] [--duration=<ms per benchmark>]" << std::endl;
+        return 1;
+    }
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 3};
+    const std::chrono::milliseconds DURATION{(commandlineArguments["duration"].size() != 0) ? std::stoi(commandlineArguments["duration"]) : 500};
+
+    std::unique_ptr<ThreadPool> threadPool{(0 < THREADS) ? new ThreadPool(THREADS) : nullptr};
+    BenchBackend i420Backend{FOURCC_I420};
+    BenchBackend nv12Backend{FOURCC_NV12};
+
+    struct Operation {
+        std::string name;
+        uint32_t sourceFourcc;
+        const EncoderBackend *backend;
+        // Fractions of the source size in percent for crop and scale; 0 disables.
+        uint32_t cropPercent;
+        bool flipHorizontal;
+        bool flipVertical;
+        uint32_t scalePercent;
+    };
+    const std::vector<Operation> OPERATIONS{
+        {"convert.nv12-i420", FOURCC_NV12, &i420Backend, 0, false, false, 0},
+        {"convert.yuyv-nv12", FOURCC_YUYV, &nv12Backend, 0, false, false, 0},
+        {"convert.yuyv-i420", FOURCC_YUYV, &i420Backend, 0, false, false, 0},
+        {"convert.bgr-i420", FOURCC_BGR, &i420Backend, 0, false, false, 0},
+        {"crop.i420", FOURCC_I420, &i420Backend, 50, false, false, 0},
+        {"flip.vertical.i420", FOURCC_I420, &i420Backend, 0, false, true, 0},
+        {"flip.horizontal.i420", FOURCC_I420, &i420Backend, 0, true, false, 0},
+        {"scale.half.i420", FOURCC_I420, &i420Backend, 0, false, false, 50},
+        {"crop+flip+scale.i420", FOURCC_I420, &i420Backend, 50, true, true, 50},
+        {"convert+scale.bgr-i420", FOURCC_BGR, &i420Backend, 0, false, false, 50},
+    };
+
+    for (const auto &resolution : benchResolutions()) {
+        const uint32_t W{resolution.first};
+        const uint32_t H{resolution.second};
+        std::vector<uint8_t> source(frameSize(FOURCC_BGR, W, H));
+        for (std::size_t i{0}; i < source.size(); i++) {
+            source[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+        }
+
+        for (const auto &op : OPERATIONS) {
+            Preprocessing p;
+            if (0 < op.cropPercent) {
+                p.cropWidth = W * op.cropPercent / 100;
+                p.cropHeight = H * op.cropPercent / 100;
+                p.cropX = (W - p.cropWidth) / 2;
+                p.cropY = (H - p.cropHeight) / 2;
+            }
+            p.flipHorizontal = op.flipHorizontal;
+            p.flipVertical = op.flipVertical;
+            if (0 < op.scalePercent) {
+                p.scaledWidth = ((0 < p.cropWidth) ? p.cropWidth : W) * op.scalePercent / 100;
+                p.scaledHeight = ((0 < p.cropHeight) ? p.cropHeight : H) * op.scalePercent / 100;
+            }
+            FramePreprocessor preprocessor(op.sourceFourcc, W, H, p, *op.backend, threadPool.get());
+            int64_t timeStamp{0};
+            BenchResult r = measure(op.name, W, H, [&]() {
+                Frame f{preprocessor.process(source.data(), timeStamp++)};
+                (void)f;
+            }, DURATION);
+            r.metrics.emplace_back("threads", THREADS);
+            printJSON(r);
+        }
+    }
+    return 0;
+}
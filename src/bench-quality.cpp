@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "bench.hpp"
+#include "encoder-backends.hpp"
+#include "frame.hpp"
+#include "frame-decoder-vpx.hpp"
+#include "frame-decoders.hpp"
+#include "frame-quality.hpp"
+#include "thread-pool.hpp"
+
+#include <libyuv.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Objective quality of a decoded frame compared with its original.
+struct FrameQuality {
+    double psnr{0}; // dB over all samples of Y, U, and V.
+    double psnrY{0};
+    double ssim{0}; // Weighted 0.8 Y, 0.1 U, 0.1 V.
+};
+
+// Uses libyuv's SIMD kernels for the squared errors and the SSE2 kernel of frame-quality.hpp for SSIM;
+// libyuv caps the PSNR of identical frames at 128 dB.
+static FrameQuality compareFrames(const Frame &a, const Frame &b) noexcept {
+    FrameQuality q;
+    uint64_t sse{0};
+    uint64_t samples{0};
+    for (uint32_t i{0}; i < 3; i++) {
+        const int W{static_cast<int>((0 == i) ? a.width : a.width / 2)};
+        const int H{static_cast<int>((0 == i) ? a.height : a.height / 2)};
+        const uint64_t SSE{libyuv::ComputeSumSquareErrorPlane(a.plane(i), static_cast<int>(a.pitch[i]), b.plane(i), static_cast<int>(b.pitch[i]), W, H)};
+        if (0 == i) {
+            q.psnrY = libyuv::SumSquareErrorToPsnr(SSE, static_cast<uint64_t>(W) * static_cast<uint64_t>(H));
+        }
+        sse += SSE;
+        samples += static_cast<uint64_t>(W) * static_cast<uint64_t>(H);
+    }
+    q.psnr = libyuv::SumSquareErrorToPsnr(sse, samples);
+    q.ssim = i420Ssim(a, b);
+    return q;
+}
+
+static std::vector<uint32_t> parseList(const std::string &value) noexcept {
+    std::vector<uint32_t> list;
+    std::stringstream sstr(value);
+    std::string item;
+    while (std::getline(sstr, item, ',')) {
+        if (!item.empty()) {
+            list.push_back(static_cast<uint32_t>(std::stoi(item)));
+        }
+    }
+    return list;
+}
+
+static const char *rcModeName(uint32_t rcMode) noexcept {
+    const char *NAMES[]{"none", "cbr", "vbr", "vcm", "cqp"};
+    return (rcMode < 5) ? NAMES[rcMode] : "unknown";
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " replays a raw I420 sequence through an encoder for a grid of rate control settings, decodes the result, and prints the rate-distortion (PSNR, SSIM) and throughput of each setting as one JSON object per result." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--i420=<file>] [--width=<width>] [--height=<height>] [--frames=<frames>] [--encoder=<encoder>] [--rc-modes=<list>] [--bitrates=<list>] [--init-qps=<list>] [--gop=<GOP>] [--threads=<threads>] [--table]" << std::endl;
+        std::cerr << "         --i420:     file with consecutive I420 frames of --width x --height (default: synthetic sequence)" << std::endl;
+        std::cerr << "         --width:    width of the frames (default: 1280)" << std::endl;
+        std::cerr << "         --height:   height of the frames (default: 720)" << std::endl;
+        std::cerr << "         --frames:   maximum number of frames to replay at 30 fps (default: 90)" << std::endl;
+        std::cerr << "         --encoder:  encoder backend as for the recorder (default: vpx, which needs no GPU)" << std::endl;
+        std::cerr << "         --rc-modes: comma-separated rate control modes as for --rc-mode (default: 1,2,4)" << std::endl;
+        std::cerr << "         --bitrates: comma-separated bitrates in kbit/s for the modes CBR, VBR, and VCM (default: 500,1000,2000,4000,8000)" << std::endl;
+        std::cerr << "         --init-qps: comma-separated QPs for the modes NONE and CQP (default: 10,20,30,40,50)" << std::endl;
+        std::cerr << "         --gop:      length of group of pictures (default: 30)" << std::endl;
+        std::cerr << "         --threads:  encoder threads and threads to compute PSNR and SSIM (default: all cores)" << std::endl;
+        std::cerr << "         --table:    print a rate-distortion and a throughput table instead of JSON" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --i420=ptg-right.i420 --width=2048 --height=1536 --rc-modes=1 --bitrates=2000,4000,8000" << std::endl;
+        return 1;
+    }
+    const std::string I420{commandlineArguments["i420"]};
+    const uint32_t W{(commandlineArguments["width"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["width"])) : 1280};
+    const uint32_t H{(commandlineArguments["height"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["height"])) : 720};
+    const uint32_t FRAMES{(commandlineArguments["frames"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["frames"])) : 90};
+    const std::string ENCODER{(commandlineArguments["encoder"].size() != 0) ? commandlineArguments["encoder"] : "vpx"};
+    const std::vector<uint32_t> RC_MODES{parseList((commandlineArguments["rc-modes"].size() != 0) ? commandlineArguments["rc-modes"] : "1,2,4")};
+    const std::vector<uint32_t> BITRATES{parseList((commandlineArguments["bitrates"].size() != 0) ? commandlineArguments["bitrates"] : "500,1000,2000,4000,8000")};
+    const std::vector<uint32_t> INIT_QPS{parseList((commandlineArguments["init-qps"].size() != 0) ? commandlineArguments["init-qps"] : "10,20,30,40,50")};
+    const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : 30};
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : std::max(std::thread::hardware_concurrency(), 1u)};
+    const bool TABLE{commandlineArguments.count("table") != 0};
+    const uint32_t FPS{30};
+    const int64_t FRAME_DURATION{1000 * 1000 / FPS};
+
+    if ( (0 == W) || (0 == H) || (0 != (W % 2)) || (0 != (H % 2)) || (0 == FRAMES) ) {
+        std::cerr << "[bench-quality]: Width and height need to be even and at least one frame is needed." << std::endl;
+        return 1;
+    }
+
+    const uint32_t SIZE{frameSize(FOURCC_I420, W, H)};
+    std::vector<std::vector<uint8_t>> sequence;
+    if (I420.empty()) {
+        sequence = createSequence(W, H, FRAMES);
+    }
+    else {
+        std::ifstream in(I420, std::ios::binary);
+        std::vector<uint8_t> f(SIZE);
+        while ( (sequence.size() < FRAMES) && in.read(reinterpret_cast<char*>(f.data()), SIZE) ) {
+            sequence.push_back(f);
+        }
+        if (sequence.empty()) {
+            std::cerr << "[bench-quality]: Could not read a " << W << "x" << H << " I420 frame from '" << I420 << "'." << std::endl;
+            return 1;
+        }
+    }
+    const uint32_t LENGTH{static_cast<uint32_t>(sequence.size())};
+
+    // The calling thread takes part in computing the quality.
+    ThreadPool threadPool{std::max(THREADS, 1u) - 1};
+
+    struct Setting {
+        uint32_t rcMode;
+        uint32_t bitrate; // kbit/s
+        uint32_t initQP;
+    };
+    std::vector<Setting> grid;
+    for (uint32_t rcMode : RC_MODES) {
+        // The bitrate only matters to the modes that control the rate; the others encode at constant quality.
+        if ( (1 <= rcMode) && (rcMode <= 3) ) {
+            for (uint32_t bitrate : BITRATES) {
+                grid.push_back(Setting{rcMode, bitrate, EncoderSettings().initQP});
+            }
+        }
+        else {
+            for (uint32_t initQP : INIT_QPS) {
+                grid.push_back(Setting{rcMode, EncoderSettings().bitrate / 1024, initQP});
+            }
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto &setting : grid) {
+        const std::string NAME{"quality." + ENCODER + "." + rcModeName(setting.rcMode)};
+        std::unique_ptr<EncoderBackend> encoder{createEncoderBackend(ENCODER)};
+        if (!encoder) {
+            std::cerr << "[bench-quality]: Unknown encoder '" << ENCODER << "'." << std::endl;
+            return 1;
+        }
+        EncoderSettings settings;
+        settings.width = W;
+        settings.height = H;
+        settings.fps = FPS;
+        settings.gop = GOP;
+        settings.bitrate = setting.bitrate * 1024;
+        settings.initQP = setting.initQP;
+        settings.rcMode = setting.rcMode;
+        settings.threads = THREADS;
+        if (!encoder->open(settings)) {
+            std::cerr << "[bench-quality]: Skipping " << NAME << " at " << setting.bitrate << " kbit/s, init-qp " << setting.initQP << "." << std::endl;
+            continue;
+        }
+
+        // Encode the whole sequence first; encoded frames are matched with their originals by time stamp.
+        std::vector<std::string> encoded;
+        std::vector<uint32_t> original;
+        uint64_t bytes{0};
+        EncodedFrame encodedFrame;
+        auto collect = [&](bool withWait) {
+            while (EncoderStatus::Ok == encoder->getOutput(encodedFrame, withWait)) {
+                const int64_t INDEX{(encodedFrame.timeStamp + FRAME_DURATION / 2) / FRAME_DURATION};
+                if ( (0 < encodedFrame.size) && (0 <= INDEX) && (INDEX < LENGTH) ) {
+                    encoded.emplace_back(reinterpret_cast<const char*>(encodedFrame.data), encodedFrame.size);
+                    original.push_back(static_cast<uint32_t>(INDEX));
+                    bytes += encodedFrame.size;
+                }
+                withWait = false;
+            }
+        };
+        const auto ENCODE_START{std::chrono::steady_clock::now()};
+        for (uint32_t n{0}; n < LENGTH; n++) {
+            Frame f{describeFrame(FOURCC_I420, W, H, sequence[n].data())};
+            f.timeStamp = static_cast<int64_t>(n) * FRAME_DURATION;
+            if (encoder->encode(f)) {
+                collect(true);
+            }
+        }
+        encoder->flush();
+        collect(false);
+        const auto ENCODE_END{std::chrono::steady_clock::now()};
+        const std::string FOURCC{encoder->fourcc()};
+        encoder->close();
+
+        // Decode sequentially as frames depend on each other and keep copies to compare in parallel.
+        std::unique_ptr<FrameDecoder> decoder{("VP90" == FOURCC) ? std::unique_ptr<FrameDecoder>(new VpxFrameDecoder()) : createFrameDecoder(FOURCC, W, H)};
+        if (!decoder) {
+            std::cerr << "[bench-quality]: Cannot decode '" << FOURCC << "' from encoder '" << ENCODER << "'." << std::endl;
+            return 1;
+        }
+        std::vector<std::vector<uint8_t>> decoded(encoded.size());
+        uint32_t decodingFailed{0};
+        // Only the decoder is timed; the copy keeps each frame beyond the next call to decode.
+        std::chrono::steady_clock::duration decoding{0};
+        for (std::size_t i{0}; i < encoded.size(); i++) {
+            Frame f;
+            const auto DECODE_START{std::chrono::steady_clock::now()};
+            const bool DECODED{decoder->decode(encoded[i], f)};
+            decoding += std::chrono::steady_clock::now() - DECODE_START;
+            if ( DECODED && (FOURCC_I420 == f.fourcc) && (W == f.width) && (H == f.height) ) {
+                decoded[i].resize(SIZE);
+                for (uint32_t p{0}; p < 3; p++) {
+                    Frame packed{describeFrame(FOURCC_I420, W, H, decoded[i].data())};
+                    libyuv::CopyPlane(f.plane(p), static_cast<int>(f.pitch[p]), packed.plane(p), static_cast<int>(packed.pitch[p]),
+                                      static_cast<int>((0 == p) ? W : W / 2), static_cast<int>((0 == p) ? H : H / 2));
+                }
+            }
+            else {
+                decodingFailed++;
+            }
+        }
+
+        std::vector<FrameQuality> quality(decoded.size());
+        const auto QUALITY_START{std::chrono::steady_clock::now()};
+        threadPool.parallelFor(static_cast<uint32_t>(decoded.size()), [&](uint32_t i) {
+            if (!decoded[i].empty()) {
+                quality[i] = compareFrames(describeFrame(FOURCC_I420, W, H, sequence[original[i]].data()), describeFrame(FOURCC_I420, W, H, decoded[i].data()));
+            }
+        });
+        const auto QUALITY_END{std::chrono::steady_clock::now()};
+
+        double psnr{0};
+        double psnrY{0};
+        double ssim{0};
+        double psnrMin{std::numeric_limits<double>::max()};
+        double ssimMin{std::numeric_limits<double>::max()};
+        uint32_t compared{0};
+        for (std::size_t i{0}; i < quality.size(); i++) {
+            if (!decoded[i].empty()) {
+                psnr += quality[i].psnr;
+                psnrY += quality[i].psnrY;
+                ssim += quality[i].ssim;
+                psnrMin = std::min(psnrMin, quality[i].psnr);
+                ssimMin = std::min(ssimMin, quality[i].ssim);
+                compared++;
+            }
+        }
+        auto seconds = [](std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+            return std::max(static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()) / (1000.0 * 1000.0), 1e-6);
+        };
+        const double C{static_cast<double>(std::max(compared, 1u))};
+
+        BenchResult r;
+        r.name = NAME;
+        r.width = W;
+        r.height = H;
+        r.iterations = LENGTH;
+        r.microsecondsPerIteration = seconds(ENCODE_START, ENCODE_END) * 1000.0 * 1000.0 / LENGTH;
+        r.metrics.emplace_back("rc_mode", setting.rcMode);
+        r.metrics.emplace_back("target_kbps", setting.bitrate);
+        r.metrics.emplace_back("init_qp", setting.initQP);
+        r.metrics.emplace_back("gop", GOP);
+        r.metrics.emplace_back("kbps", static_cast<double>(bytes) * 8.0 * FPS / LENGTH / 1000.0);
+        r.metrics.emplace_back("bytes_per_frame", static_cast<double>(bytes) / LENGTH);
+        r.metrics.emplace_back("psnr", (0 < compared) ? psnr / C : 0.0);
+        r.metrics.emplace_back("psnr_min", (0 < compared) ? psnrMin : 0.0);
+        r.metrics.emplace_back("psnr_y", (0 < compared) ? psnrY / C : 0.0);
+        r.metrics.emplace_back("ssim", (0 < compared) ? ssim / C : 0.0);
+        r.metrics.emplace_back("ssim_min", (0 < compared) ? ssimMin : 0.0);
+        r.metrics.emplace_back("frames_missing", LENGTH - compared);
+        r.metrics.emplace_back("encode_fps", LENGTH / seconds(ENCODE_START, ENCODE_END));
+        r.metrics.emplace_back("decode_fps", encoded.size() / std::max(std::chrono::duration<double>(decoding).count(), 1e-6));
+        r.metrics.emplace_back("quality_fps", compared / seconds(QUALITY_START, QUALITY_END));
+        r.metrics.emplace_back("threads", THREADS);
+        if (0 < decodingFailed) {
+            std::cerr << "[bench-quality]: Failed to decode " << decodingFailed << " frames of " << NAME << "." << std::endl;
+        }
+        if (TABLE) {
+            results.push_back(r);
+        }
+        else {
+            printJSON(r);
+        }
+    }
+
+    if (TABLE) {
+        auto metric = [](const BenchResult &r, const std::string &name) {
+            for (const auto &m : r.metrics) {
+                if (name == m.first) {
+                    return m.second;
+                }
+            }
+            return 0.0;
+        };
+        std::printf("Rate-distortion of '%s' at %ux%u, %u frames, GOP %u:\n", ENCODER.c_str(), W, H, LENGTH, GOP);
+        std::printf("%-6s %11s %7s %9s %9s %9s %9s %7s %8s\n", "rc", "target kbps", "init-qp", "kbps", "PSNR dB", "min dB", "PSNR-Y dB", "SSIM", "min SSIM");
+        for (const auto &r : results) {
+            std::printf("%-6s %11.0f %7.0f %9.1f %9.2f %9.2f %9.2f %7.4f %8.4f\n", rcModeName(static_cast<uint32_t>(metric(r, "rc_mode"))), metric(r, "target_kbps"), metric(r, "init_qp"),
+                        metric(r, "kbps"), metric(r, "psnr"), metric(r, "psnr_min"), metric(r, "psnr_y"), metric(r, "ssim"), metric(r, "ssim_min"));
+        }
+        std::printf("\nThroughput in frames per second with %u threads:\n", THREADS);
+        std::printf("%-6s %11s %7s %9s %9s %11s\n", "rc", "target kbps", "init-qp", "encode", "decode", "PSNR+SSIM");
+        for (const auto &r : results) {
+            std::printf("%-6s %11.0f %7.0f %9.1f %9.1f %11.1f\n", rcModeName(static_cast<uint32_t>(metric(r, "rc_mode"))), metric(r, "target_kbps"), metric(r, "init_qp"),
+                        metric(r, "encode_fps"), metric(r, "decode_fps"), metric(r, "quality_fps"));
+        }
+    }
+    return 0;
+}
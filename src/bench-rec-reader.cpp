@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "bench.hpp"
+#include "rec-reader.hpp"
+#include "thread-pool.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Writes a recording of about the given size with VP9-sized ImageReadings at 30 fps and a TimeStamp every second.
+static bool createRecording(const std::string &name, uint64_t size) noexcept {
+    std::ofstream out(name, std::ios::binary | std::ios::trunc);
+    std::mt19937 random{42};
+    std::uniform_int_distribution<uint32_t> frameSize{20*1024, 200*1024};
+    std::string data;
+    uint64_t written{0};
+    for (uint32_t n{0}; out.good() && (written < size); n++) {
+        data.resize(frameSize(random));
+        for (auto &c : data) {
+            c = static_cast<char>(random());
+        }
+        opendlv::proxy::ImageReading ir;
+        ir.fourcc("VP90").width(1920).height(1080).data(data);
+        cluon::data::Envelope envelope;
+        cluon::ToProtoVisitor encoder;
+        ir.accept(encoder);
+        envelope.dataType(ir.ID()).serializedData(encoder.encodedData()).sampleTimeStamp(cluon::time::fromMicroseconds(n * 33333)).senderStamp(0);
+        const std::string SERIALIZED{cluon::serializeEnvelope(std::move(envelope))};
+        out.write(SERIALIZED.data(), static_cast<std::streamsize>(SERIALIZED.size()));
+        written += SERIALIZED.size();
+
+        if (0 == (n % 30)) {
+            cluon::data::TimeStamp ts{cluon::time::fromMicroseconds(n * 33333)};
+            cluon::ToProtoVisitor tsEncoder;
+            ts.accept(tsEncoder);
+            cluon::data::Envelope tsEnvelope;
+            tsEnvelope.dataType(ts.ID()).serializedData(tsEncoder.encodedData()).senderStamp(0);
+            const std::string TS{cluon::serializeEnvelope(std::move(tsEnvelope))};
+            out.write(TS.data(), static_cast<std::streamsize>(TS.size()));
+            written += TS.size();
+        }
+    }
+    return out.good();
+}
+
+// Reads one byte per page of the payload so that every variant has to bring all data into memory.
+static uint64_t touch(const char *data, std::size_t size) noexcept {
+    uint64_t sum{0};
+    for (std::size_t i{0}; i < size; i += 4096) {
+        sum += static_cast<uint8_t>(data[i]);
+    }
+    return sum;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures how fast all envelopes of a .rec file are read with cluon::Player, cluon::extractEnvelope, and the memory-mapped RecReader (sequentially and in parallel) and prints one JSON object per result." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--rec=<file.rec>] [--size=<MB>] [--threads=<threads>] [--duration=<ms per benchmark>]" << std::endl;
+        std::cerr << "         --rec:     .rec file to read (default: a synthetic recording of --size MB in /tmp)" << std::endl;
+        return 1;
+    }
+    const bool SYNTHETIC{commandlineArguments["rec"].size() == 0};
+    const std::string REC{SYNTHETIC ? "/tmp/bench-rec-reader.rec" : commandlineArguments["rec"]};
+    const uint64_t SIZE{((commandlineArguments["size"].size() != 0) ? static_cast<uint64_t>(std::stoi(commandlineArguments["size"])) : 256) * 1024 * 1024};
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 4};
+    const std::chrono::milliseconds DURATION{(commandlineArguments["duration"].size() != 0) ? std::stoi(commandlineArguments["duration"]) : 2000};
+
+    if (SYNTHETIC && !createRecording(REC, SIZE)) {
+        std::cerr << "[bench-rec-reader]: Could not create '" << REC << "'." << std::endl;
+        return 1;
+    }
+    uint64_t fileSize{0};
+    {
+        RecReader reader{REC};
+        if (!reader.good()) {
+            std::cerr << "[bench-rec-reader]: Could not open '" << REC << "'." << std::endl;
+            return 1;
+        }
+        fileSize = reader.size();
+    }
+
+    // Each variant visits all envelopes and sums the bytes sampled by touch() so that the results can be cross-checked.
+    struct Variant {
+        std::string name;
+        std::function<void(uint64_t &envelopes, uint64_t &checksum)> scan;
+    };
+    std::unique_ptr<ThreadPool> threadPool{(1 < THREADS) ? new ThreadPool(THREADS - 1) : nullptr};
+    const std::vector<Variant> VARIANTS{
+        {"rec.player", [&REC](uint64_t &envelopes, uint64_t &checksum) {
+            cluon::Player player(REC, false, false);
+            while (player.hasMoreData()) {
+                auto next = player.getNextEnvelopeToBeReplayed();
+                if (next.first) {
+                    envelopes++;
+                    const std::string DATA{next.second.serializedData()};
+                    checksum += touch(DATA.data(), DATA.size());
+                }
+            }
+        }},
+        {"rec.extractEnvelope", [&REC](uint64_t &envelopes, uint64_t &checksum) {
+            std::ifstream in(REC, std::ios::binary);
+            while (in.good()) {
+                auto next = cluon::extractEnvelope(in);
+                if (next.first) {
+                    envelopes++;
+                    const std::string DATA{next.second.serializedData()};
+                    checksum += touch(DATA.data(), DATA.size());
+                }
+            }
+        }},
+        {"rec.mmap", [&REC](uint64_t &envelopes, uint64_t &checksum) {
+            RecReader reader{REC};
+            reader.forEach([&](const EnvelopeView &view) {
+                envelopes++;
+                checksum += touch(view.serializedData, view.serializedSize);
+            });
+        }},
+        {"rec.mmap.parallel", [&REC, &threadPool, THREADS](uint64_t &envelopes, uint64_t &checksum) {
+            RecReader reader{REC};
+            const auto RANGES{reader.split(THREADS)};
+            std::vector<uint64_t> envelopesPerRange(RANGES.size(), 0);
+            std::vector<uint64_t> checksumPerRange(RANGES.size(), 0);
+            auto scanRange = [&](uint32_t i) {
+                reader.forEach([&envelopesPerRange, &checksumPerRange, i](const EnvelopeView &view) {
+                    envelopesPerRange[i]++;
+                    checksumPerRange[i] += touch(view.serializedData, view.serializedSize);
+                }, RANGES[i].first, RANGES[i].second);
+            };
+            if (threadPool) {
+                threadPool->parallelFor(static_cast<uint32_t>(RANGES.size()), scanRange);
+            }
+            else {
+                for (uint32_t i{0}; i < RANGES.size(); i++) {
+                    scanRange(i);
+                }
+            }
+            for (std::size_t i{0}; i < RANGES.size(); i++) {
+                envelopes += envelopesPerRange[i];
+                checksum += checksumPerRange[i];
+            }
+        }},
+    };
+
+    uint64_t expectedEnvelopes{0};
+    uint64_t expectedChecksum{0};
+    for (const auto &variant : VARIANTS) {
+        uint64_t envelopes{0};
+        uint64_t checksum{0};
+        BenchResult r = measure(variant.name, 0, 0, [&]() {
+            envelopes = 0;
+            checksum = 0;
+            variant.scan(envelopes, checksum);
+        }, DURATION, 3);
+        if (0 == expectedEnvelopes) {
+            expectedEnvelopes = envelopes;
+            expectedChecksum = checksum;
+        }
+        else if ( (expectedEnvelopes != envelopes) || (expectedChecksum != checksum) ) {
+            std::cerr << "[bench-rec-reader]: " << variant.name << " read " << envelopes << " envelopes (checksum " << checksum << ") instead of "
+                      << expectedEnvelopes << " (checksum " << expectedChecksum << ")." << std::endl;
+        }
+        r.metrics.emplace_back("file_bytes", static_cast<double>(fileSize));
+        r.metrics.emplace_back("envelopes", static_cast<double>(envelopes));
+        r.metrics.emplace_back("gb_per_s", static_cast<double>(fileSize) / r.microsecondsPerIteration / 1000.0);
+        r.metrics.emplace_back("threads", ("rec.mmap.parallel" == variant.name) ? THREADS : 1);
+        printJSON(r);
+    }
+
+    if (SYNTHETIC) {
+        std::remove(REC.c_str());
+    }
+    return 0;
+}
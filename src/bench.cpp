@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "bench.hpp"
+#include "encoder-backends.hpp"
+#include "encoder-branch.hpp"
+#include "frame.hpp"
+#include "frame-handoff.hpp"
+#include "frame-pool.hpp"
+#include "image-reading-envelope.hpp"
+#include "rec-file.hpp"
+#include "rec-writer.hpp"
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stands in for an encoder that does no work and emits a small frame so that the rest of the recording path is measured.
+class NullEncoderBackend : public EncoderBackend {
+   public:
+    const char *name() const noexcept override { return "null"; }
+    std::string fourcc() const noexcept override { return "NULL"; }
+    bool accepts(uint32_t fourcc) const noexcept override { return FOURCC_I420 == fourcc; }
+    uint32_t preferredFourcc() const noexcept override { return FOURCC_I420; }
+    bool open(const EncoderSettings &) noexcept override { return true; }
+    bool encode(const Frame &frame) noexcept override {
+        m_timeStamp = frame.timeStamp;
+        m_pending = true;
+        return true;
+    }
+    EncoderStatus getOutput(EncodedFrame &encodedFrame, bool) noexcept override {
+        if (!m_pending) {
+            return EncoderStatus::NoMore;
+        }
+        m_pending = false;
+        encodedFrame.data = m_data.data();
+        encodedFrame.size = static_cast<uint32_t>(m_data.size());
+        encodedFrame.timeStamp = m_timeStamp;
+        encodedFrame.keyFrame = true;
+        return EncoderStatus::Ok;
+    }
+    void flush() noexcept override {}
+    void close() noexcept override {}
+
+   private:
+    std::vector<uint8_t> m_data = std::vector<uint8_t>(1024, 0);
+    int64_t m_timeStamp{0};
+    bool m_pending{false};
+};
+
+// Writes into a file that is started over after 1 GiB so that long runs do not fill the disk.
+class BenchFile {
+   public:
+    explicit BenchFile(const std::string &name) noexcept
+        : m_name(name)
+        , m_recFile(new RecFile(name)) {}
+
+    ~BenchFile() {
+        m_recFile.reset();
+        std::remove(m_name.c_str());
+        std::remove(recIndexName(m_name).c_str());
+    }
+
+    RecFile &recFile() noexcept {
+        if (m_recFile->offset() > LIMIT) {
+            m_recFile.reset(new RecFile(m_name));
+        }
+        return *m_recFile;
+    }
+
+   private:
+    static const uint64_t LIMIT{1024ull * 1024 * 1024};
+    std::string m_name;
+    std::unique_ptr<RecFile> m_recFile;
+};
+
+static void runMicrobenchmarks(const std::string &directory, std::chrono::milliseconds duration) noexcept {
+    for (const auto &resolution : benchResolutions()) {
+        const uint32_t W{resolution.first};
+        const uint32_t H{resolution.second};
+        const uint32_t SIZE{frameSize(FOURCC_I420, W, H)};
+        const double MB{static_cast<double>(SIZE) / (1024.0 * 1024.0)};
+        // Raw frames are the largest payloads the recorder writes (--encoder=raw); encoded frames are a fraction thereof.
+        const std::vector<uint8_t> FRAME{createSequence(W, H, 1).front()};
+        auto addThroughput = [MB](BenchResult &r) {
+            r.metrics.emplace_back("mb_per_s", MB * 1000.0 * 1000.0 / r.microsecondsPerIteration);
+            printJSON(r);
+        };
+
+        // Copy of an I420 frame out of the shared memory area as done by the recorder for simulcast.
+        {
+            cluon::SharedMemory sharedMemory{"bench-" + std::to_string(::getpid()), SIZE};
+            if (sharedMemory.valid()) {
+                std::memcpy(sharedMemory.data(), FRAME.data(), SIZE);
+                FramePool pool(SIZE, 4);
+                BenchResult r = measure("copy.shm.i420", W, H, [&]() {
+                    std::shared_ptr<uint8_t> buffer{pool.acquire()};
+                    sharedMemory.lock();
+                    std::memcpy(buffer.get(), sharedMemory.data(), SIZE);
+                    sharedMemory.unlock();
+                }, duration);
+                addThroughput(r);
+            }
+            else {
+                std::cerr << "[bench]: Could not create shared memory; skipping copy.shm.i420." << std::endl;
+            }
+        }
+
+        // Encoding an ImageReading with its payload into Protobuf.
+        std::string imageReading;
+        {
+            BenchResult r = measure("proto.imagereading", W, H, [&]() {
+                opendlv::proxy::ImageReading ir;
+                ir.fourcc("I420").width(W).height(H).data(std::string(reinterpret_cast<const char*>(FRAME.data()), SIZE));
+                cluon::ToProtoVisitor protoEncoder;
+                ir.accept(protoEncoder);
+                imageReading = protoEncoder.encodedData();
+            }, duration);
+            addThroughput(r);
+        }
+
+        // Wrapping the serialized ImageReading into an Envelope with the OD4 header.
+        std::string serializedEnvelope;
+        auto serialize = [&]() {
+            cluon::data::Envelope envelope;
+            envelope.dataType(opendlv::proxy::ImageReading::ID()).serializedData(imageReading).sent(cluon::time::now()).sampleTimeStamp(cluon::time::now());
+            serializedEnvelope = cluon::serializeEnvelope(std::move(envelope));
+        };
+        {
+            BenchResult r = measure("serialize.envelope", W, H, serialize, duration);
+            addThroughput(r);
+        }
+
+        // The zero-copy alternative to the two steps above as used by the recorder.
+        {
+            BenchResult r = measure("serialize.image-reading-envelope", W, H, [&]() {
+                ImageReadingEnvelope envelope("I420", W, H, FRAME.data(), SIZE, cluon::time::now(), 0);
+                (void)envelope.size();
+            }, duration);
+            addThroughput(r);
+        }
+
+        // Write variants: std::ofstream as used with cluon, RecFile with a copy, and RecFile with writev from the frame.
+        const std::string NAME{directory + "/bench-" + std::to_string(::getpid()) + ".rec"};
+        {
+            BenchResult r;
+            {
+                uint64_t written{0};
+                std::unique_ptr<std::ofstream> out{new std::ofstream(NAME, std::ios::binary | std::ios::trunc)};
+                r = measure("write.ofstream", W, H, [&]() {
+                    if (written > 1024ull * 1024 * 1024) {
+                        out.reset(new std::ofstream(NAME, std::ios::binary | std::ios::trunc));
+                        written = 0;
+                    }
+                    serialize();
+                    out->write(serializedEnvelope.data(), static_cast<std::streamsize>(serializedEnvelope.size()));
+                    written += serializedEnvelope.size();
+                }, duration);
+            }
+            std::remove(NAME.c_str());
+            addThroughput(r);
+        }
+        {
+            BenchFile file{NAME};
+            BenchResult r = measure("write.recfile", W, H, [&]() {
+                serialize();
+                file.recFile().write(serializedEnvelope);
+            }, duration);
+            addThroughput(r);
+        }
+        {
+            BenchFile file{NAME};
+            BenchResult r = measure("write.recfile.writev", W, H, [&]() {
+                ImageReadingEnvelope envelope("I420", W, H, FRAME.data(), SIZE, cluon::time::now(), 0);
+                struct iovec iov[3];
+                envelope.toIovec(iov);
+                file.recFile().write(iov, 3);
+            }, duration);
+            addThroughput(r);
+        }
+    }
+}
+
+// Runs a producer writing synthetic frames into a shared memory area as fast as possible and a recorder
+// that captures, encodes, and writes them to disk like video-qsv-vp9-recorder does.
+static void runMacrobenchmark(const std::string &encoder, uint32_t width, uint32_t height, uint32_t threads, std::chrono::microseconds spin,
+                              uint32_t slots, const std::string &directory, std::chrono::milliseconds duration) noexcept {
+    std::unique_ptr<EncoderBackend> backend{("null" == encoder) ? std::unique_ptr<EncoderBackend>(new NullEncoderBackend()) : createEncoderBackend(encoder)};
+    if (!backend) {
+        std::cerr << "[bench]: Unknown encoder '" << encoder << "'." << std::endl;
+        return;
+    }
+    const uint32_t SIZE{frameSize(FOURCC_I420, width, height)};
+    const std::string NAME{"bench-e2e-" + std::to_string(::getpid())};
+    cluon::SharedMemory producerMemory{NAME, (1 < slots) ? FrameRing::sizeOf(SIZE, slots) : FrameHandoff::sizeWithTrailer(SIZE)};
+    cluon::SharedMemory sharedMemory{NAME};
+    if (!producerMemory.valid() || !sharedMemory.valid()) {
+        std::cerr << "[bench]: Could not create shared memory; skipping e2e." << encoder << "." << std::endl;
+        return;
+    }
+
+    // Encoded frames are handed to the RecWriter's thread as by the recorder, i.e., copied only if they have no buffer of their own;
+    // the file is started over after 1 GiB so that long runs do not fill the disk.
+    const std::string REC{directory + "/" + NAME + ".rec"};
+    const uint64_t REC_LIMIT{1024ull * 1024 * 1024};
+    RecWriter recWriter{std::chrono::steady_clock::now(), 0, 0, false};
+    recWriter.open(REC, std::chrono::steady_clock::now());
+    uint64_t framesQueued{0};
+    uint64_t bytesQueued{0};
+    uint64_t bytesInFile{0};
+    uint64_t framesDuplicated{0};
+    int64_t latency{0};
+    int64_t lastTimeStamp{-1};
+    auto writer = [&](const EncoderBranch &branch, const EncodedFrame &encodedFrame) {
+        ImageReadingEnvelope envelope(branch.encoder().fourcc(), branch.settings().width, branch.settings().height, encodedFrame.data, encodedFrame.size,
+                                      cluon::time::fromMicroseconds(encodedFrame.timeStamp), branch.senderStamp());
+        if (!envelope.valid()) {
+            recWriter.failed();
+            return;
+        }
+        FrameRecord record;
+        record.senderStamp = branch.senderStamp();
+        record.timeStamp = encodedFrame.timeStamp;
+        record.size = encodedFrame.size;
+        record.keyFrame = encodedFrame.keyFrame;
+        record.encodingDuration = encodedFrame.encodingDuration;
+        const uint64_t BYTES{envelope.size()};
+        if (bytesInFile + BYTES > REC_LIMIT) {
+            recWriter.open(REC, std::chrono::steady_clock::now());
+            bytesInFile = 0;
+        }
+        if (recWriter.write(envelope, encodedFrame.buffer, record)) {
+            framesQueued++;
+            bytesQueued += BYTES;
+            bytesInFile += BYTES;
+            // Time until the frame is handed to the writer's thread, as the recorder's capture thread sees it.
+            latency += cluon::time::toMicroseconds(cluon::time::now()) - encodedFrame.timeStamp;
+            // The same shared memory content is encoded again when the recorder wakes up without a new frame.
+            framesDuplicated += (lastTimeStamp == encodedFrame.timeStamp) ? 1 : 0;
+            lastTimeStamp = encodedFrame.timeStamp;
+        }
+    };
+
+    EncoderSettings settings;
+    settings.threads = threads;
+    EncoderBranch branch(0, std::move(backend), FOURCC_I420, width, height, Preprocessing(), settings, nullptr, writer);
+    if (!branch.open()) {
+        std::cerr << "[bench]: Skipping e2e." << encoder << " at " << width << "x" << height << "." << std::endl;
+        return;
+    }
+
+    const uint32_t SEQUENCE_LENGTH{8};
+    const std::vector<std::vector<uint8_t>> SEQUENCE{createSequence(width, height, SEQUENCE_LENGTH)};
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> framesProduced{0};
+    FrameRing ring{producerMemory.data(), producerMemory.size()};
+    if ( (1 < slots) && !ring.initialize(SIZE, slots) ) {
+        std::cerr << "[bench]: Could not lay out " << slots << " slots; skipping e2e." << encoder << "." << std::endl;
+        return;
+    }
+    std::thread producer([&]() {
+        while ( (1 < slots) && !done.load() ) {
+            const int32_t SLOT{ring.beginWrite()};
+            if (0 <= SLOT) {
+                std::memcpy(ring.data(SLOT), SEQUENCE[framesProduced.load() % SEQUENCE_LENGTH].data(), SIZE);
+                ring.endWrite(SLOT, SIZE, cluon::time::toMicroseconds(cluon::time::now()));
+                producerMemory.notifyAll();
+                framesProduced++;
+            }
+        }
+        while (!done.load()) {
+            producerMemory.lock();
+            std::memcpy(producerMemory.data(), SEQUENCE[framesProduced.load() % SEQUENCE_LENGTH].data(), SIZE);
+            producerMemory.setTimeStamp(cluon::time::now());
+            FrameHandoff::publish(producerMemory, SIZE);
+            producerMemory.unlock();
+            producerMemory.notifyAll();
+            framesProduced++;
+        }
+    });
+
+    FrameHandoff handoff{sharedMemory, SIZE};
+    handoff.spin(spin);
+    const auto START{std::chrono::steady_clock::now()};
+    while (branch.good() && (std::chrono::steady_clock::now() - START < duration)) {
+        if (!handoff.acquire()) {
+            continue;
+        }
+        Frame frame{branch.preprocessor().process(handoff.data(), handoff.timeStamp())};
+        if (branch.preprocessor().converts()) {
+            handoff.release();
+        }
+        branch.encode(frame);
+        handoff.release();
+    }
+    branch.drain(std::chrono::steady_clock::now() + std::chrono::seconds(5));
+    // All frames are on disk only when the writer is done.
+    recWriter.stop(std::chrono::steady_clock::now() + std::chrono::seconds(5));
+    const auto ELAPSED{std::chrono::steady_clock::now() - START};
+    done = true;
+    producer.join();
+    std::remove(REC.c_str());
+    std::remove(recIndexName(REC).c_str());
+    const uint64_t FRAMES_WRITTEN{recWriter.framesWritten()};
+
+    BenchResult r;
+    r.name = "e2e." + encoder;
+    r.width = width;
+    r.height = height;
+    r.iterations = FRAMES_WRITTEN;
+    r.microsecondsPerIteration = static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(ELAPSED).count()) / static_cast<double>((0 < FRAMES_WRITTEN) ? FRAMES_WRITTEN : 1);
+    r.metrics.emplace_back("fps", 1000.0 * 1000.0 / r.microsecondsPerIteration);
+    r.metrics.emplace_back("frames_produced", static_cast<double>(framesProduced.load()));
+    r.metrics.emplace_back("frames_encoded", static_cast<double>(branch.framesEncoded()));
+    r.metrics.emplace_back("frames_duplicated", static_cast<double>(framesDuplicated));
+    r.metrics.emplace_back("frames_dropped", static_cast<double>(recWriter.framesDropped()));
+    r.metrics.emplace_back("frames_missed", static_cast<double>(handoff.framesMissed()));
+    r.metrics.emplace_back("wakeups_ignored", static_cast<double>(handoff.duplicateWakeups()));
+    r.metrics.emplace_back("frames_spun", static_cast<double>(handoff.framesSpun()));
+    r.metrics.emplace_back("slots", (1 < slots) ? slots : 1);
+    r.metrics.emplace_back("mb_per_s", static_cast<double>(bytesQueued) / (1024.0 * 1024.0) / (r.microsecondsPerIteration * static_cast<double>(r.iterations) / (1000.0 * 1000.0)));
+    r.metrics.emplace_back("latency_us", (0 < framesQueued) ? static_cast<double>(latency) / static_cast<double>(framesQueued) : 0.0);
+    printJSON(r);
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures the recording hot path from 640x480 to 3840x2160 and prints one JSON object per result." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--micro] [--macro] [--encoders=<list of encoders>] [--threads=<encoder threads>] [--spin=<us>] [--slots=<slots>] [--dir=<directory>] [--duration=<ms per benchmark>]" << std::endl;
+        std::cerr << "         --micro:    only run the microbenchmarks (shared memory copy, Protobuf encoding, envelope serialization, writing)" << std::endl;
+        std::cerr << "         --macro:    only run the end-to-end benchmark (producer -> shared memory -> encoder -> disk)" << std::endl;
+        std::cerr << "         --encoders: comma-separated list of encoders for the end-to-end benchmark (default: null,vpx); null does not encode at all" << std::endl;
+        std::cerr << "         --threads:  encoder threads (default: all cores)" << std::endl;
+        std::cerr << "         --spin:     time in microseconds to busy-poll for the next frame in the end-to-end benchmark (default: 0)" << std::endl;
+        std::cerr << "         --slots:    number of frames in the shared memory area of the end-to-end benchmark; more than 1 uses a FrameRing (default: 1)" << std::endl;
+        std::cerr << "         --dir:      directory for the files written (default: .)" << std::endl;
+        return 1;
+    }
+    const bool MICRO{(commandlineArguments.count("micro") != 0) || (commandlineArguments.count("macro") == 0)};
+    const bool MACRO{(commandlineArguments.count("macro") != 0) || (commandlineArguments.count("micro") == 0)};
+    const std::string ENCODERS{(commandlineArguments["encoders"].size() != 0) ? commandlineArguments["encoders"] : "null,vpx"};
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 0};
+    const std::chrono::microseconds SPIN{(commandlineArguments["spin"].size() != 0) ? std::stoi(commandlineArguments["spin"]) : 0};
+    const uint32_t SLOTS{(commandlineArguments["slots"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["slots"])) : 1};
+    const std::string DIRECTORY{(commandlineArguments["dir"].size() != 0) ? commandlineArguments["dir"] : "."};
+    const std::chrono::milliseconds DURATION{(commandlineArguments["duration"].size() != 0) ? std::stoi(commandlineArguments["duration"]) : 2000};
+
+    if (MICRO) {
+        runMicrobenchmarks(DIRECTORY, DURATION);
+    }
+    if (MACRO) {
+        std::stringstream sstr(ENCODERS);
+        std::string encoder;
+        while (std::getline(sstr, encoder, ',')) {
+            for (const auto &resolution : benchResolutions()) {
+                runMacrobenchmark(encoder, resolution.first, resolution.second, THREADS, SPIN, SLOTS, DIRECTORY, DURATION);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "frame.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Result of a benchmark; printed as one JSON object per line.
+ */
+struct BenchResult {
+    std::string name{""};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint64_t iterations{0};
+    double microsecondsPerIteration{0};
+    // Additional metrics as name/value pairs, e.g. throughput.
+    std::vector<std::pair<std::string, double>> metrics{};
+};
+
+inline void printJSON(const BenchResult &r, std::ostream &out = std::cout) noexcept {
+    out << "{\"benchmark\":\"" << r.name << "\",\"width\":" << r.width << ",\"height\":" << r.height
+        << ",\"iterations\":" << r.iterations << ",\"us_per_iteration\":" << r.microsecondsPerIteration;
+    if (0 < r.width * r.height) {
+        out << ",\"mpixel_per_s\":" << (r.width * r.height) / r.microsecondsPerIteration;
+    }
+    for (const auto &m : r.metrics) {
+        out << ",\"" << m.first << "\":" << m.second;
+    }
+    out << "}" << std::endl;
+}
+
+/**
+ * This method runs task repeatedly after a short warm-up until at least
+ * minimumDuration has passed (and at least minimumIterations were run).
+ */
+template <typename Task>
+inline BenchResult measure(const std::string &name, uint32_t width, uint32_t height, Task &&task,
+                           std::chrono::milliseconds minimumDuration = std::chrono::milliseconds(500), uint64_t minimumIterations = 10) noexcept {
+    const uint32_t WARMUP{3};
+    for (uint32_t i{0}; i < WARMUP; i++) {
+        task();
+    }
+
+    BenchResult r;
+    r.name = name;
+    r.width = width;
+    r.height = height;
+    const auto START{std::chrono::steady_clock::now()};
+    auto now{START};
+    while ( (r.iterations < minimumIterations) || (now - START < minimumDuration) ) {
+        task();
+        r.iterations++;
+        now = std::chrono::steady_clock::now();
+    }
+    r.microsecondsPerIteration = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - START).count()) / 1000.0 / static_cast<double>(r.iterations);
+    return r;
+}
+
+/**
+ * @return Synthetic I420 sequence: a moving gradient with some texture so that neither intra nor inter prediction is trivial.
+ */
+inline std::vector<std::vector<uint8_t>> createSequence(uint32_t width, uint32_t height, uint32_t length) noexcept {
+    std::vector<std::vector<uint8_t>> sequence;
+    uint32_t noise{12345};
+    for (uint32_t n{0}; n < length; n++) {
+        std::vector<uint8_t> f(frameSize(FOURCC_I420, width, height));
+        for (uint32_t y{0}; y < height; y++) {
+            for (uint32_t x{0}; x < width; x++) {
+                noise = noise * 1103515245u + 12345u;
+                f[y * width + x] = static_cast<uint8_t>(((x + 4 * n) ^ (y + 2 * n)) + ((noise >> 28) & 0x3));
+            }
+        }
+        for (uint32_t i{width * height}; i < f.size(); i++) {
+            f[i] = static_cast<uint8_t>(128 + ((i + n) & 0xF));
+        }
+        sequence.push_back(f);
+    }
+    return sequence;
+}
+
+/**
+ * @return Resolutions from VGA to 4K used by the benchmarks.
+ */
+inline std::vector<std::pair<uint32_t, uint32_t>> benchResolutions() noexcept {
+    return {{640, 480}, {1280, 720}, {1920, 1080}, {2048, 1536}, {3840, 2160}};
+}
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTAINER_WRITER_HPP
+#define CONTAINER_WRITER_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * @return true if the VP8 (fourcc VP80) or VP9 (VP90) frame is a key frame.
+ */
+inline bool isVpxKeyFrame(const std::string &fourcc, const std::string &frame) noexcept {
+    if (frame.empty()) {
+        return false;
+    }
+    const uint8_t B{static_cast<uint8_t>(frame[0])};
+    if ("VP80" == fourcc) {
+        return (0 == (B & 0x01));
+    }
+    // VP9 uncompressed header: frame_marker(2), profile_low_bit, profile_high_bit, [reserved_zero if profile 3], show_existing_frame, frame_type.
+    const uint8_t PROFILE{static_cast<uint8_t>(((B >> 5) & 0x01) | (((B >> 4) & 0x01) << 1))};
+    const uint8_t SHIFT{static_cast<uint8_t>((3 == PROFILE) ? 2 : 3)};
+    const bool SHOW_EXISTING_FRAME{0 != ((B >> SHIFT) & 0x01)};
+    const bool INTER_FRAME{0 != ((B >> (SHIFT - 1)) & 0x01)};
+    return (0x02 == (B >> 6)) && !SHOW_EXISTING_FRAME && !INTER_FRAME;
+}
+
+/**
+ * ContainerWriter streams compressed video frames of a single track into a
+ * file. Frames are appended without being buffered; sizes and counters that
+ * are only known at the end are patched in place by end(), so memory use
+ * does not depend on the length of the video.
+ */
+class ContainerWriter {
+   private:
+    ContainerWriter(const ContainerWriter &) = delete;
+    ContainerWriter(ContainerWriter &&)      = delete;
+    ContainerWriter &operator=(const ContainerWriter &) = delete;
+    ContainerWriter &operator=(ContainerWriter &&) = delete;
+
+   public:
+    explicit ContainerWriter(const std::string &name) noexcept
+        : m_fd(::open(name.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) {}
+
+    virtual ~ContainerWriter() {
+        if (-1 != m_fd) {
+            ::close(m_fd);
+        }
+    }
+
+    bool good() const noexcept {
+        return (-1 != m_fd) && !m_failed;
+    }
+
+    /**
+     * This method writes the file header.
+     *
+     * @param fourcc VP80 or VP90.
+     */
+    virtual bool begin(const std::string &fourcc, uint32_t width, uint32_t height) noexcept = 0;
+
+    /**
+     * This method appends a frame.
+     *
+     * @param timeStamp Presentation time stamp in microseconds relative to the first frame.
+     */
+    virtual bool write(const std::string &frame, int64_t timeStamp, bool keyFrame) noexcept = 0;
+
+    /**
+     * This method completes the file; no frames may be written afterwards.
+     */
+    virtual bool end() noexcept = 0;
+
+   protected:
+    uint64_t offset() const noexcept {
+        return m_offset;
+    }
+
+    bool append(const void *header, std::size_t headerSize, const void *data = nullptr, std::size_t size = 0) noexcept {
+        struct iovec iov[2];
+        iov[0].iov_base = const_cast<void*>(header);
+        iov[0].iov_len = headerSize;
+        iov[1].iov_base = const_cast<void*>(data);
+        iov[1].iov_len = size;
+        struct iovec *next{iov};
+        int count{(0 < size) ? 2 : 1};
+        while (good() && (0 < count)) {
+            if (0 == next->iov_len) {
+                next++;
+                count--;
+                continue;
+            }
+            ssize_t n = ::writev(m_fd, next, count);
+            if (0 == n) {
+                // No progress without an error, e.g., on a full device; retrying would not end.
+                m_failed = true;
+                continue;
+            }
+            if (0 > n) {
+                m_failed = (EINTR != errno);
+                continue;
+            }
+            m_offset += static_cast<uint64_t>(n);
+            std::size_t written{static_cast<std::size_t>(n)};
+            while ( (0 < count) && (next->iov_len <= written) ) {
+                written -= next->iov_len;
+                next++;
+                count--;
+            }
+            if (0 < count) {
+                next->iov_base = static_cast<char*>(next->iov_base) + written;
+                next->iov_len -= written;
+            }
+        }
+        return good();
+    }
+
+    bool patch(uint64_t position, const void *data, std::size_t size) noexcept {
+        const char *next{static_cast<const char*>(data)};
+        while (good() && (0 < size)) {
+            ssize_t n = ::pwrite(m_fd, next, size, static_cast<off_t>(position));
+            if (0 == n) {
+                m_failed = true;
+                continue;
+            }
+            if (0 > n) {
+                m_failed = (EINTR != errno);
+                continue;
+            }
+            next += n;
+            size -= static_cast<std::size_t>(n);
+            position += static_cast<uint64_t>(n);
+        }
+        return good();
+    }
+
+   private:
+    int m_fd{-1};
+    bool m_failed{false};
+    uint64_t m_offset{0};
+};
+
+/**
+ * IvfWriter writes IVF files with a time base of one microsecond.
+ */
+class IvfWriter : public ContainerWriter {
+   public:
+    explicit IvfWriter(const std::string &name) noexcept
+        : ContainerWriter(name) {}
+
+    bool begin(const std::string &fourcc, uint32_t width, uint32_t height) noexcept override {
+        uint8_t header[HEADER_SIZE];
+        std::memset(header, 0, sizeof(header));
+        std::memcpy(header, "DKIF", 4);
+        putLE(header + 6, HEADER_SIZE, 2);
+        std::memcpy(header + 8, fourcc.data(), std::min<std::size_t>(fourcc.size(), 4));
+        putLE(header + 12, width, 2);
+        putLE(header + 14, height, 2);
+        putLE(header + 16, 1000*1000, 4); // Time base denominator.
+        putLE(header + 20, 1, 4); // Time base numerator.
+        m_frames = 0;
+        return append(header, sizeof(header));
+    }
+
+    bool write(const std::string &frame, int64_t timeStamp, bool) noexcept override {
+        uint8_t header[12];
+        putLE(header, frame.size(), 4);
+        putLE(header + 4, static_cast<uint64_t>(timeStamp), 8);
+        m_frames++;
+        return append(header, sizeof(header), frame.data(), frame.size());
+    }
+
+    bool end() noexcept override {
+        uint8_t frames[4];
+        putLE(frames, m_frames, 4);
+        return patch(24, frames, sizeof(frames));
+    }
+
+   private:
+    static void putLE(uint8_t *dst, uint64_t value, uint32_t bytes) noexcept {
+        for (uint32_t i{0}; i < bytes; i++) {
+            dst[i] = static_cast<uint8_t>((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+   private:
+    static const uint32_t HEADER_SIZE{32};
+    uint32_t m_frames{0};
+};
+
+/**
+ * WebmWriter writes WebM files with one video track and a time base of one
+ * millisecond. Clusters start at key frames at least a second apart (or when
+ * the 16 bit block time codes would overflow); their sizes, the segment's size
+ * and the duration are patched when they are known. As no index (Cues) is
+ * written, players seek by scanning the clusters.
+ */
+class WebmWriter : public ContainerWriter {
+   public:
+    explicit WebmWriter(const std::string &name) noexcept
+        : ContainerWriter(name) {}
+
+    bool begin(const std::string &fourcc, uint32_t width, uint32_t height) noexcept override {
+        std::string ebml;
+        element(ebml, 0x4286, uint64_t{1});      // EBMLVersion
+        element(ebml, 0x42F7, uint64_t{1});      // EBMLReadVersion
+        element(ebml, 0x42F2, uint64_t{4});      // EBMLMaxIDLength
+        element(ebml, 0x42F3, uint64_t{8});      // EBMLMaxSizeLength
+        element(ebml, 0x4282, std::string("webm")); // DocType
+        element(ebml, 0x4287, uint64_t{2});      // DocTypeVersion
+        element(ebml, 0x4285, uint64_t{2});      // DocTypeReadVersion
+        std::string header;
+        master(header, 0x1A45DFA3, ebml);        // EBML
+
+        // Segment with a placeholder for its size.
+        putId(header, 0x18538067);
+        m_segmentSizePosition = header.size();
+        putSizePlaceholder(header);
+        m_segmentStart = header.size();
+
+        std::string info;
+        element(info, 0x2AD7B1, uint64_t{1000*1000}); // TimecodeScale: 1 ms.
+        element(info, 0x4D80, std::string("video-qsv-vp9-recorder")); // MuxingApp
+        element(info, 0x5741, std::string("rec-export"));             // WritingApp
+        putId(info, 0x4489);                      // Duration as 8 byte float.
+        putSize(info, 8);
+        const std::size_t DURATION_IN_INFO{info.size()};
+        info.append(8, '\0');
+        master(header, 0x1549A966, info);         // Info
+        m_durationPosition = header.size() - info.size() + DURATION_IN_INFO;
+
+        std::string video;
+        element(video, 0xB0, uint64_t{width});    // PixelWidth
+        element(video, 0xBA, uint64_t{height});   // PixelHeight
+        std::string track;
+        element(track, 0xD7, uint64_t{1});        // TrackNumber
+        element(track, 0x73C5, uint64_t{1});      // TrackUID
+        element(track, 0x83, uint64_t{1});        // TrackType: video
+        element(track, 0x86, std::string(("VP80" == fourcc) ? "V_VP8" : "V_VP9")); // CodecID
+        master(track, 0xE0, video);               // Video
+        std::string tracks;
+        master(tracks, 0xAE, track);              // TrackEntry
+        master(header, 0x1654AE6B, tracks);       // Tracks
+
+        m_hasCluster = false;
+        m_lastTimeCode = 0;
+        return append(header.data(), header.size());
+    }
+
+    bool write(const std::string &frame, int64_t timeStamp, bool keyFrame) noexcept override {
+        const int64_t TIME_CODE{std::max(timeStamp / 1000, m_lastTimeCode)};
+        const int64_t MAX_RELATIVE_TIME_CODE{32767};
+        if ( !m_hasCluster ||
+             (keyFrame && (TIME_CODE - m_clusterTimeCode >= 1000)) ||
+             (TIME_CODE - m_clusterTimeCode > MAX_RELATIVE_TIME_CODE) ) {
+            closeCluster();
+            std::string cluster;
+            putId(cluster, 0x1F43B675);
+            m_clusterSizePosition = offset() + cluster.size();
+            putSizePlaceholder(cluster);
+            m_clusterStart = offset() + cluster.size();
+            element(cluster, 0xE7, static_cast<uint64_t>(TIME_CODE)); // Timecode
+            m_hasCluster = true;
+            m_clusterTimeCode = TIME_CODE;
+            append(cluster.data(), cluster.size());
+        }
+        m_lastTimeCode = TIME_CODE;
+
+        // SimpleBlock: track number, time code relative to the cluster, flags.
+        std::string block;
+        putId(block, 0xA3);
+        putSize(block, 4 + frame.size());
+        const int16_t RELATIVE{static_cast<int16_t>(TIME_CODE - m_clusterTimeCode)};
+        block.push_back(static_cast<char>(0x81));
+        block.push_back(static_cast<char>((RELATIVE >> 8) & 0xFF));
+        block.push_back(static_cast<char>(RELATIVE & 0xFF));
+        block.push_back(static_cast<char>(keyFrame ? 0x80 : 0x00));
+        return append(block.data(), block.size(), frame.data(), frame.size());
+    }
+
+    bool end() noexcept override {
+        closeCluster();
+        uint8_t size[8];
+        encodeSize(size, offset() - m_segmentStart);
+        patch(m_segmentSizePosition, size, sizeof(size));
+
+        double duration{static_cast<double>(m_lastTimeCode)};
+        uint64_t bits{0};
+        std::memcpy(&bits, &duration, sizeof(bits));
+        uint8_t bigEndian[8];
+        for (uint32_t i{0}; i < 8; i++) {
+            bigEndian[i] = static_cast<uint8_t>((bits >> (8 * (7 - i))) & 0xFF);
+        }
+        return patch(m_durationPosition, bigEndian, sizeof(bigEndian));
+    }
+
+   private:
+    void closeCluster() noexcept {
+        if (m_hasCluster) {
+            uint8_t size[8];
+            encodeSize(size, offset() - m_clusterStart);
+            patch(m_clusterSizePosition, size, sizeof(size));
+            m_hasCluster = false;
+        }
+    }
+
+    static void encodeSize(uint8_t *dst, uint64_t size) noexcept {
+        dst[0] = 0x01;
+        for (uint32_t i{1}; i < 8; i++) {
+            dst[i] = static_cast<uint8_t>((size >> (8 * (7 - i))) & 0xFF);
+        }
+    }
+
+    static void putSizePlaceholder(std::string &s) noexcept {
+        s.push_back(static_cast<char>(0x01));
+        s.append(7, '\0');
+    }
+
+    static void putId(std::string &s, uint32_t id) noexcept {
+        for (int32_t shift{24}; shift >= 0; shift -= 8) {
+            if ( (0 != (id >> shift)) || (0 == shift) ) {
+                s.push_back(static_cast<char>((id >> shift) & 0xFF));
+            }
+        }
+    }
+
+    static void putSize(std::string &s, uint64_t size) noexcept {
+        // Shortest variable length integer with at least one value bit left over for "unknown".
+        uint32_t length{1};
+        while ( (length < 8) && (size >= ((uint64_t{1} << (7 * length)) - 1)) ) {
+            length++;
+        }
+        s.push_back(static_cast<char>((0x100 >> length) | ((size >> (8 * (length - 1))) & 0xFF)));
+        for (uint32_t i{1}; i < length; i++) {
+            s.push_back(static_cast<char>((size >> (8 * (length - 1 - i))) & 0xFF));
+        }
+    }
+
+    static void element(std::string &s, uint32_t id, uint64_t value) noexcept {
+        uint32_t length{1};
+        while ( (length < 8) && (0 != (value >> (8 * length))) ) {
+            length++;
+        }
+        putId(s, id);
+        putSize(s, length);
+        for (uint32_t i{0}; i < length; i++) {
+            s.push_back(static_cast<char>((value >> (8 * (length - 1 - i))) & 0xFF));
+        }
+    }
+
+    static void element(std::string &s, uint32_t id, const std::string &value) noexcept {
+        putId(s, id);
+        putSize(s, value.size());
+        s += value;
+    }
+
+    static void master(std::string &s, uint32_t id, const std::string &children) noexcept {
+        element(s, id, children);
+    }
+
+   private:
+    uint64_t m_segmentSizePosition{0};
+    uint64_t m_segmentStart{0};
+    uint64_t m_durationPosition{0};
+    bool m_hasCluster{false};
+    uint64_t m_clusterSizePosition{0};
+    uint64_t m_clusterStart{0};
+    int64_t m_clusterTimeCode{0};
+    int64_t m_lastTimeCode{0};
+};
+
+#endif
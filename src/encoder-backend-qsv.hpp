@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BACKEND_QSV_HPP
+#define ENCODER_BACKEND_QSV_HPP
+
+#include "encoder-backend.hpp"
+#include "logger.hpp"
+
+#include <YamiC.h>
+#include <va/va.h>
+#include <va/va_drm.h>
+#include <va/va_drmcommon.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * QsvEncoderBackend encodes VP9 using Intel QuickSync via libyami. VA surfaces
+ * are NV12 internally, so NV12 input avoids a conversion inside libyami.
+ *
+ * libyami uploads frames in memory into a VA surface of its own. Frames in an
+ * imported DMA-BUF are instead imported once per buffer as a VA surface
+ * (DRM PRIME) on the VA display that the encoder uses, and encoded from there
+ * without copying.
+ */
+class QsvEncoderBackend : public EncoderBackend {
+   private:
+    QsvEncoderBackend(const QsvEncoderBackend &) = delete;
+    QsvEncoderBackend(QsvEncoderBackend &&)      = delete;
+    QsvEncoderBackend &operator=(const QsvEncoderBackend &) = delete;
+    QsvEncoderBackend &operator=(QsvEncoderBackend &&) = delete;
+
+   public:
+    QsvEncoderBackend() = default;
+    ~QsvEncoderBackend() override {
+        close();
+    }
+
+    const char *name() const noexcept override {
+        return "qsv";
+    }
+
+    std::string fourcc() const noexcept override {
+        return "VP90";
+    }
+
+    bool accepts(uint32_t fourcc) const noexcept override {
+        return (FOURCC_I420 == fourcc) || (FOURCC_NV12 == fourcc);
+    }
+
+    uint32_t preferredFourcc() const noexcept override {
+        return FOURCC_NV12;
+    }
+
+    bool open(const EncoderSettings &settings) noexcept override {
+        if (settings.lossless) {
+            Logger::instance().log(LogLevel::Error, "Encoder 'qsv' does not support lossless encoding; use --encoder=vpx.");
+            return false;
+        }
+        m_encodeHandler = createEncoder(YAMI_MIME_VP9);
+        if (nullptr == m_encodeHandler) {
+            Logger::instance().log(LogLevel::Error, "Error creating encoding handler.");
+            return false;
+        }
+        // Imported DMA-BUFs need to become surfaces on the same display as the encoder's.
+        if (openDisplay()) {
+            NativeDisplay nativeDisplay;
+            nativeDisplay.type = NATIVE_DISPLAY_VA;
+            nativeDisplay.handle = reinterpret_cast<intptr_t>(m_display);
+            encodeSetNativeDisplay(m_encodeHandler, &nativeDisplay);
+        }
+
+        YamiStatus retVal{YAMI_SUCCESS};
+        {
+            VideoParamsCommon encVideoParams;
+            encVideoParams.size = sizeof(VideoParamsCommon);
+            retVal = encodeGetParameters(m_encodeHandler, VideoParamsTypeCommon, &encVideoParams);
+            if (YAMI_SUCCESS != retVal) {
+                Logger::instance().log(LogLevel::Error, "Error retrieving parameters 'VideoParamsTypeCommon': {}", retVal);
+            }
+
+            {
+                // https://github.com/intel/libyami/blob/apache/interface/VideoEncoderDefs.h
+                // https://github.com/intel/libyami-utils/blob/master/doc/yamitranscode.1
+                encVideoParams.resolution.width = settings.width;
+                encVideoParams.resolution.height = settings.height;
+
+                encVideoParams.frameRate.frameRateDenom = 1;
+                encVideoParams.frameRate.frameRateNum = settings.fps;
+
+                encVideoParams.intraPeriod = settings.gop;
+                encVideoParams.ipPeriod = settings.ipPeriod;
+
+                encVideoParams.rcParams.bitRate = settings.bitrate;
+                encVideoParams.rcParams.initQP = settings.initQP; // Initial quality factor.
+                encVideoParams.rcParams.minQP = settings.qpMin;
+                encVideoParams.rcParams.maxQP = settings.qpMax;
+                encVideoParams.rcParams.disableFrameSkip = settings.disableFrameSkip;
+                encVideoParams.rcParams.diffQPIP = settings.diffQPIP;
+                encVideoParams.rcParams.diffQPIB = settings.diffQPIB;
+
+                encVideoParams.numRefFrames = settings.numRefFrames;
+                encVideoParams.enableLowPower = false;
+                encVideoParams.bitDepth = 8;
+
+                switch (settings.rcMode) {
+                    case 0: { encVideoParams.rcMode = RATE_CONTROL_NONE; break; }
+                    case 1: { encVideoParams.rcMode = RATE_CONTROL_CBR; break; }
+                    case 2: { encVideoParams.rcMode = RATE_CONTROL_VBR; break; }
+                    case 3: { encVideoParams.rcMode = RATE_CONTROL_VCM; break; }
+                    case 4: { encVideoParams.rcMode = RATE_CONTROL_CQP; break; }
+                }
+
+                encVideoParams.size = sizeof(VideoParamsCommon);
+            }
+            retVal = encodeSetParameters(m_encodeHandler, VideoParamsTypeCommon, &encVideoParams);
+            if (YAMI_SUCCESS != retVal) {
+                Logger::instance().log(LogLevel::Error, "Error setting parameters 'VideoParamsTypeCommon': {}", retVal);
+            }
+        }
+
+        {
+            VideoParamsVP9 encVideoParams;
+            retVal = encodeGetParameters(m_encodeHandler, VideoParamsTypeVP9, &encVideoParams);
+            if (YAMI_SUCCESS != retVal) {
+                Logger::instance().log(LogLevel::Error, "Error retrieving parameters 'VideoParamsTypeVP9': {}", retVal);
+            }
+
+            {
+                encVideoParams.referenceMode = settings.referenceMode;
+            }
+            retVal = encodeSetParameters(m_encodeHandler, VideoParamsTypeVP9, &encVideoParams);
+            if (YAMI_SUCCESS != retVal) {
+                Logger::instance().log(LogLevel::Error, "Error setting parameters 'VideoParamsTypeVP9': {}", retVal);
+            }
+        }
+
+        retVal = encodeStart(m_encodeHandler);
+        if (YAMI_SUCCESS != retVal) {
+            Logger::instance().log(LogLevel::Error, "Error starting encoder: {}", retVal);
+            return false;
+        }
+
+        // Reserve buffer per frame that should be large enough to hold a lossy-encoded frame.
+        const uint32_t INTERNAL_BUFFER_SIZE{5*1000*1000};
+        m_internalBuffer.resize(INTERNAL_BUFFER_SIZE);
+        {
+            m_outBuffer.data = m_internalBuffer.data();
+            m_outBuffer.bufferSize = INTERNAL_BUFFER_SIZE;
+            m_outBuffer.dataSize = 0;
+            m_outBuffer.remainingSize = 0;
+            m_outBuffer.flag = 0;
+            m_outBuffer.format = OUTPUT_EVERYTHING;
+            m_outBuffer.temporalID = 0;
+            m_outBuffer.timeStamp = 0;
+        }
+        return true;
+    }
+
+    bool encode(const Frame &frame) noexcept override {
+        if (0 <= frame.dmaBuf) {
+            return encodeSurface(frame);
+        }
+
+        VideoFrameRawData inBuffer;
+        {
+            // libyami copies the frame into a VA surface.
+            inBuffer.memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_POINTER;
+            inBuffer.handle = reinterpret_cast<intptr_t>(frame.data);
+            inBuffer.size = frame.size;
+            inBuffer.width = frame.width;
+            inBuffer.height = frame.height;
+            for (uint32_t i{0}; i < 3; i++) {
+                inBuffer.pitch[i] = frame.pitch[i];
+                inBuffer.offset[i] = frame.offset[i];
+            }
+            inBuffer.fourcc = (FOURCC_NV12 == frame.fourcc) ? YAMI_FOURCC_NV12 : YAMI_FOURCC_I420;
+            inBuffer.internalID = 0;
+            inBuffer.timeStamp = static_cast<uint64_t>(frame.timeStamp);
+            inBuffer.flags = VIDEO_FRAME_FLAGS_KEY;
+        }
+
+        YamiStatus retVal = encodeEncodeRawData(m_encodeHandler, &inBuffer);
+        if (YAMI_SUCCESS != retVal) {
+            Logger::instance().log(LogLevel::Error, "Error encoding frame: {}", retVal);
+        }
+        return (YAMI_SUCCESS == retVal);
+    }
+
+    EncoderStatus getOutput(EncodedFrame &encodedFrame, bool withWait) noexcept override {
+        YamiStatus retVal = encodeGetOutput(m_encodeHandler, &m_outBuffer, withWait);
+        if (YAMI_SUCCESS == retVal) {
+            encodedFrame.data = m_internalBuffer.data();
+            encodedFrame.size = m_outBuffer.dataSize;
+            encodedFrame.timeStamp = static_cast<int64_t>(m_outBuffer.timeStamp);
+            encodedFrame.keyFrame = (0 != (m_outBuffer.flag & ENCODE_BUFFERFLAG_SYNCFRAME));
+            return EncoderStatus::Ok;
+        }
+        if (YAMI_ENCODE_BUFFER_NO_MORE == retVal) {
+            return EncoderStatus::NoMore;
+        }
+        Logger::instance().log(LogLevel::Error, "Error getting encoded frame: {}", retVal);
+        return EncoderStatus::Failed;
+    }
+
+    void flush() noexcept override {
+        // libyami's C API has no end-of-stream call; the VP9 encoder does not
+        // reorder frames, so all pending frames are retrievable via getOutput.
+    }
+
+    void close() noexcept override {
+        if (nullptr != m_encodeHandler) {
+            encodeStop(m_encodeHandler);
+            releaseEncoder(m_encodeHandler);
+            m_encodeHandler = nullptr;
+        }
+        // The encoder might refer to the surfaces until it is released.
+        for (const auto &s : m_surfaces) {
+            VASurfaceID surface{s.surface};
+            vaDestroySurfaces(m_display, &surface, 1);
+        }
+        m_surfaces.clear();
+        if (nullptr != m_display) {
+            vaTerminate(m_display);
+            m_display = nullptr;
+        }
+        if (-1 != m_drmFd) {
+            ::close(m_drmFd);
+            m_drmFd = -1;
+        }
+    }
+
+   private:
+    static const char *renderNode() noexcept {
+        return "/dev/dri/renderD128";
+    }
+
+    /**
+     * This method opens the VA display on the GPU's render node.
+     *
+     * @return true on success; libyami opens its own display otherwise.
+     */
+    bool openDisplay() noexcept {
+        m_drmFd = ::open(renderNode(), O_RDWR | O_CLOEXEC);
+        if (-1 == m_drmFd) {
+            Logger::instance().log(LogLevel::Warning, "Could not open '{}'; imported DMA-BUFs cannot be encoded: {}", renderNode(), std::strerror(errno));
+            return false;
+        }
+        m_display = vaGetDisplayDRM(m_drmFd);
+        int major{0};
+        int minor{0};
+        if ( (nullptr == m_display) || (VA_STATUS_SUCCESS != vaInitialize(m_display, &major, &minor)) ) {
+            Logger::instance().log(LogLevel::Warning, "Could not initialize VA display on '{}'; imported DMA-BUFs cannot be encoded.", renderNode());
+            m_display = nullptr;
+            ::close(m_drmFd);
+            m_drmFd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return VA surface of the DMA-BUF holding the given frame, which is
+     *         imported on first use, or VA_INVALID_SURFACE.
+     */
+    VASurfaceID surfaceOf(const Frame &frame) noexcept {
+        for (const auto &s : m_surfaces) {
+            if (frame.dmaBuf == s.dmaBuf) {
+                return s.surface;
+            }
+        }
+        if (nullptr == m_display) {
+            return VA_INVALID_SURFACE;
+        }
+
+        const bool NV12{FOURCC_NV12 == frame.fourcc};
+        uintptr_t handle{static_cast<uintptr_t>(frame.dmaBuf)};
+        VASurfaceAttribExternalBuffers external;
+        std::memset(&external, 0, sizeof(external));
+        external.pixel_format = NV12 ? VA_FOURCC_NV12 : VA_FOURCC_I420;
+        external.width = frame.width;
+        external.height = frame.height;
+        external.data_size = frame.size;
+        external.num_planes = NV12 ? 2 : 3;
+        for (uint32_t i{0}; i < external.num_planes; i++) {
+            external.pitches[i] = frame.pitch[i];
+            external.offsets[i] = frame.offset[i];
+        }
+        external.buffers = &handle;
+        external.num_buffers = 1;
+
+        VASurfaceAttrib attributes[2];
+        std::memset(attributes, 0, sizeof(attributes));
+        attributes[0].type = VASurfaceAttribMemoryType;
+        attributes[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attributes[0].value.type = VAGenericValueTypeInteger;
+        attributes[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
+        attributes[1].type = VASurfaceAttribExternalBufferDescriptor;
+        attributes[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attributes[1].value.type = VAGenericValueTypePointer;
+        attributes[1].value.value.p = &external;
+
+        VASurfaceID surface{VA_INVALID_SURFACE};
+        const VAStatus STATUS{vaCreateSurfaces(m_display, VA_RT_FORMAT_YUV420, frame.width, frame.height, &surface, 1, attributes, 2)};
+        if (VA_STATUS_SUCCESS != STATUS) {
+            Logger::instance().log(LogLevel::Error, "Error importing DMA-BUF {} as VA surface: {}", frame.dmaBuf, vaErrorStr(STATUS));
+            return VA_INVALID_SURFACE;
+        }
+        m_surfaces.push_back(ImportedSurface{frame.dmaBuf, surface});
+        return surface;
+    }
+
+    bool encodeSurface(const Frame &frame) noexcept {
+        const VASurfaceID SURFACE{surfaceOf(frame)};
+        if (VA_INVALID_SURFACE == SURFACE) {
+            return false;
+        }
+        // libyami keeps the VideoFrame until the frame is encoded and frees it via its callback.
+        VideoFrame *videoFrame{new VideoFrame};
+        std::memset(videoFrame, 0, sizeof(VideoFrame));
+        videoFrame->surface = static_cast<intptr_t>(SURFACE);
+        videoFrame->timeStamp = frame.timeStamp;
+        videoFrame->crop.x = 0;
+        videoFrame->crop.y = 0;
+        videoFrame->crop.width = frame.width;
+        videoFrame->crop.height = frame.height;
+        videoFrame->fourcc = (FOURCC_NV12 == frame.fourcc) ? YAMI_FOURCC_NV12 : YAMI_FOURCC_I420;
+        videoFrame->flags = VIDEO_FRAME_FLAGS_KEY;
+        videoFrame->free = [](VideoFrame *f) { delete f; };
+
+        YamiStatus retVal = encodeEncode(m_encodeHandler, videoFrame);
+        if (YAMI_SUCCESS != retVal) {
+            Logger::instance().log(LogLevel::Error, "Error encoding frame from DMA-BUF {}: {}", frame.dmaBuf, retVal);
+            return false;
+        }
+        // The producer may overwrite the buffer once the frame is released; wait until the GPU has read it.
+        const VAStatus STATUS{vaSyncSurface(m_display, SURFACE)};
+        if (VA_STATUS_SUCCESS != STATUS) {
+            Logger::instance().log(LogLevel::Error, "Error waiting for VA surface of DMA-BUF {}: {}", frame.dmaBuf, vaErrorStr(STATUS));
+            return false;
+        }
+        return true;
+    }
+
+   private:
+    struct ImportedSurface {
+        int32_t dmaBuf;
+        VASurfaceID surface;
+    };
+
+    EncodeHandler m_encodeHandler{nullptr};
+    int m_drmFd{-1};
+    VADisplay m_display{nullptr};
+    std::vector<ImportedSurface> m_surfaces{};
+    std::vector<uint8_t> m_internalBuffer{};
+    VideoEncOutputBuffer m_outBuffer{};
+};
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BACKEND_RAW_HPP
+#define ENCODER_BACKEND_RAW_HPP
+
+#include "encoder-backend.hpp"
+#include "frame-pool.hpp"
+#include "logger.hpp"
+#include "thread-pool.hpp"
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+enum class RawCompression : uint8_t {
+    None,
+    Lz4,
+    Zstd,
+};
+
+/**
+ * RawEncoderBackend records I420 frames without encoding them. Uncompressed
+ * ("I420"), a tightly packed frame in a pooled buffer (e.g., after
+ * preprocessing or for simulcast) is passed on as it is together with that
+ * buffer, i.e., to the .rec file without copying it; frames residing in the
+ * shared memory are copied once into a pooled buffer of this backend so that
+ * the producer can continue while the frame waits to be written.
+ *
+ * With compression ("I4LZ" for LZ4, "I4ZS" for zstd at level 1), the three
+ * planes are compressed in parallel on an own thread pool straight into a
+ * pooled buffer; the payload holds for each plane (Y, U, V) its compressed
+ * size as uint32_t little endian followed by the compressed bytes.
+ */
+class RawEncoderBackend : public EncoderBackend {
+   private:
+    RawEncoderBackend(const RawEncoderBackend &) = delete;
+    RawEncoderBackend(RawEncoderBackend &&)      = delete;
+    RawEncoderBackend &operator=(const RawEncoderBackend &) = delete;
+    RawEncoderBackend &operator=(RawEncoderBackend &&) = delete;
+
+   public:
+    explicit RawEncoderBackend(RawCompression compression) noexcept
+        : m_compression(compression) {}
+    ~RawEncoderBackend() override {
+        close();
+    }
+
+    const char *name() const noexcept override {
+        return (RawCompression::Lz4 == m_compression) ? "lz4" : ((RawCompression::Zstd == m_compression) ? "zstd" : "raw");
+    }
+
+    std::string fourcc() const noexcept override {
+        return (RawCompression::Lz4 == m_compression) ? "I4LZ" : ((RawCompression::Zstd == m_compression) ? "I4ZS" : "I420");
+    }
+
+    bool accepts(uint32_t fourcc) const noexcept override {
+        return (FOURCC_I420 == fourcc);
+    }
+
+    uint32_t preferredFourcc() const noexcept override {
+        return FOURCC_I420;
+    }
+
+    bool open(const EncoderSettings &settings) noexcept override {
+        m_width = settings.width;
+        m_height = settings.height;
+        m_hasOutput = false;
+        uint32_t outputSize{frameSize(FOURCC_I420, m_width, m_height)};
+        if (RawCompression::None != m_compression) {
+            // The calling thread compresses one of the planes.
+            const uint32_t THREADS{(0 < settings.threads) ? settings.threads : PLANES};
+            m_threadPool.reset(new ThreadPool(((THREADS < PLANES) ? THREADS : PLANES) - 1));
+            outputSize = 0;
+            for (uint32_t i{0}; i < PLANES; i++) {
+                const uint32_t PLANE_SIZE{planeWidth(i) * planeHeight(i)};
+                const std::size_t BOUND{(RawCompression::Lz4 == m_compression) ? static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(PLANE_SIZE))) : ZSTD_compressBound(PLANE_SIZE)};
+                m_planes[i].input.resize(PLANE_SIZE);
+                // Each plane is compressed behind its size at the place it would take with the largest possible output.
+                m_planes[i].offset = outputSize + SIZE_FIELD;
+                m_planes[i].bound = static_cast<uint32_t>(BOUND);
+                outputSize += SIZE_FIELD + static_cast<uint32_t>(BOUND);
+                if ( (RawCompression::Zstd == m_compression) && (nullptr == m_planes[i].context) ) {
+                    m_planes[i].context = ZSTD_createCCtx();
+                    if (nullptr == m_planes[i].context) {
+                        Logger::instance().log(LogLevel::Error, "Error creating zstd context.");
+                        return false;
+                    }
+                }
+            }
+        }
+        // Encoded frames stay in their buffers until written; the pool grows if the writer falls behind.
+        m_outputPool.reset(new FramePool(outputSize, OUTPUT_BUFFERS));
+        return true;
+    }
+
+    bool encode(const Frame &frame) noexcept override {
+        m_timeStamp = frame.timeStamp;
+        m_hasOutput = true;
+        if (RawCompression::None == m_compression) {
+            const Frame PACKED{describeFrame(FOURCC_I420, m_width, m_height, frame.data)};
+            if ( isLayoutOf(frame, PACKED) && frame.buffer ) {
+                m_buffer = frame.buffer;
+                m_data = frame.data;
+            }
+            else {
+                m_buffer = m_outputPool->acquire();
+                if (isLayoutOf(frame, PACKED)) {
+                    std::memcpy(m_buffer.get(), frame.data, PACKED.size);
+                }
+                else {
+                    for (uint32_t i{0}; i < PLANES; i++) {
+                        copyPlane(frame, i, m_buffer.get() + PACKED.offset[i]);
+                    }
+                }
+                m_data = m_buffer.get();
+            }
+            m_size = PACKED.size;
+            return true;
+        }
+
+        // A failed compression leaves a size of 0 as the planes are never empty.
+        std::shared_ptr<uint8_t> output{m_outputPool->acquire()};
+        auto compressPlane = [this, &frame, &output](uint32_t i) {
+            Plane &p = m_planes[i];
+            const uint8_t *src{frame.plane(i)};
+            if (frame.pitch[i] != planeWidth(i)) {
+                copyPlane(frame, i, p.input.data());
+                src = p.input.data();
+            }
+            uint8_t *dst{output.get() + p.offset};
+            const int SRC_SIZE{static_cast<int>(p.input.size())};
+            if (RawCompression::Lz4 == m_compression) {
+                const int N{LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst), SRC_SIZE, static_cast<int>(p.bound))};
+                p.size = (0 < N) ? static_cast<uint32_t>(N) : 0;
+            }
+            else {
+                const std::size_t N{ZSTD_compressCCtx(p.context, dst, p.bound, src, static_cast<std::size_t>(SRC_SIZE), ZSTD_LEVEL)};
+                p.size = (0 == ZSTD_isError(N)) ? static_cast<uint32_t>(N) : 0;
+            }
+        };
+        m_threadPool->parallelFor(PLANES, compressPlane);
+        if ( (0 == m_planes[0].size) || (0 == m_planes[1].size) || (0 == m_planes[2].size) ) {
+            Logger::instance().log(LogLevel::Error, "Error compressing frame with {}.", name());
+            m_hasOutput = false;
+            return false;
+        }
+
+        // Close the gaps behind the planes that were smaller than their bound.
+        uint32_t size{0};
+        for (uint32_t i{0}; i < PLANES; i++) {
+            const uint32_t SIZE{m_planes[i].size};
+            for (uint32_t b{0}; b < SIZE_FIELD; b++) {
+                output.get()[size + b] = static_cast<uint8_t>((SIZE >> (8 * b)) & 0xFF);
+            }
+            size += SIZE_FIELD;
+            if (size != m_planes[i].offset) {
+                std::memmove(output.get() + size, output.get() + m_planes[i].offset, SIZE);
+            }
+            size += SIZE;
+        }
+        m_buffer = output;
+        m_data = m_buffer.get();
+        m_size = size;
+        return true;
+    }
+
+    EncoderStatus getOutput(EncodedFrame &encodedFrame, bool) noexcept override {
+        if (!m_hasOutput) {
+            return EncoderStatus::NoMore;
+        }
+        m_hasOutput = false;
+        encodedFrame.data = m_data;
+        encodedFrame.size = m_size;
+        encodedFrame.buffer = std::move(m_buffer);
+        encodedFrame.timeStamp = m_timeStamp;
+        encodedFrame.keyFrame = true;
+        return EncoderStatus::Ok;
+    }
+
+    void flush() noexcept override {}
+
+    void close() noexcept override {
+        for (auto &p : m_planes) {
+            if (nullptr != p.context) {
+                ZSTD_freeCCtx(p.context);
+                p.context = nullptr;
+            }
+        }
+        m_threadPool.reset();
+        m_buffer.reset();
+        m_outputPool.reset();
+    }
+
+   private:
+    uint32_t planeWidth(uint32_t i) const noexcept {
+        return (0 == i) ? m_width : m_width / 2;
+    }
+
+    uint32_t planeHeight(uint32_t i) const noexcept {
+        return (0 == i) ? m_height : m_height / 2;
+    }
+
+    static bool isLayoutOf(const Frame &frame, const Frame &packed) noexcept {
+        bool retVal{true};
+        for (uint32_t i{0}; i < PLANES; i++) {
+            retVal = retVal && (frame.pitch[i] == packed.pitch[i]) && (frame.offset[i] == packed.offset[i]);
+        }
+        return retVal;
+    }
+
+    void copyPlane(const Frame &frame, uint32_t i, uint8_t *dst) const noexcept {
+        const uint32_t W{planeWidth(i)};
+        for (uint32_t y{0}; y < planeHeight(i); y++) {
+            std::memcpy(dst + static_cast<std::size_t>(y) * W, frame.plane(i) + static_cast<std::size_t>(y) * frame.pitch[i], W);
+        }
+    }
+
+   private:
+    static const uint32_t PLANES{3};
+    static const int ZSTD_LEVEL{1};
+    static const uint32_t SIZE_FIELD{4};
+    static const uint32_t OUTPUT_BUFFERS{4};
+
+    struct Plane {
+        std::vector<uint8_t> input{};
+        uint32_t offset{0}; // Position of the compressed plane in the output buffer.
+        uint32_t bound{0};
+        uint32_t size{0};
+        ZSTD_CCtx *context{nullptr};
+    };
+
+    RawCompression m_compression{RawCompression::None};
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    std::unique_ptr<ThreadPool> m_threadPool{nullptr};
+    Plane m_planes[PLANES]{};
+    std::unique_ptr<FramePool> m_outputPool{nullptr};
+    std::shared_ptr<uint8_t> m_buffer{nullptr};
+    const uint8_t *m_data{nullptr};
+    uint32_t m_size{0};
+    int64_t m_timeStamp{0};
+    bool m_hasOutput{false};
+};
+
+#endif
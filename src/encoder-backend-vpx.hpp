@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BACKEND_VPX_HPP
+#define ENCODER_BACKEND_VPX_HPP
+
+#include "encoder-backend.hpp"
+#include "logger.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/**
+ * VpxEncoderBackend encodes VP9 in software using libvpx in realtime mode;
+ * it spreads the work over tile columns and rows on all cores. Unlike the
+ * QuickSync backend, it supports per-block QP deltas for regions of interest.
+ *
+ * The QP related settings map to libvpx's quantizer range 0..63; rate control
+ * modes NONE and CQP use constant quality at init-qp. In lossless mode, all
+ * rate control settings are ignored and every frame is reconstructed
+ * bit-exactly; tile columns and row based multithreading keep all cores busy.
+ */
+class VpxEncoderBackend : public EncoderBackend {
+   private:
+    VpxEncoderBackend(const VpxEncoderBackend &) = delete;
+    VpxEncoderBackend(VpxEncoderBackend &&)      = delete;
+    VpxEncoderBackend &operator=(const VpxEncoderBackend &) = delete;
+    VpxEncoderBackend &operator=(VpxEncoderBackend &&) = delete;
+
+   public:
+    VpxEncoderBackend() = default;
+    ~VpxEncoderBackend() override {
+        close();
+    }
+
+    const char *name() const noexcept override {
+        return "vpx";
+    }
+
+    std::string fourcc() const noexcept override {
+        return "VP90";
+    }
+
+    bool accepts(uint32_t fourcc) const noexcept override {
+        return (FOURCC_I420 == fourcc);
+    }
+
+    uint32_t preferredFourcc() const noexcept override {
+        return FOURCC_I420;
+    }
+
+    bool open(const EncoderSettings &settings) noexcept override {
+        const uint32_t MAX_QUANTIZER{63};
+        const uint32_t THREADS{(0 < settings.threads) ? settings.threads : std::max(std::thread::hardware_concurrency(), 1u)};
+
+        vpx_codec_enc_cfg_t cfg;
+        if (VPX_CODEC_OK != vpx_codec_enc_config_default(vpx_codec_vp9_cx(), &cfg, 0)) {
+            Logger::instance().log(LogLevel::Error, "Error retrieving default configuration for libvpx.");
+            return false;
+        }
+        cfg.g_w = settings.width;
+        cfg.g_h = settings.height;
+        cfg.g_threads = THREADS;
+        // Time stamps are given in microseconds relative to the first frame.
+        cfg.g_timebase.num = 1;
+        cfg.g_timebase.den = 1000*1000;
+        cfg.g_pass = VPX_RC_ONE_PASS;
+        cfg.g_lag_in_frames = 0;
+        cfg.g_error_resilient = 0;
+        cfg.rc_target_bitrate = settings.bitrate / 1024;
+        cfg.rc_min_quantizer = std::min(settings.qpMin, MAX_QUANTIZER);
+        cfg.rc_max_quantizer = std::min(settings.qpMax, MAX_QUANTIZER);
+        cfg.rc_dropframe_thresh = (0 != settings.disableFrameSkip) ? 0 : 30;
+        switch (settings.rcMode) {
+            case 1: { cfg.rc_end_usage = VPX_CBR; break; }
+            case 2: // Fall-through.
+            case 3: { cfg.rc_end_usage = VPX_VBR; break; }
+            default: { cfg.rc_end_usage = VPX_Q; break; }
+        }
+        if (settings.lossless) {
+            cfg.rc_end_usage = VPX_Q;
+            cfg.rc_min_quantizer = 0;
+            cfg.rc_max_quantizer = 0;
+            cfg.rc_dropframe_thresh = 0;
+        }
+        cfg.kf_mode = VPX_KF_AUTO;
+        cfg.kf_min_dist = 0;
+        cfg.kf_max_dist = (1 < settings.gop) ? settings.gop : 0;
+        m_intraOnly = (settings.gop <= 1) || (0 == settings.ipPeriod);
+        m_frameDuration = (0 < settings.fps) ? 1000*1000 / settings.fps : 0;
+
+        if (VPX_CODEC_OK != vpx_codec_enc_init(&m_codec, vpx_codec_vp9_cx(), &cfg, 0)) {
+            Logger::instance().log(LogLevel::Error, "Error initializing libvpx: {}", vpx_codec_error(&m_codec));
+            return false;
+        }
+        m_initialized = true;
+
+        // Tiles need to be at least 256 pixels wide.
+        uint32_t log2TileColumns{0};
+        while ( ((2u << log2TileColumns) <= THREADS) && ((256u << (log2TileColumns + 1)) <= settings.width) ) {
+            log2TileColumns++;
+        }
+        control(VP8E_SET_CPUUSED, 8);
+        control(VP9E_SET_TILE_COLUMNS, static_cast<int>(log2TileColumns));
+        control(VP9E_SET_ROW_MT, 1);
+        control(VP9E_SET_AQ_MODE, 0);
+        control(VP8E_SET_CQ_LEVEL, settings.lossless ? 0 : static_cast<int>(std::min(settings.initQP, MAX_QUANTIZER)));
+        control(VP9E_SET_LOSSLESS, settings.lossless ? 1 : 0);
+        m_lossless = settings.lossless;
+
+        m_roiColumns = (settings.width + 7) / 8;
+        m_roiRows = (settings.height + 7) / 8;
+        m_firstTimeStamp = 0;
+        m_hasFirstTimeStamp = false;
+        m_lastPts = -1;
+        m_iterator = nullptr;
+        return true;
+    }
+
+    bool encode(const Frame &frame) noexcept override {
+        if (!m_hasFirstTimeStamp) {
+            m_firstTimeStamp = frame.timeStamp;
+            m_hasFirstTimeStamp = true;
+        }
+        vpx_image_t image;
+        vpx_img_wrap(&image, VPX_IMG_FMT_I420, frame.width, frame.height, 1, frame.data);
+        for (uint32_t i{0}; i < 3; i++) {
+            image.planes[i] = frame.plane(i);
+            image.stride[i] = static_cast<int>(frame.pitch[i]);
+        }
+
+        // Time stamps must increase monotonically.
+        const vpx_codec_pts_t PTS{std::max<vpx_codec_pts_t>(frame.timeStamp - m_firstTimeStamp, m_lastPts + 1)};
+        m_lastPts = PTS;
+        const vpx_codec_err_t retVal = vpx_codec_encode(&m_codec, &image, PTS, m_frameDuration, m_intraOnly ? VPX_EFLAG_FORCE_KF : 0, VPX_DL_REALTIME);
+        m_iterator = nullptr;
+        if (VPX_CODEC_OK != retVal) {
+            Logger::instance().log(LogLevel::Error, "Error encoding frame: {}", vpx_codec_error(&m_codec));
+        }
+        return (VPX_CODEC_OK == retVal);
+    }
+
+    EncoderStatus getOutput(EncodedFrame &encodedFrame, bool) noexcept override {
+        const vpx_codec_cx_pkt_t *packet{nullptr};
+        while (nullptr != (packet = vpx_codec_get_cx_data(&m_codec, &m_iterator))) {
+            if (VPX_CODEC_CX_FRAME_PKT == packet->kind) {
+                encodedFrame.data = static_cast<const uint8_t*>(packet->data.frame.buf);
+                encodedFrame.size = static_cast<uint32_t>(packet->data.frame.sz);
+                encodedFrame.timeStamp = packet->data.frame.pts + m_firstTimeStamp;
+                encodedFrame.keyFrame = (0 != (packet->data.frame.flags & VPX_FRAME_IS_KEY));
+                return EncoderStatus::Ok;
+            }
+        }
+        return EncoderStatus::NoMore;
+    }
+
+    bool setRegionsOfInterest(const std::vector<RegionOfInterest> &regions, int32_t backgroundQpDelta) noexcept override {
+        if (m_lossless) {
+            // QP deltas would break losslessness.
+            return false;
+        }
+        // libvpx uses up to eight segments with their own QP delta on a map of 8x8 blocks; segment 0 is the background.
+        const int32_t MAX_DELTA{63};
+        const uint32_t MAX_SEGMENTS{8};
+        vpx_roi_map_t roi;
+        std::memset(&roi, 0, sizeof(roi));
+        for (uint32_t i{0}; i < MAX_SEGMENTS; i++) {
+            // ref_frame 0 is INTRA_FRAME and would force intra prediction on the segment; -1 leaves the reference to the encoder.
+            roi.ref_frame[i] = -1;
+            roi.skip[i] = 0;
+        }
+        roi.delta_q[0] = std::min(std::max(backgroundQpDelta, -MAX_DELTA), MAX_DELTA);
+        uint32_t segments{1};
+
+        m_roiMap.assign(m_roiColumns * m_roiRows, 0);
+        for (const auto &r : regions) {
+            const int32_t DELTA{std::min(std::max(r.qpDelta, -MAX_DELTA), MAX_DELTA)};
+            uint32_t segment{1};
+            while ( (segment < segments) && (roi.delta_q[segment] != DELTA) ) {
+                segment++;
+            }
+            if (segment == segments) {
+                if (segments < MAX_SEGMENTS) {
+                    roi.delta_q[segments++] = DELTA;
+                }
+                else {
+                    segment = MAX_SEGMENTS - 1;
+                }
+            }
+
+            const uint32_t X1{std::min((r.x + r.width + 7) / 8, m_roiColumns)};
+            const uint32_t X0{std::min(r.x / 8, X1)};
+            const uint32_t Y1{std::min((r.y + r.height + 7) / 8, m_roiRows)};
+            for (uint32_t y{r.y / 8}; y < Y1; y++) {
+                std::fill(m_roiMap.begin() + y * m_roiColumns + X0, m_roiMap.begin() + y * m_roiColumns + X1, static_cast<uint8_t>(segment));
+            }
+        }
+        roi.roi_map = m_roiMap.data();
+        roi.rows = m_roiRows;
+        roi.cols = m_roiColumns;
+
+        const vpx_codec_err_t retVal = vpx_codec_control(&m_codec, VP9E_SET_ROI_MAP, &roi);
+        if (VPX_CODEC_OK != retVal) {
+            Logger::instance().log(LogLevel::Error, "Error setting regions of interest: {}", vpx_codec_error(&m_codec));
+        }
+        return (VPX_CODEC_OK == retVal);
+    }
+
+    void flush() noexcept override {
+        if (m_initialized) {
+            vpx_codec_encode(&m_codec, nullptr, 0, 0, 0, VPX_DL_REALTIME);
+            m_iterator = nullptr;
+        }
+    }
+
+    void close() noexcept override {
+        if (m_initialized) {
+            vpx_codec_destroy(&m_codec);
+            m_initialized = false;
+        }
+    }
+
+   private:
+    void control(int id, int value) noexcept {
+        if (VPX_CODEC_OK != vpx_codec_control_(&m_codec, id, value)) {
+            Logger::instance().log(LogLevel::Error, "Error setting libvpx control {}: {}", id, vpx_codec_error(&m_codec));
+        }
+    }
+
+   private:
+    vpx_codec_ctx_t m_codec{};
+    bool m_initialized{false};
+    vpx_codec_iter_t m_iterator{nullptr};
+    bool m_intraOnly{false};
+    bool m_lossless{false};
+    unsigned long m_frameDuration{0};
+    int64_t m_firstTimeStamp{0};
+    bool m_hasFirstTimeStamp{false};
+    vpx_codec_pts_t m_lastPts{-1};
+    uint32_t m_roiColumns{0};
+    uint32_t m_roiRows{0};
+    std::vector<uint8_t> m_roiMap{};
+};
+
+#endif
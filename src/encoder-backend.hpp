@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BACKEND_HPP
+#define ENCODER_BACKEND_HPP
+
+#include "frame.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Encoder parameters as given on the command line.
+ */
+struct EncoderSettings {
+    uint32_t width{0};
+    uint32_t height{0};
+    uint32_t fps{30};
+    uint32_t gop{1};
+    uint32_t ipPeriod{1};
+    uint32_t bitrate{8000*1024}; // Bits per second.
+    uint32_t initQP{26};
+    uint32_t qpMin{0};
+    uint32_t qpMax{51};
+    uint32_t disableFrameSkip{1};
+    int8_t diffQPIP{0};
+    int8_t diffQPIB{0};
+    uint32_t numRefFrames{1};
+    uint32_t rcMode{4}; // 0: NONE, 1: CBR, 2: VBR, 3: VCM, 4: CQP
+    uint32_t referenceMode{0};
+    uint32_t threads{0}; // Encoder threads for software backends; 0 uses all cores.
+    bool lossless{false}; // Bit-exact reconstruction of the frames handed to the encoder.
+};
+
+/**
+ * Rectangle in the encoded frame whose QP is shifted by qpDelta.
+ */
+struct RegionOfInterest {
+    uint32_t x{0};
+    uint32_t y{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    int32_t qpDelta{0};
+
+    bool operator==(const RegionOfInterest &other) const noexcept {
+        return (x == other.x) && (y == other.y) && (width == other.width) && (height == other.height) && (qpDelta == other.qpDelta);
+    }
+};
+
+/**
+ * Encoded frame as returned from an EncoderBackend; data is valid until the
+ * next call to getOutput unless buffer is set, which keeps data alive as long
+ * as it is referenced so that it can be written without copying it.
+ */
+struct EncodedFrame {
+    const uint8_t *data{nullptr};
+    uint32_t size{0};
+    std::shared_ptr<uint8_t> buffer{nullptr};
+    int64_t timeStamp{0}; // Sample time stamp in microseconds of the corresponding input frame.
+    bool keyFrame{false};
+    bool repeat{false}; // Input frame was skipped as it repeats the previous one; no data.
+    // Set by EncoderBranch for the input frame with this time stamp, which might have been encoded several frames earlier.
+    int64_t encodingDuration{0}; // Microseconds spent in EncoderBackend::encode.
+    int64_t queueDelay{0}; // Microseconds from the sample time stamp until encoding started.
+};
+
+enum class EncoderStatus : uint8_t {
+    Ok,
+    NoMore,
+    Failed,
+};
+
+/**
+ * EncoderBackend is the interface to an encoder implementation. Frames are
+ * submitted with encode() and the encoded results are collected with
+ * getOutput(); an encoder may hold back frames (e.g., for reordering) until
+ * flush() signals the end of the stream.
+ */
+class EncoderBackend {
+   public:
+    virtual ~EncoderBackend() = default;
+
+    /**
+     * @return Name of this backend as used for --encoder.
+     */
+    virtual const char *name() const noexcept = 0;
+
+    /**
+     * @return FOURCC of the encoded payload as stored in ImageReading, e.g. "VP90".
+     */
+    virtual std::string fourcc() const noexcept = 0;
+
+    /**
+     * @return true if frames in the given raw format can be encoded without conversion.
+     */
+    virtual bool accepts(uint32_t fourcc) const noexcept = 0;
+
+    /**
+     * @return Raw format that this backend processes most efficiently.
+     */
+    virtual uint32_t preferredFourcc() const noexcept = 0;
+
+    virtual bool open(const EncoderSettings &settings) noexcept = 0;
+    virtual bool encode(const Frame &frame) noexcept = 0;
+    virtual EncoderStatus getOutput(EncodedFrame &encodedFrame, bool withWait) noexcept = 0;
+
+    /**
+     * This method sets the regions to encode with a different QP from the next
+     * frame on; all blocks outside of the regions are shifted by backgroundQpDelta.
+     *
+     * @return false if the backend does not support regions of interest.
+     */
+    virtual bool setRegionsOfInterest(const std::vector<RegionOfInterest> &regions, int32_t backgroundQpDelta) noexcept {
+        (void)regions;
+        (void)backgroundQpDelta;
+        return false;
+    }
+
+    /**
+     * This method signals the end of the stream so that all frames held back
+     * by the encoder become available through getOutput().
+     */
+    virtual void flush() noexcept = 0;
+    virtual void close() noexcept = 0;
+};
+
+#endif
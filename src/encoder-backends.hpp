@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BACKENDS_HPP
+#define ENCODER_BACKENDS_HPP
+
+#include "encoder-backend.hpp"
+#include "encoder-backend-qsv.hpp"
+#include "encoder-backend-raw.hpp"
+#include "encoder-backend-vpx.hpp"
+
+#include <memory>
+#include <string>
+
+/**
+ * @return EncoderBackend for the value of --encoder or nullptr if unknown.
+ */
+inline std::unique_ptr<EncoderBackend> createEncoderBackend(const std::string &name) noexcept {
+    std::unique_ptr<EncoderBackend> backend{nullptr};
+    if ( name.empty() || ("qsv" == name) ) {
+        backend.reset(new QsvEncoderBackend());
+    }
+    else if ("vpx" == name) {
+        backend.reset(new VpxEncoderBackend());
+    }
+    else if ("raw" == name) {
+        backend.reset(new RawEncoderBackend(RawCompression::None));
+    }
+    else if ("lz4" == name) {
+        backend.reset(new RawEncoderBackend(RawCompression::Lz4));
+    }
+    else if ("zstd" == name) {
+        backend.reset(new RawEncoderBackend(RawCompression::Zstd));
+    }
+    return backend;
+}
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_BRANCH_HPP
+#define ENCODER_BRANCH_HPP
+
+#include "encoder-backend.hpp"
+#include "frame.hpp"
+#include "frame-preprocessor.hpp"
+#include "logger.hpp"
+#include "object-regions.hpp"
+#include "static-scene-detector.hpp"
+#include "thread-placement.hpp"
+#include "thread-pool.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Parameters of an additional simulcast stream as given by --simulcast.
+ */
+struct SimulcastStream {
+    uint32_t width{0};
+    uint32_t height{0};
+    uint32_t bitrate{0}; // Bits per second; 0 uses the main stream's bitrate.
+    uint32_t senderStamp{0};
+};
+
+/**
+ * @return Streams parsed from <width>x<height>[:<bitrate>[:<id>]][,...]; the
+ *         bitrate is given in kbit/s like --bitrate and the id defaults to
+ *         id + the position in the list. An empty vector denotes a syntax error.
+ */
+inline std::vector<SimulcastStream> parseSimulcast(const std::string &value, uint32_t id) noexcept {
+    std::vector<SimulcastStream> streams;
+    std::stringstream sstr(value);
+    std::string item;
+    while (std::getline(sstr, item, ',')) {
+        SimulcastStream s;
+        s.senderStamp = id + static_cast<uint32_t>(streams.size()) + 1;
+        unsigned int w{0}, h{0}, bitrate{0}, senderStamp{0};
+        const int N{std::sscanf(item.c_str(), "%ux%u:%u:%u", &w, &h, &bitrate, &senderStamp)};
+        if ( (N < 2) || (0 == w) || (0 == h) ) {
+            return std::vector<SimulcastStream>();
+        }
+        s.width = w;
+        s.height = h;
+        s.bitrate = (2 < N) ? bitrate * 1024 : 0;
+        s.senderStamp = (3 < N) ? senderStamp : s.senderStamp;
+        streams.push_back(s);
+    }
+    return streams;
+}
+
+/**
+ * EncoderBranch turns captured frames into one encoded stream: it owns the
+ * preprocessing (crop, flip, scale, conversion) and the encoder backend for
+ * one resolution/bitrate and hands every encoded frame to the writer together
+ * with its senderStamp.
+ *
+ * A branch is either driven synchronously via encode() from the capture loop,
+ * or, with several branches fanning out from one capture, runs on its own
+ * thread fed by submit(). The queue is bounded; a full queue blocks the
+ * capture loop just like a slow encoder does without simulcast.
+ */
+class EncoderBranch {
+   private:
+    EncoderBranch(const EncoderBranch &) = delete;
+    EncoderBranch(EncoderBranch &&)      = delete;
+    EncoderBranch &operator=(const EncoderBranch &) = delete;
+    EncoderBranch &operator=(EncoderBranch &&) = delete;
+
+    struct Timing {
+        int64_t timeStamp{0};
+        int64_t encodingDuration{0};
+        int64_t queueDelay{0};
+    };
+
+   public:
+    /**
+     * Writer for encoded frames; called from the branch's thread when started.
+     */
+    using Writer = std::function<void(const EncoderBranch &, const EncodedFrame &)>;
+
+    /**
+     * Constructor.
+     *
+     * @param senderStamp senderStamp for the Envelopes of this stream.
+     * @param backend Encoder to use.
+     * @param fourcc Format of the captured images.
+     * @param width Width of the captured images.
+     * @param height Height of the captured images.
+     * @param preprocessing Geometric operations to apply before encoding.
+     * @param settings Encoder settings; width and height are set from the preprocessing.
+     * @param threadPool Worker threads for processing large frames; might be nullptr.
+     * @param writer Receiver of the encoded frames.
+     */
+    EncoderBranch(uint32_t senderStamp, std::unique_ptr<EncoderBackend> &&backend, uint32_t fourcc, uint32_t width, uint32_t height,
+                  const Preprocessing &preprocessing, const EncoderSettings &settings, ThreadPool *threadPool, Writer writer) noexcept
+        : m_senderStamp(senderStamp)
+        , m_encoder(std::move(backend))
+        , m_preprocessor(fourcc, width, height, preprocessing, *m_encoder, threadPool)
+        , m_settings(settings)
+        , m_writer(writer) {
+        m_settings.width = m_preprocessor.width();
+        m_settings.height = m_preprocessor.height();
+    }
+
+    ~EncoderBranch() {
+        stop();
+        m_encoder->close();
+    }
+
+    uint32_t senderStamp() const noexcept {
+        return m_senderStamp;
+    }
+
+    const EncoderSettings &settings() const noexcept {
+        return m_settings;
+    }
+
+    EncoderBackend &encoder() noexcept {
+        return *m_encoder;
+    }
+
+    const EncoderBackend &encoder() const noexcept {
+        return *m_encoder;
+    }
+
+    FramePreprocessor &preprocessor() noexcept {
+        return m_preprocessor;
+    }
+
+    bool open() noexcept {
+        return m_encoder->open(m_settings);
+    }
+
+    /**
+     * This method lets frames that do not differ from the last encoded one
+     * bypass the encoder; they are passed to the writer with repeat set.
+     */
+    void useStaticSceneDetection(float threshold, int64_t maxSkip) noexcept {
+        m_staticSceneDetector.reset(new StaticSceneDetector(m_settings.width, m_settings.height, threshold, maxSkip));
+    }
+
+    /**
+     * This method lets the encoder follow the given regions of interest; they
+     * are mapped through this branch's crop, flip and scale for every frame.
+     */
+    void useRegionsOfInterest(ObjectRegions *objectRegions) noexcept {
+        m_objectRegions = objectRegions;
+        m_regionsApplied = false;
+    }
+
+    /**
+     * @return true as long as the encoder did not fail.
+     */
+    bool good() const noexcept {
+        return m_good.load();
+    }
+
+    /**
+     * This method encodes an already preprocessed frame and writes all frames
+     * that the encoder has completed.
+     *
+     * @return false if the encoder failed.
+     */
+    bool encode(const Frame &frame) noexcept {
+        if (m_staticSceneDetector && m_staticSceneDetector->skip(frame)) {
+            m_framesSkipped++;
+            EncodedFrame repeated;
+            repeated.timeStamp = frame.timeStamp;
+            repeated.repeat = true;
+            m_writer(*this, repeated);
+            return true;
+        }
+
+        if (nullptr != m_objectRegions) {
+            applyRegionsOfInterest(frame.timeStamp);
+        }
+
+        const auto BEFORE{std::chrono::steady_clock::now()};
+        Timing timing;
+        timing.timeStamp = frame.timeStamp;
+        // Sample time stamps are taken from the system clock.
+        timing.queueDelay = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() - frame.timeStamp;
+        bool retVal{false};
+        {
+            TraceScope trace(TraceSpan::Encode, frame.timeStamp);
+            retVal = m_encoder->encode(frame);
+        }
+        timing.encodingDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - BEFORE).count();
+        // Encoding for longer than two frame intervals makes the capture fall behind; keep the spans that led to it.
+        if ( Tracer::instance().enabled() && (0 < m_lastTimeStamp) && (m_lastTimeStamp < frame.timeStamp) &&
+             (timing.encodingDuration > 2 * (frame.timeStamp - m_lastTimeStamp)) ) {
+            Tracer::instance().anomaly("encoding frame " + std::to_string(frame.timeStamp) + " (senderStamp " + std::to_string(m_senderStamp) + ") took " + std::to_string(timing.encodingDuration) + " us");
+        }
+        m_lastTimeStamp = frame.timeStamp;
+        if (retVal) {
+            m_framesEncoded++;
+            // Encoders with pipeline latency or reordering return frames after later ones were given to them.
+            const std::size_t MAX_TIMINGS{64};
+            if (MAX_TIMINGS <= m_timings.size()) {
+                m_timings.pop_front();
+            }
+            m_timings.push_back(timing);
+
+            // Collect all frames that the encoder has completed; an encoder might hold back frames for reordering.
+            EncoderStatus status{EncoderStatus::NoMore};
+            bool withWait = true;
+            while (true) {
+                {
+                    TraceScope trace(TraceSpan::GetOutput, frame.timeStamp);
+                    status = m_encoder->getOutput(m_encodedFrame, withWait);
+                }
+                if (EncoderStatus::Ok != status) {
+                    break;
+                }
+                write();
+                withWait = false;
+            }
+            retVal = (EncoderStatus::Failed != status);
+        }
+        m_good = m_good && retVal;
+        return retVal;
+    }
+
+    /**
+     * This method starts the thread that processes frames given to submit().
+     */
+    void start() noexcept {
+        m_running = true;
+        m_thread = std::thread(&EncoderBranch::run, this);
+    }
+
+    /**
+     * This method applies a placement to the thread started by start(); the
+     * encoder's own threads created afterwards inherit it.
+     *
+     * @return true on success.
+     */
+    bool place(const ThreadPlacement &placement) noexcept {
+        return m_thread.joinable() && placeThread(m_thread.native_handle(), placement);
+    }
+
+    /**
+     * This method queues a captured frame for this branch's thread; it blocks
+     * while the queue is full.
+     */
+    void submit(const Frame &captured) noexcept {
+        const std::size_t QUEUE_LENGTH{2};
+        std::unique_lock<std::mutex> lck(m_queueMutex);
+        m_queueCondition.wait(lck, [this, QUEUE_LENGTH](){ return !m_running || (m_queue.size() < QUEUE_LENGTH); });
+        if (m_running) {
+            m_queue.push_back(captured);
+            m_queueCondition.notify_all();
+        }
+    }
+
+    /**
+     * This method waits until all queued frames are encoded and stops the thread.
+     */
+    void stop() noexcept {
+        if (m_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lck(m_queueMutex);
+                m_running = false;
+            }
+            m_queueCondition.notify_all();
+            m_thread.join();
+        }
+    }
+
+    /**
+     * This method flushes the encoder and writes all frames still held by it
+     * until the given deadline.
+     */
+    void drain(std::chrono::steady_clock::time_point deadline) noexcept {
+        stop();
+        m_encoder->flush();
+        while ( (m_framesRetrieved < m_framesEncoded) && (std::chrono::steady_clock::now() < deadline) ) {
+            EncoderStatus status{m_encoder->getOutput(m_encodedFrame, false)};
+            if (EncoderStatus::Ok == status) {
+                write();
+            }
+            else if (EncoderStatus::NoMore == status) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    uint64_t framesEncoded() const noexcept {
+        return m_framesEncoded;
+    }
+
+    uint64_t framesRetrieved() const noexcept {
+        return m_framesRetrieved;
+    }
+
+    uint64_t framesSkipped() const noexcept {
+        return m_framesSkipped;
+    }
+
+   private:
+    void applyRegionsOfInterest(int64_t timeStamp) noexcept {
+        std::vector<RegionOfInterest> regions;
+        for (const auto &r : m_objectRegions->regions(timeStamp)) {
+            RegionOfInterest mapped{m_preprocessor.mapRegion(r)};
+            if ( (0 < mapped.width) && (0 < mapped.height) ) {
+                regions.push_back(mapped);
+            }
+        }
+        if (!m_regionsApplied || (regions != m_regions)) {
+            if (!m_encoder->setRegionsOfInterest(regions, m_objectRegions->backgroundQpDelta())) {
+                Logger::instance().log(LogLevel::Warning, "Encoder '{}' does not support regions of interest; ignoring them.", m_encoder->name());
+                m_objectRegions = nullptr;
+            }
+            m_regions = regions;
+            m_regionsApplied = true;
+        }
+    }
+
+    void write() noexcept {
+        m_framesRetrieved++;
+        m_encodedFrame.encodingDuration = 0;
+        m_encodedFrame.queueDelay = 0;
+        for (auto it = m_timings.begin(); it != m_timings.end(); it++) {
+            if (it->timeStamp == m_encodedFrame.timeStamp) {
+                m_encodedFrame.encodingDuration = it->encodingDuration;
+                m_encodedFrame.queueDelay = it->queueDelay;
+                m_timings.erase(it);
+                break;
+            }
+        }
+        if (0 < m_encodedFrame.size) {
+            m_writer(*this, m_encodedFrame);
+        }
+        // The writer keeps its own reference if it needs the data later.
+        m_encodedFrame.buffer.reset();
+    }
+
+    void run() noexcept {
+        Tracer::instance().nameThread("encoder-" + std::to_string(m_senderStamp));
+        while (true) {
+            Frame captured;
+            {
+                std::unique_lock<std::mutex> lck(m_queueMutex);
+                m_queueCondition.wait(lck, [this](){ return !m_running || !m_queue.empty(); });
+                if (m_queue.empty()) {
+                    break;
+                }
+                captured = m_queue.front();
+                m_queue.pop_front();
+            }
+            m_queueCondition.notify_all();
+
+            if (m_good) {
+                Frame frame;
+                {
+                    TraceScope trace(TraceSpan::Preprocess, captured.timeStamp);
+                    frame = m_preprocessor.process(captured);
+                }
+                encode(frame);
+            }
+        }
+    }
+
+   private:
+    uint32_t m_senderStamp{0};
+    std::unique_ptr<EncoderBackend> m_encoder;
+    FramePreprocessor m_preprocessor;
+    EncoderSettings m_settings{};
+    Writer m_writer{};
+    EncodedFrame m_encodedFrame{};
+    ObjectRegions *m_objectRegions{nullptr};
+    std::vector<RegionOfInterest> m_regions{};
+    bool m_regionsApplied{false};
+    std::atomic<bool> m_good{true};
+    // Timings of the frames inside of the encoder.
+    std::deque<Timing> m_timings{};
+    int64_t m_lastTimeStamp{0};
+
+    uint64_t m_framesEncoded{0};
+    uint64_t m_framesRetrieved{0};
+    uint64_t m_framesSkipped{0};
+    std::unique_ptr<StaticSceneDetector> m_staticSceneDetector{nullptr};
+
+    std::thread m_thread{};
+    std::mutex m_queueMutex{};
+    std::condition_variable m_queueCondition{};
+    std::deque<Frame> m_queue{};
+    bool m_running{false};
+};
+
+#endif
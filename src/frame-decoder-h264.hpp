@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODER_H264_HPP
+#define FRAME_DECODER_H264_HPP
+
+#include "frame-decoder.hpp"
+#include "logger.hpp"
+
+#include <wels/codec_api.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * H264FrameDecoder decodes h264 payloads (Annex B, as recorded by
+ * opendlv-video-h264-encoder) with openh264 into I420 frames. Decoding needs
+ * to start at a frame for which isH264KeyFrame() holds.
+ */
+class H264FrameDecoder : public FrameDecoder {
+   private:
+    H264FrameDecoder(const H264FrameDecoder &) = delete;
+    H264FrameDecoder(H264FrameDecoder &&)      = delete;
+    H264FrameDecoder &operator=(const H264FrameDecoder &) = delete;
+    H264FrameDecoder &operator=(H264FrameDecoder &&) = delete;
+
+   public:
+    H264FrameDecoder() noexcept {
+        if ( (0 != WelsCreateDecoder(&m_decoder)) || (nullptr == m_decoder) ) {
+            Logger::instance().log(LogLevel::Error, "Error creating h264 decoder.");
+            m_decoder = nullptr;
+            return;
+        }
+        SDecodingParam decodingParam;
+        std::memset(&decodingParam, 0, sizeof(decodingParam));
+        decodingParam.eEcActiveIdc = ERROR_CON_DISABLE;
+        decodingParam.bParseOnly = false;
+        decodingParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_DEFAULT;
+        if (0 != m_decoder->Initialize(&decodingParam)) {
+            Logger::instance().log(LogLevel::Error, "Error initializing h264 decoder.");
+            WelsDestroyDecoder(m_decoder);
+            m_decoder = nullptr;
+        }
+    }
+
+    ~H264FrameDecoder() override {
+        if (nullptr != m_decoder) {
+            m_decoder->Uninitialize();
+            WelsDestroyDecoder(m_decoder);
+        }
+    }
+
+    bool decode(const std::string &data, Frame &frame) noexcept override {
+        if (nullptr == m_decoder) {
+            return false;
+        }
+        unsigned char *yuv[3]{nullptr, nullptr, nullptr};
+        SBufferInfo bufferInfo;
+        std::memset(&bufferInfo, 0, sizeof(bufferInfo));
+        if ( (dsErrorFree != m_decoder->DecodeFrameNoDelay(reinterpret_cast<const unsigned char*>(data.data()), static_cast<int>(data.size()), yuv, &bufferInfo)) ||
+             (1 != bufferInfo.iBufferStatus) ) {
+            return false;
+        }
+
+        // The planes are owned by the decoder and may reside in separate allocations; pack them into a single frame.
+        const uint32_t W{static_cast<uint32_t>(bufferInfo.UsrData.sSystemBuffer.iWidth)};
+        const uint32_t H{static_cast<uint32_t>(bufferInfo.UsrData.sSystemBuffer.iHeight)};
+        m_buffer.resize(frameSize(FOURCC_I420, W, H));
+        frame = describeFrame(FOURCC_I420, W, H, m_buffer.data());
+        for (uint32_t i{0}; i < 3; i++) {
+            const uint32_t STRIDE{static_cast<uint32_t>(bufferInfo.UsrData.sSystemBuffer.iStride[(0 == i) ? 0 : 1])};
+            for (uint32_t y{0}; y < ((0 == i) ? H : H / 2); y++) {
+                std::memcpy(frame.plane(i) + static_cast<std::size_t>(y) * frame.pitch[i], yuv[i] + static_cast<std::size_t>(y) * STRIDE, frame.pitch[i]);
+            }
+        }
+        return true;
+    }
+
+   private:
+    ISVCDecoder *m_decoder{nullptr};
+    std::vector<uint8_t> m_buffer{};
+};
+
+/**
+ * @return true if the h264 payload contains an IDR slice or a sequence parameter set so that decoding can start here.
+ */
+inline bool isH264KeyFrame(const std::string &data) noexcept {
+    for (std::size_t i{0}; i + 3 < data.size(); i++) {
+        if ( (0 == data[i]) && (0 == data[i + 1]) && (1 == data[i + 2]) ) {
+            const uint8_t NAL_UNIT_TYPE{static_cast<uint8_t>(data[i + 3] & 0x1F)};
+            if ( (5 == NAL_UNIT_TYPE) || (7 == NAL_UNIT_TYPE) ) {
+                return true;
+            }
+            i += 2;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODER_RAW_HPP
+#define FRAME_DECODER_RAW_HPP
+
+#include "encoder-backend-raw.hpp"
+#include "frame-decoder.hpp"
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * RawFrameDecoder describes uncompressed payloads (I420, NV12, YUYV, BGR3,
+ * RGB3) in place.
+ */
+class RawFrameDecoder : public FrameDecoder {
+   private:
+    RawFrameDecoder(const RawFrameDecoder &) = delete;
+    RawFrameDecoder(RawFrameDecoder &&)      = delete;
+    RawFrameDecoder &operator=(const RawFrameDecoder &) = delete;
+    RawFrameDecoder &operator=(RawFrameDecoder &&) = delete;
+
+   public:
+    RawFrameDecoder(uint32_t fourcc, uint32_t width, uint32_t height) noexcept
+        : m_fourcc(fourcc)
+        , m_width(width)
+        , m_height(height) {}
+
+    bool decode(const std::string &data, Frame &frame) noexcept override {
+        if (data.size() < frameSize(m_fourcc, m_width, m_height)) {
+            return false;
+        }
+        frame = describeFrame(m_fourcc, m_width, m_height, reinterpret_cast<uint8_t*>(const_cast<char*>(data.data())));
+        return true;
+    }
+
+   private:
+    uint32_t m_fourcc{0};
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+};
+
+/**
+ * CompressedFrameDecoder restores I420 frames recorded by RawEncoderBackend
+ * with LZ4 (I4LZ) or zstd (I4ZS) compression.
+ */
+class CompressedFrameDecoder : public FrameDecoder {
+   private:
+    CompressedFrameDecoder(const CompressedFrameDecoder &) = delete;
+    CompressedFrameDecoder(CompressedFrameDecoder &&)      = delete;
+    CompressedFrameDecoder &operator=(const CompressedFrameDecoder &) = delete;
+    CompressedFrameDecoder &operator=(CompressedFrameDecoder &&) = delete;
+
+   public:
+    CompressedFrameDecoder(RawCompression compression, uint32_t width, uint32_t height) noexcept
+        : m_compression(compression)
+        , m_width(width)
+        , m_height(height)
+        , m_buffer(frameSize(FOURCC_I420, width, height)) {}
+
+    bool decode(const std::string &data, Frame &frame) noexcept override {
+        frame = describeFrame(FOURCC_I420, m_width, m_height, m_buffer.data());
+        const uint8_t *src{reinterpret_cast<const uint8_t*>(data.data())};
+        std::size_t pos{0};
+        for (uint32_t i{0}; i < 3; i++) {
+            if (pos + 4 > data.size()) {
+                return false;
+            }
+            const uint32_t SIZE{static_cast<uint32_t>(src[pos]) | (static_cast<uint32_t>(src[pos + 1]) << 8) | (static_cast<uint32_t>(src[pos + 2]) << 16) | (static_cast<uint32_t>(src[pos + 3]) << 24)};
+            pos += 4;
+            const std::size_t PLANE_SIZE{static_cast<std::size_t>(frame.pitch[i]) * ((0 == i) ? m_height : m_height / 2)};
+            if (pos + SIZE > data.size()) {
+                return false;
+            }
+            bool ok{false};
+            if (RawCompression::Lz4 == m_compression) {
+                ok = (static_cast<int>(PLANE_SIZE) == LZ4_decompress_safe(data.data() + pos, reinterpret_cast<char*>(frame.plane(i)), static_cast<int>(SIZE), static_cast<int>(PLANE_SIZE)));
+            }
+            else {
+                ok = (PLANE_SIZE == ZSTD_decompress(frame.plane(i), PLANE_SIZE, src + pos, SIZE));
+            }
+            if (!ok) {
+                return false;
+            }
+            pos += SIZE;
+        }
+        return true;
+    }
+
+   private:
+    RawCompression m_compression{RawCompression::None};
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    std::vector<uint8_t> m_buffer{};
+};
+
+#endif
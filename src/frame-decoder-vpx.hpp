@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODER_VPX_HPP
+#define FRAME_DECODER_VPX_HPP
+
+#include "frame-decoder.hpp"
+#include "logger.hpp"
+
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+/**
+ * VpxFrameDecoder decodes VP9 payloads (VP90, as recorded by the qsv and vpx
+ * backends) with libvpx into I420 frames. Decoding needs to start at a key
+ * frame.
+ */
+class VpxFrameDecoder : public FrameDecoder {
+   private:
+    VpxFrameDecoder(const VpxFrameDecoder &) = delete;
+    VpxFrameDecoder(VpxFrameDecoder &&)      = delete;
+    VpxFrameDecoder &operator=(const VpxFrameDecoder &) = delete;
+    VpxFrameDecoder &operator=(VpxFrameDecoder &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param threads Decoder threads; 0 lets libvpx decide.
+     */
+    explicit VpxFrameDecoder(uint32_t threads = 0) noexcept {
+        vpx_codec_dec_cfg_t cfg;
+        std::memset(&cfg, 0, sizeof(cfg));
+        cfg.threads = threads;
+        m_initialized = (VPX_CODEC_OK == vpx_codec_dec_init(&m_codec, vpx_codec_vp9_dx(), &cfg, 0));
+        if (!m_initialized) {
+            Logger::instance().log(LogLevel::Error, "Error initializing VP9 decoder: {}", vpx_codec_error(&m_codec));
+        }
+    }
+
+    ~VpxFrameDecoder() override {
+        if (m_initialized) {
+            vpx_codec_destroy(&m_codec);
+        }
+    }
+
+    bool decode(const std::string &data, Frame &frame) noexcept override {
+        if ( !m_initialized ||
+             (VPX_CODEC_OK != vpx_codec_decode(&m_codec, reinterpret_cast<const uint8_t*>(data.data()), static_cast<unsigned int>(data.size()), nullptr, 0)) ) {
+            return false;
+        }
+        vpx_codec_iter_t iterator{nullptr};
+        const vpx_image_t *image{vpx_codec_get_frame(&m_codec, &iterator)};
+        if ( (nullptr == image) || (VPX_IMG_FMT_I420 != image->fmt) ) {
+            return false;
+        }
+
+        // Describe the decoder's planes in place; their strides include the padding for its reference frames.
+        uint8_t *first{image->planes[0]};
+        uint8_t *last{image->planes[0]};
+        for (uint32_t i{0}; i < 3; i++) {
+            const uint32_t ROWS{(0 == i) ? image->d_h : (image->d_h + 1) / 2};
+            first = std::min(first, image->planes[i]);
+            last = std::max(last, image->planes[i] + static_cast<std::size_t>(ROWS) * static_cast<uint32_t>(image->stride[i]));
+        }
+        if (static_cast<std::size_t>(last - first) > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        frame = Frame{};
+        frame.fourcc = FOURCC_I420;
+        frame.width = image->d_w;
+        frame.height = image->d_h;
+        frame.data = first;
+        frame.size = static_cast<uint32_t>(last - first);
+        for (uint32_t i{0}; i < 3; i++) {
+            frame.pitch[i] = static_cast<uint32_t>(image->stride[i]);
+            frame.offset[i] = static_cast<uint32_t>(image->planes[i] - first);
+        }
+        return true;
+    }
+
+   private:
+    vpx_codec_ctx_t m_codec{};
+    bool m_initialized{false};
+};
+
+#endif
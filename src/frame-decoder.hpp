@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODER_HPP
+#define FRAME_DECODER_HPP
+
+#include "frame.hpp"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * FrameDecoder turns the payload of recorded ImageReadings of one stream back
+ * into uncompressed Frames, e.g., to re-encode them.
+ */
+class FrameDecoder {
+   public:
+    virtual ~FrameDecoder() = default;
+
+    /**
+     * This method decodes the payload of the next ImageReading of the stream.
+     *
+     * @param data Payload of the ImageReading; it must outlive the returned frame.
+     * @param frame Decoded image; valid until the next call.
+     * @return true if frame describes a decoded image.
+     */
+    virtual bool decode(const std::string &data, Frame &frame) noexcept = 0;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODERS_HPP
+#define FRAME_DECODERS_HPP
+
+#include "frame-decoder.hpp"
+#include "frame-decoder-h264.hpp"
+#include "frame-decoder-raw.hpp"
+
+#include <memory>
+#include <string>
+
+/**
+ * @return true if frames of the given ImageReading fourcc depend on previous frames.
+ */
+inline bool isPredictive(const std::string &fourcc) noexcept {
+    return ("h264" == fourcc) || ("H264" == fourcc);
+}
+
+/**
+ * @return true if decoding a stream can start at the given ImageReading payload.
+ */
+inline bool isKeyFrame(const std::string &fourcc, const std::string &data) noexcept {
+    return !isPredictive(fourcc) || isH264KeyFrame(data);
+}
+
+/**
+ * @return true if ImageReadings with the given fourcc and size can be decoded.
+ */
+inline bool isDecodable(const std::string &fourcc, uint32_t width, uint32_t height) noexcept {
+    const uint32_t RAW{(4 == fourcc.size()) ? makeFourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]) : 0};
+    return isPredictive(fourcc) || ("I4LZ" == fourcc) || ("I4ZS" == fourcc) || ((0 < width) && (0 < height) && (0 < frameSize(RAW, width, height)));
+}
+
+/**
+ * @return FrameDecoder for ImageReadings with the given fourcc and size or nullptr if unsupported (e.g., VP90).
+ */
+inline std::unique_ptr<FrameDecoder> createFrameDecoder(const std::string &fourcc, uint32_t width, uint32_t height) noexcept {
+    std::unique_ptr<FrameDecoder> decoder{nullptr};
+    if (!isDecodable(fourcc, width, height)) {
+        return decoder;
+    }
+    if (isPredictive(fourcc)) {
+        decoder.reset(new H264FrameDecoder());
+    }
+    else if ("I4LZ" == fourcc) {
+        decoder.reset(new CompressedFrameDecoder(RawCompression::Lz4, width, height));
+    }
+    else if ("I4ZS" == fourcc) {
+        decoder.reset(new CompressedFrameDecoder(RawCompression::Zstd, width, height));
+    }
+    else {
+        decoder.reset(new RawFrameDecoder(makeFourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]), width, height));
+    }
+    return decoder;
+}
+
+#endif
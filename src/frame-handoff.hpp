@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_HANDOFF_HPP
+#define FRAME_HANDOFF_HPP
+
+#include "cluon-complete.hpp"
+#include "frame-ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/**
+ * FrameHandoff hands frames from a producer's shared memory area to the
+ * recorder exactly once.
+ *
+ * Producers opt in by allocating sizeWithTrailer(frameSize) bytes and by
+ * calling publish() after writing a frame while still holding the lock; this
+ * increments a sequence number stored in a trailer after the (8-byte aligned)
+ * frame. With a sequence number, acquire() does not wait at all when a frame
+ * arrived while the previous one was encoded, ignores wakeups without a new
+ * frame, counts frames that were overwritten before they were captured, and
+ * locks the shared memory only once per frame.
+ *
+ * Producers that lay out the area as FrameRing hand over frames in slots;
+ * acquire() then reserves the slot with the newest frame instead of locking,
+ * so that the producer keeps writing into the other slots meanwhile.
+ *
+ * For producers with neither, acquire() waits and locks as before and treats
+ * an unchanged time stamp as a duplicate wakeup once the producer is seen to
+ * set time stamps.
+ *
+ * Optionally, acquire() busy-polls the sequence number for a given time
+ * before it falls back to waiting; this avoids the latency of being woken up
+ * by the scheduler at the cost of a core that is spinning meanwhile.
+ */
+class FrameHandoff {
+   private:
+    FrameHandoff(const FrameHandoff &) = delete;
+    FrameHandoff(FrameHandoff &&)      = delete;
+    FrameHandoff &operator=(const FrameHandoff &) = delete;
+    FrameHandoff &operator=(FrameHandoff &&) = delete;
+
+    // "SEQN" in little endian.
+    static const uint32_t MAGIC{0x4E514553};
+
+    struct Trailer {
+        std::atomic<uint32_t> magic;
+        uint32_t reserved;
+        std::atomic<uint64_t> sequence;
+    };
+    static_assert(sizeof(Trailer) == 16, "Trailer needs to have the same layout for all producers.");
+
+   public:
+    static uint32_t sizeWithTrailer(uint32_t frameSize) noexcept {
+        return trailerOffset(frameSize) + static_cast<uint32_t>(sizeof(Trailer));
+    }
+
+    /**
+     * This method marks the frame in the shared memory as new; it needs to be
+     * called by the producer while holding the lock and before notifyAll().
+     */
+    static void publish(cluon::SharedMemory &sharedMemory, uint32_t frameSize) noexcept {
+        Trailer *t{trailer(sharedMemory, frameSize)};
+        if (nullptr != t) {
+            t->magic.store(MAGIC, std::memory_order_relaxed);
+            t->sequence.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    /**
+     * Constructor.
+     *
+     * @param sharedMemory Shared memory area of the producer.
+     * @param frameSize Size of a frame; 0 if the frames reside in buffers
+     *        imported with FrameImport and the area holds a FrameRing only.
+     */
+    FrameHandoff(cluon::SharedMemory &sharedMemory, uint32_t frameSize) noexcept
+        : m_sharedMemory(sharedMemory)
+        , m_frameSize(frameSize)
+        , m_trailer(trailer(sharedMemory, frameSize))
+        , m_ring(sharedMemory.valid() ? sharedMemory.data() : nullptr, sharedMemory.valid() ? sharedMemory.size() : 0) {}
+
+    ~FrameHandoff() {
+        release();
+    }
+
+    /**
+     * This method waits for a frame that was not acquired before and holds
+     * it, i.e., locks the shared memory or reserves the frame's slot, until
+     * release() is called.
+     *
+     * @return true if a new frame is held; false after a wakeup without a
+     *         new frame, in which case nothing is held.
+     */
+    bool acquire() noexcept {
+        // The layout is fixed once the first frame was acquired.
+        m_isRing = m_isRing || ((0 == m_framesAcquired) && m_ring.valid(m_frameSize));
+        if (m_isRing) {
+            return acquireFromRing();
+        }
+        uint64_t next{sequence()};
+        if (0 == next) {
+            return acquireWithoutSequence();
+        }
+        if ( (next == m_sequence) && (0 < m_spin.count()) ) {
+            next = poll();
+        }
+        if (next == m_sequence) {
+            m_sharedMemory.wait();
+            next = sequence();
+            if (next == m_sequence) {
+                backOff();
+                return false;
+            }
+        }
+        m_sharedMemory.lock();
+        m_locked = true;
+        // The producer might have published further frames meanwhile; the newest one is locked now.
+        next = sequence();
+        if ( (0 < m_sequence) && (next > m_sequence + 1) ) {
+            m_framesMissed += next - m_sequence - 1;
+        }
+        m_sequence = next;
+        m_sequenced = true;
+        m_framesAcquired++;
+        return true;
+    }
+
+    /**
+     * @return Frame held after acquire().
+     */
+    uint8_t *data() noexcept {
+        return (0 <= m_slot) ? m_ring.data(m_slot) : reinterpret_cast<uint8_t*>(m_sharedMemory.data());
+    }
+
+    /**
+     * @return Index of the FrameRing slot held after acquire() or -1 for other layouts.
+     */
+    int32_t slot() const noexcept {
+        return m_slot;
+    }
+
+    /**
+     * @return Sample time stamp in microseconds of the frame held or 0 if the producer did not set one.
+     */
+    int64_t timeStamp() noexcept {
+        if (0 <= m_slot) {
+            return m_ring.timeStamp(m_slot);
+        }
+        auto r = m_sharedMemory.getTimeStamp();
+        return r.first ? cluon::time::toMicroseconds(r.second) : 0;
+    }
+
+    /**
+     * This method hands the frame back to the producer; calling it again has no effect.
+     */
+    void release() noexcept {
+        if (0 <= m_slot) {
+            m_ring.release(m_slot);
+            m_slot = -1;
+        }
+        if (m_locked) {
+            m_sharedMemory.unlock();
+            m_locked = false;
+        }
+    }
+
+    /**
+     * @return Description of how frames are handed over.
+     */
+    std::string mode() const noexcept {
+        return m_isRing ? "ring of " + std::to_string(m_ring.slotCount()) + " slots" : (m_sequenced ? "with sequence numbers" : "without sequence numbers");
+    }
+
+    /**
+     * This method sets the time to busy-poll for a new frame before waiting;
+     * it only has an effect for producers that publish sequence numbers or
+     * use a FrameRing.
+     */
+    void spin(std::chrono::microseconds budget) noexcept {
+        m_spin = budget;
+    }
+
+    uint64_t framesAcquired() const noexcept {
+        return m_framesAcquired;
+    }
+
+    uint64_t framesMissed() const noexcept {
+        return m_framesMissed;
+    }
+
+    uint64_t duplicateWakeups() const noexcept {
+        return m_duplicateWakeups;
+    }
+
+    /**
+     * @return Number of frames that arrived while busy-polling.
+     */
+    uint64_t framesSpun() const noexcept {
+        return m_framesSpun;
+    }
+
+   private:
+    static uint32_t trailerOffset(uint32_t frameSize) noexcept {
+        return (frameSize + 7u) & ~7u;
+    }
+
+    static Trailer *trailer(cluon::SharedMemory &sharedMemory, uint32_t frameSize) noexcept {
+        return (sharedMemory.valid() && (sharedMemory.size() >= sizeWithTrailer(frameSize))) ? reinterpret_cast<Trailer*>(sharedMemory.data() + trailerOffset(frameSize)) : nullptr;
+    }
+
+    // Returns 0 for producers that do not publish sequence numbers.
+    uint64_t sequence() const noexcept {
+        if (m_isRing) {
+            return m_ring.sequence();
+        }
+        return ( (nullptr != m_trailer) && (MAGIC == m_trailer->magic.load(std::memory_order_relaxed)) ) ? m_trailer->sequence.load(std::memory_order_acquire) : 0;
+    }
+
+    static void relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    // Returns the sequence number once it changed or the budget is used up; the clock is read only every few iterations.
+    uint64_t poll() noexcept {
+        const uint32_t ITERATIONS_PER_CLOCK_READ{64};
+        const auto DEADLINE{std::chrono::steady_clock::now() + m_spin};
+        do {
+            for (uint32_t i{0}; i < ITERATIONS_PER_CLOCK_READ; i++) {
+                relax();
+                const uint64_t NEXT{sequence()};
+                if (NEXT != m_sequence) {
+                    m_framesSpun++;
+                    return NEXT;
+                }
+            }
+        } while (std::chrono::steady_clock::now() < DEADLINE);
+        return m_sequence;
+    }
+
+    // cluon's SysV notifyAll() resets the semaphore in two steps and wait() returns at once while the producer is
+    // preempted in between; sleep briefly so that the producer can finish, in particular when this thread uses SCHED_FIFO.
+    void backOff() noexcept {
+        const std::chrono::microseconds DURATION{50};
+        m_duplicateWakeups++;
+        std::this_thread::sleep_for(DURATION);
+    }
+
+    bool acquireFromRing() noexcept {
+        uint64_t next{m_ring.sequence()};
+        if ( (next == m_sequence) && (0 < m_spin.count()) ) {
+            next = poll();
+        }
+        if (next == m_sequence) {
+            m_sharedMemory.wait();
+            if (m_ring.sequence() == m_sequence) {
+                backOff();
+                return false;
+            }
+        }
+        const int32_t SLOT{m_ring.acquire()};
+        if (0 > SLOT) {
+            backOff();
+            return false;
+        }
+        const uint64_t SEQUENCE{m_ring.sequence(SLOT)};
+        if (SEQUENCE <= m_sequence) {
+            m_ring.release(SLOT);
+            backOff();
+            return false;
+        }
+        if ( (0 < m_sequence) && (SEQUENCE > m_sequence + 1) ) {
+            m_framesMissed += SEQUENCE - m_sequence - 1;
+        }
+        m_sequence = SEQUENCE;
+        m_slot = SLOT;
+        m_framesAcquired++;
+        return true;
+    }
+
+    bool acquireWithoutSequence() noexcept {
+        m_sharedMemory.wait();
+        m_sharedMemory.lock();
+        m_locked = true;
+        auto r = m_sharedMemory.getTimeStamp();
+        const int64_t TIMESTAMP{r.first ? cluon::time::toMicroseconds(r.second) : 0};
+        if (m_timeStamped && (TIMESTAMP == m_lastTimeStamp)) {
+            release();
+            backOff();
+            return false;
+        }
+        m_timeStamped = m_timeStamped || ((0 != m_lastTimeStamp) && (TIMESTAMP != m_lastTimeStamp));
+        m_lastTimeStamp = TIMESTAMP;
+        m_framesAcquired++;
+        return true;
+    }
+
+   private:
+    cluon::SharedMemory &m_sharedMemory;
+    uint32_t m_frameSize;
+    Trailer *m_trailer{nullptr};
+    FrameRing m_ring;
+    bool m_isRing{false};
+    int32_t m_slot{-1};
+    bool m_locked{false};
+    uint64_t m_sequence{0};
+    bool m_sequenced{false};
+    bool m_timeStamped{false};
+    int64_t m_lastTimeStamp{0};
+    uint64_t m_framesAcquired{0};
+    uint64_t m_framesMissed{0};
+    uint64_t m_duplicateWakeups{0};
+    std::chrono::microseconds m_spin{0};
+    uint64_t m_framesSpun{0};
+};
+
+#endif
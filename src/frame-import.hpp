@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_IMPORT_HPP
+#define FRAME_IMPORT_HPP
+
+#include "frame.hpp"
+
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * FrameImport receives the buffers that a producer renders its frames into,
+ * so that frames are encoded from there instead of from the shared memory.
+ *
+ * The producer listens on a Unix domain socket; once the recorder connects,
+ * the producer sends one Description together with one file descriptor per
+ * buffer (SCM_RIGHTS) using offer(). Buffer i holds the frame of slot i of
+ * the FrameRing in the shared memory, which still carries sequence numbers,
+ * time stamps, and the notifications; its slots do not hold pixels.
+ *
+ * DMA-BUF file descriptors (e.g., exported from VA surfaces or V4L2 buffers)
+ * are handed to the encoder as they are; the qsv backend imports them as VA
+ * surfaces and encodes them without copying. All buffers are also mapped into memory whenever possible
+ * for backends and preprocessing that need the pixels; producers without a
+ * GPU can offer plain memory, e.g., from memfd_create(), the same way.
+ * Descriptions whose planes do not fit into size, or buffers smaller than
+ * size, are rejected before anything is mapped.
+ */
+class FrameImport {
+   private:
+    FrameImport(const FrameImport &) = delete;
+    FrameImport(FrameImport &&)      = delete;
+    FrameImport &operator=(const FrameImport &) = delete;
+    FrameImport &operator=(FrameImport &&) = delete;
+
+    static const uint32_t VERSION{1};
+    static const uint32_t MAX_BUFFERS{16};
+
+   public:
+    enum BufferType : uint32_t {
+        MEMORY  = 0, // Can only be mapped, e.g., memfd or POSIX shared memory.
+        DMA_BUF = 1,
+    };
+
+    /**
+     * Layout of the buffers as sent by the producer.
+     */
+    struct Description {
+        // "FRMIMPT1"
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+        uint32_t type;
+        uint32_t fourcc;
+        uint32_t width;
+        uint32_t height;
+        uint32_t size;
+        uint32_t pitch[3];
+        uint32_t offset[3];
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Description) == 64, "Description needs to have the same layout for all producers.");
+
+    /**
+     * This method sends the description of count buffers and their file
+     * descriptors over a connected socket (producer).
+     *
+     * @return true on success.
+     */
+    static bool offer(int connection, Description description, const int *fds, uint32_t count) noexcept {
+        if ( (0 == count) || (count > MAX_BUFFERS) ) {
+            return false;
+        }
+        std::memcpy(description.magic, magic(), sizeof(description.magic));
+        description.version = VERSION;
+        description.count = count;
+
+        struct iovec iov;
+        iov.iov_base = &description;
+        iov.iov_len = sizeof(description);
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_BUFFERS), 0);
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *cmsg{CMSG_FIRSTHDR(&message)};
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+        return static_cast<ssize_t>(sizeof(description)) == ::sendmsg(connection, &message, MSG_NOSIGNAL);
+    }
+
+    FrameImport() = default;
+
+    ~FrameImport() {
+        for (auto &b : m_buffers) {
+            if (nullptr != b.data) {
+                ::munmap(b.data, m_description.size);
+            }
+            ::close(b.fd);
+        }
+    }
+
+    /**
+     * This method connects to the producer's socket and receives its buffers.
+     *
+     * @return Empty string on success or a description of the error.
+     */
+    std::string connect(const std::string &path) noexcept {
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return "path too long";
+        }
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+        int s{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        if (0 > s) {
+            return std::strerror(errno);
+        }
+        if (0 != ::connect(s, reinterpret_cast<struct sockaddr*>(&address), sizeof(address))) {
+            const std::string ERROR{std::strerror(errno)};
+            ::close(s);
+            return ERROR;
+        }
+
+        struct iovec iov;
+        iov.iov_base = &m_description;
+        iov.iov_len = sizeof(m_description);
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_BUFFERS), 0);
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        const ssize_t N{::recvmsg(s, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC)};
+        ::close(s);
+
+        // Take ownership of all received file descriptors first so that they are closed on errors.
+        for (struct cmsghdr *cmsg{CMSG_FIRSTHDR(&message)}; nullptr != cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if ( (SOL_SOCKET == cmsg->cmsg_level) && (SCM_RIGHTS == cmsg->cmsg_type) ) {
+                const std::size_t COUNT{(cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)};
+                for (std::size_t i{0}; i < COUNT; i++) {
+                    Buffer b;
+                    std::memcpy(&b.fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    m_buffers.push_back(b);
+                }
+            }
+        }
+        if (static_cast<ssize_t>(sizeof(m_description)) != N) {
+            return "incomplete description";
+        }
+        if ( (0 != std::memcmp(m_description.magic, magic(), sizeof(m_description.magic))) || (VERSION != m_description.version) ) {
+            return "unknown protocol";
+        }
+        if ( (0 != (message.msg_flags & MSG_CTRUNC)) || (m_buffers.size() != m_description.count) ) {
+            return "expected " + std::to_string(m_description.count) + " buffers but received " + std::to_string(m_buffers.size());
+        }
+
+        const std::string LAYOUT{checkLayout()};
+        if (!LAYOUT.empty()) {
+            return LAYOUT;
+        }
+        for (const auto &b : m_buffers) {
+            // DMA-BUFs report their size only via lseek, memory via fstat.
+            struct stat st;
+            const off_t SIZE{(DMA_BUF == m_description.type) ? ::lseek(b.fd, 0, SEEK_END) : ((0 == ::fstat(b.fd, &st)) ? st.st_size : -1)};
+            if (0 > SIZE) {
+                return "cannot determine the size of a buffer: " + std::string(std::strerror(errno));
+            }
+            if (static_cast<uint64_t>(SIZE) < m_description.size) {
+                return "buffer of " + std::to_string(SIZE) + " bytes is smaller than the described size of " + std::to_string(m_description.size) + " bytes";
+            }
+        }
+
+        for (auto &b : m_buffers) {
+            void *p{::mmap(nullptr, m_description.size, PROT_READ, MAP_SHARED, b.fd, 0)};
+            b.data = (MAP_FAILED != p) ? static_cast<uint8_t*>(p) : nullptr;
+            m_mapped = m_mapped && (nullptr != b.data);
+        }
+        if ( (MEMORY == m_description.type) && !m_mapped ) {
+            return "could not map buffers";
+        }
+        return "";
+    }
+
+    const Description &description() const noexcept {
+        return m_description;
+    }
+
+    uint32_t count() const noexcept {
+        return static_cast<uint32_t>(m_buffers.size());
+    }
+
+    /**
+     * @return true if the pixels of all buffers are accessible via Frame::data.
+     */
+    bool mapped() const noexcept {
+        return m_mapped && !m_buffers.empty();
+    }
+
+    /**
+     * This method needs to be called before the pixels of the given buffer are
+     * read via Frame::data: exporters of DMA-BUFs whose caches are not coherent
+     * with the CPU would return stale data otherwise. It does nothing for
+     * buffers in plain memory or that are not mapped.
+     *
+     * @return true on success.
+     */
+    bool beginRead(uint32_t index) const noexcept {
+        return sync(index, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    }
+
+    /**
+     * This method needs to be called after reading the given buffer and before
+     * handing it back to the producer.
+     *
+     * @return true on success.
+     */
+    bool endRead(uint32_t index) const noexcept {
+        return sync(index, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    }
+
+    /**
+     * @return Frame describing the image in the given buffer.
+     */
+    Frame frame(uint32_t index, int64_t timeStamp) const noexcept {
+        Frame f;
+        f.fourcc = m_description.fourcc;
+        f.width = m_description.width;
+        f.height = m_description.height;
+        f.data = m_buffers[index].data;
+        f.size = m_description.size;
+        for (uint32_t i{0}; i < 3; i++) {
+            f.pitch[i] = m_description.pitch[i];
+            f.offset[i] = m_description.offset[i];
+        }
+        f.timeStamp = timeStamp;
+        f.dmaBuf = (DMA_BUF == m_description.type) ? m_buffers[index].fd : -1;
+        return f;
+    }
+
+   private:
+    static const char *magic() noexcept {
+        return "FRMIMPT1";
+    }
+
+    /**
+     * @return Empty string if all planes of the described format lie within
+     *         size and their rows within their pitch, a description otherwise.
+     */
+    std::string checkLayout() const noexcept {
+        const Description &d{m_description};
+        const uint32_t CHROMA_WIDTH{(d.width + 1) / 2};
+        const uint32_t CHROMA_HEIGHT{(d.height + 1) / 2};
+        // Bytes per row and rows of each plane.
+        uint32_t planes{0};
+        uint64_t rowBytes[3]{0, 0, 0};
+        uint64_t rows[3]{0, 0, 0};
+        if (FOURCC_I420 == d.fourcc) {
+            planes = 3;
+            rowBytes[0] = d.width;
+            rows[0] = d.height;
+            rowBytes[1] = rowBytes[2] = CHROMA_WIDTH;
+            rows[1] = rows[2] = CHROMA_HEIGHT;
+        }
+        else if (FOURCC_NV12 == d.fourcc) {
+            planes = 2;
+            rowBytes[0] = d.width;
+            rows[0] = d.height;
+            rowBytes[1] = 2 * static_cast<uint64_t>(CHROMA_WIDTH);
+            rows[1] = CHROMA_HEIGHT;
+        }
+        else if (FOURCC_YUYV == d.fourcc) {
+            planes = 1;
+            rowBytes[0] = 4 * static_cast<uint64_t>(CHROMA_WIDTH);
+            rows[0] = d.height;
+        }
+        else if ( (FOURCC_BGR == d.fourcc) || (FOURCC_RGB == d.fourcc) ) {
+            planes = 1;
+            rowBytes[0] = 3 * static_cast<uint64_t>(d.width);
+            rows[0] = d.height;
+        }
+        if ( (0 == planes) || (0 == d.width) || (0 == d.height) ) {
+            return "unsupported format or size";
+        }
+        for (uint32_t i{0}; i < planes; i++) {
+            if (d.pitch[i] < rowBytes[i]) {
+                return "pitch " + std::to_string(d.pitch[i]) + " of plane " + std::to_string(i) + " is smaller than its rows of " + std::to_string(rowBytes[i]) + " bytes";
+            }
+            if (static_cast<uint64_t>(d.offset[i]) + static_cast<uint64_t>(d.pitch[i]) * rows[i] > d.size) {
+                return "plane " + std::to_string(i) + " exceeds the described size of " + std::to_string(d.size) + " bytes";
+            }
+        }
+        return "";
+    }
+
+    bool sync(uint32_t index, uint64_t flags) const noexcept {
+        if ( (DMA_BUF != m_description.type) || (index >= m_buffers.size()) || (nullptr == m_buffers[index].data) ) {
+            return true;
+        }
+        struct dma_buf_sync sync{};
+        sync.flags = flags;
+        int32_t retVal{-1};
+        do {
+            retVal = ::ioctl(m_buffers[index].fd, DMA_BUF_IOCTL_SYNC, &sync);
+        } while ( (-1 == retVal) && ((EINTR == errno) || (EAGAIN == errno)) );
+        return (0 == retVal);
+    }
+
+   private:
+    struct Buffer {
+        int fd{-1};
+        uint8_t *data{nullptr};
+    };
+
+    Description m_description{};
+    std::vector<Buffer> m_buffers{};
+    bool m_mapped{true};
+};
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * FramePool hands out reusable, cache-line aligned buffers of a fixed size.
+ * Buffers return to the pool once the last shared_ptr to them is released,
+ * so no memory is allocated per frame once the pool is warm.
+ */
+class FramePool {
+   private:
+    FramePool(const FramePool &) = delete;
+    FramePool(FramePool &&)      = delete;
+    FramePool &operator=(const FramePool &) = delete;
+    FramePool &operator=(FramePool &&) = delete;
+
+   private:
+    struct State {
+        std::mutex mutex{};
+        std::vector<uint8_t*> free{};
+        ~State() {
+            for (auto b : free) {
+                ::free(b);
+            }
+        }
+    };
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param bufferSize Size of each buffer in bytes.
+     * @param count Number of buffers to allocate ahead of time.
+     */
+    FramePool(uint32_t bufferSize, uint32_t count) noexcept
+        : m_bufferSize(bufferSize) {
+        for (uint32_t i{0}; i < count; i++) {
+            uint8_t *b = allocate();
+            if (nullptr != b) {
+                m_state->free.push_back(b);
+            }
+        }
+    }
+
+    uint32_t bufferSize() const noexcept {
+        return m_bufferSize;
+    }
+
+    /**
+     * @return Buffer from the pool; a new one is allocated if all are in use.
+     */
+    std::shared_ptr<uint8_t> acquire() noexcept {
+        uint8_t *b{nullptr};
+        {
+            std::lock_guard<std::mutex> lck(m_state->mutex);
+            if (!m_state->free.empty()) {
+                b = m_state->free.back();
+                m_state->free.pop_back();
+            }
+        }
+        if (nullptr == b) {
+            b = allocate();
+        }
+        std::shared_ptr<State> state{m_state};
+        return std::shared_ptr<uint8_t>(b, [state](uint8_t *p) {
+            if (nullptr != p) {
+                std::lock_guard<std::mutex> lck(state->mutex);
+                state->free.push_back(p);
+            }
+        });
+    }
+
+   private:
+    uint8_t *allocate() noexcept {
+        const std::size_t ALIGNMENT{64};
+        void *p{nullptr};
+        if (0 != ::posix_memalign(&p, ALIGNMENT, (m_bufferSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1))) {
+            p = nullptr;
+        }
+        else {
+            // Touch all pages now rather than on the first frame.
+            std::memset(p, 0, m_bufferSize);
+        }
+        return static_cast<uint8_t*>(p);
+    }
+
+   private:
+    uint32_t m_bufferSize{0};
+    std::shared_ptr<State> m_state{std::make_shared<State>()};
+};
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_PREPROCESSOR_HPP
+#define FRAME_PREPROCESSOR_HPP
+
+#include "encoder-backend.hpp"
+#include "frame.hpp"
+#include "frame-pool.hpp"
+#include "thread-pool.hpp"
+
+#include <libyuv.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/**
+ * Geometric operations applied to the image from the shared memory; they are
+ * applied in the order crop, flip, scale. Zero values select the full frame.
+ */
+struct Preprocessing {
+    uint32_t cropX{0};
+    uint32_t cropY{0};
+    uint32_t cropWidth{0};
+    uint32_t cropHeight{0};
+    bool flipHorizontal{false};
+    bool flipVertical{false};
+    uint32_t scaledWidth{0};
+    uint32_t scaledHeight{0};
+};
+
+/**
+ * FramePreprocessor turns the image produced into the shared memory into a
+ * Frame that the encoder backend accepts.
+ *
+ * Cropping only moves plane pointers. If the backend accepts the source format
+ * and neither flipping nor scaling is requested, the Frame refers to the shared
+ * memory directly. Otherwise, libyuv writes the result in a single pass into a
+ * pooled buffer that is handed to the encoder: format conversions go to the
+ * backend's preferred format (or I420 if there is no single-pass conversion
+ * into it); flipping and scaling produce I420. Vertical flips are free as they
+ * are expressed as negative strides for the kernel doing the pass. Large frames
+ * are processed in horizontal bands (or per plane for scaling) in parallel.
+ */
+class FramePreprocessor {
+   private:
+    FramePreprocessor(const FramePreprocessor &) = delete;
+    FramePreprocessor(FramePreprocessor &&)      = delete;
+    FramePreprocessor &operator=(const FramePreprocessor &) = delete;
+    FramePreprocessor &operator=(FramePreprocessor &&) = delete;
+
+   private:
+    // Planes of an image with signed strides to express vertical flips.
+    struct View {
+        uint32_t fourcc{0};
+        int width{0};
+        int height{0};
+        uint8_t *plane[3]{nullptr, nullptr, nullptr};
+        int stride[3]{0, 0, 0};
+    };
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param fourcc Format of the images in the shared memory.
+     * @param width Width of the images in the shared memory.
+     * @param height Height of the images in the shared memory.
+     * @param preprocessing Geometric operations to apply.
+     * @param backend Encoder backend to prepare frames for.
+     * @param threadPool Worker threads for processing large frames; might be nullptr.
+     */
+    FramePreprocessor(uint32_t fourcc, uint32_t width, uint32_t height, const Preprocessing &preprocessing, const EncoderBackend &backend, ThreadPool *threadPool) noexcept
+        : m_sourceFourcc(fourcc)
+        , m_sourceWidth(width)
+        , m_sourceHeight(height)
+        , m_threadPool(threadPool) {
+        // Crop origin and size must be even to keep 4:2:0 chroma aligned.
+        m_cropX = std::min(preprocessing.cropX & ~1u, width);
+        m_cropY = std::min(preprocessing.cropY & ~1u, height);
+        m_cropWidth = ((0 < preprocessing.cropWidth) ? std::min(preprocessing.cropWidth, width - m_cropX) : width - m_cropX) & ~1u;
+        m_cropHeight = ((0 < preprocessing.cropHeight) ? std::min(preprocessing.cropHeight, height - m_cropY) : height - m_cropY) & ~1u;
+        m_flipHorizontal = preprocessing.flipHorizontal;
+        m_flipVertical = preprocessing.flipVertical;
+        m_width = ((0 < preprocessing.scaledWidth) ? preprocessing.scaledWidth : m_cropWidth) & ~1u;
+        m_height = ((0 < preprocessing.scaledHeight) ? preprocessing.scaledHeight : m_cropHeight) & ~1u;
+        m_scales = (m_width != m_cropWidth) || (m_height != m_cropHeight);
+
+        if (m_scales || m_flipHorizontal || m_flipVertical) {
+            m_targetFourcc = FOURCC_I420;
+        }
+        else if (!backend.accepts(m_sourceFourcc)) {
+            m_targetFourcc = (hasDirectConversion(m_sourceFourcc, backend.preferredFourcc()) ? backend.preferredFourcc() : FOURCC_I420);
+        }
+        else {
+            m_targetFourcc = m_sourceFourcc;
+        }
+
+        if (converts()) {
+            const uint32_t NUMBER_OF_BUFFERS{3};
+            m_framePool.reset(new FramePool(frameSize(m_targetFourcc, m_width, m_height), NUMBER_OF_BUFFERS));
+            // Mirroring and scaling in one go needs an intermediate image; so does any geometric operation on a non-I420 source.
+            if ( (m_flipHorizontal && m_scales) || ((m_flipHorizontal || m_scales) && (FOURCC_I420 != m_sourceFourcc)) ) {
+                m_scratchPool.reset(new FramePool(frameSize(FOURCC_I420, m_cropWidth, m_cropHeight), 1));
+            }
+        }
+    }
+
+    /**
+     * @return true if frames are written into own buffers rather than referring to the shared memory.
+     */
+    bool converts() const noexcept {
+        return (m_sourceFourcc != m_targetFourcc) || m_scales || m_flipHorizontal || m_flipVertical;
+    }
+
+    uint32_t targetFourcc() const noexcept {
+        return m_targetFourcc;
+    }
+
+    /**
+     * @return Width of the frames handed to the encoder.
+     */
+    uint32_t width() const noexcept {
+        return m_width;
+    }
+
+    /**
+     * @return Height of the frames handed to the encoder.
+     */
+    uint32_t height() const noexcept {
+        return m_height;
+    }
+
+    /**
+     * @return Region of the source image mapped into the frames handed to the
+     *         encoder; the result is empty if the region was cropped away.
+     */
+    RegionOfInterest mapRegion(const RegionOfInterest &region) const noexcept {
+        RegionOfInterest r{region};
+        uint64_t x0{std::max(region.x, m_cropX) - m_cropX};
+        uint64_t y0{std::max(region.y, m_cropY) - m_cropY};
+        uint64_t x1{std::min(region.x + region.width, m_cropX + m_cropWidth) - std::min(m_cropX, region.x + region.width)};
+        uint64_t y1{std::min(region.y + region.height, m_cropY + m_cropHeight) - std::min(m_cropY, region.y + region.height)};
+        if ( (x1 <= x0) || (y1 <= y0) ) {
+            r.width = r.height = 0;
+            return r;
+        }
+        if (m_flipHorizontal) {
+            std::swap(x0, x1);
+            x0 = m_cropWidth - x0;
+            x1 = m_cropWidth - x1;
+        }
+        if (m_flipVertical) {
+            std::swap(y0, y1);
+            y0 = m_cropHeight - y0;
+            y1 = m_cropHeight - y1;
+        }
+        // Round outwards when scaling.
+        r.x = static_cast<uint32_t>(x0 * m_width / m_cropWidth);
+        r.y = static_cast<uint32_t>(y0 * m_height / m_cropHeight);
+        r.width = static_cast<uint32_t>((x1 * m_width + m_cropWidth - 1) / m_cropWidth) - r.x;
+        r.height = static_cast<uint32_t>((y1 * m_height + m_cropHeight - 1) / m_cropHeight) - r.y;
+        return r;
+    }
+
+    /**
+     * This method prepares the image at src for encoding; the returned Frame
+     * refers to src itself if no pass over the pixels is needed.
+     */
+    Frame process(uint8_t *src, int64_t timeStamp) noexcept {
+        Frame source{describeFrame(m_sourceFourcc, m_sourceWidth, m_sourceHeight, src)};
+        source.timeStamp = timeStamp;
+        return process(source);
+    }
+
+    /**
+     * This method prepares a frame that was captured into a pooled or an
+     * imported buffer with its own plane layout; the returned Frame keeps
+     * that buffer alive and refers to its DMA-BUF if it refers to it.
+     */
+    Frame process(const Frame &captured) noexcept {
+        Frame source{captured};
+        View view{crop(viewOf(source), m_cropX, m_cropY, m_cropWidth, m_cropHeight)};
+
+        if (!converts()) {
+            // Cropping is expressed by offsets into the source buffer.
+            source.width = m_width;
+            source.height = m_height;
+            for (uint32_t i{0}; i < 3; i++) {
+                source.offset[i] = (nullptr != view.plane[i]) ? static_cast<uint32_t>(view.plane[i] - source.data) : 0;
+            }
+            return source;
+        }
+
+        std::shared_ptr<uint8_t> buffer{m_framePool->acquire()};
+        Frame target{describeFrame(m_targetFourcc, m_width, m_height, buffer.get())};
+        target.timeStamp = captured.timeStamp;
+        target.buffer = buffer;
+        View dst{viewOf(target)};
+
+        if (m_flipVertical) {
+            view = flipVertically(view);
+        }
+
+        if (!m_scales && !m_flipHorizontal) {
+            // Format conversion and/or vertical flip in a single pass.
+            inBands(m_cropHeight, [&](int y, int rows) { convert(band(view, y, rows), band(dst, y, rows)); });
+            return target;
+        }
+
+        std::shared_ptr<uint8_t> scratch{nullptr};
+        if (FOURCC_I420 != view.fourcc) {
+            scratch = m_scratchPool->acquire();
+            View tmp{viewOf(describeFrame(FOURCC_I420, m_cropWidth, m_cropHeight, scratch.get()))};
+            inBands(m_cropHeight, [&](int y, int rows) { convert(band(view, y, rows), band(tmp, y, rows)); });
+            view = tmp;
+        }
+
+        if (m_flipHorizontal) {
+            if (!m_scales) {
+                inBands(m_cropHeight, [&](int y, int rows) { mirror(band(view, y, rows), band(dst, y, rows)); });
+                return target;
+            }
+            // libyuv cannot mirror in place; mirror into another scratch image before scaling.
+            std::shared_ptr<uint8_t> mirrorBuffer{m_scratchPool->acquire()};
+            View mirrored{viewOf(describeFrame(FOURCC_I420, m_cropWidth, m_cropHeight, mirrorBuffer.get()))};
+            inBands(m_cropHeight, [&](int y, int rows) { mirror(band(view, y, rows), band(mirrored, y, rows)); });
+            view = mirrored;
+            scratch = mirrorBuffer;
+        }
+
+        // Scale each plane in parallel.
+        auto scalePlane = [&](uint32_t i) {
+            const int SHIFT{(0 == i) ? 0 : 1};
+            libyuv::ScalePlane(view.plane[i], view.stride[i], view.width >> SHIFT, view.height >> SHIFT,
+                               dst.plane[i], dst.stride[i], dst.width >> SHIFT, dst.height >> SHIFT, libyuv::kFilterBox);
+        };
+        if (nullptr != m_threadPool) {
+            m_threadPool->parallelFor(3, scalePlane);
+        }
+        else {
+            for (uint32_t i{0}; i < 3; i++) {
+                scalePlane(i);
+            }
+        }
+        return target;
+    }
+
+   private:
+    static bool hasDirectConversion(uint32_t from, uint32_t to) noexcept {
+        return (FOURCC_I420 == to) ||
+               ( (FOURCC_NV12 == to) && ((FOURCC_I420 == from) || (FOURCC_YUYV == from)) );
+    }
+
+    static int bytesPerPixel(uint32_t fourcc) noexcept {
+        return (FOURCC_YUYV == fourcc) ? 2 : (((FOURCC_BGR == fourcc) || (FOURCC_RGB == fourcc)) ? 3 : 1);
+    }
+
+    static uint32_t numberOfPlanes(uint32_t fourcc) noexcept {
+        return (FOURCC_I420 == fourcc) ? 3 : ((FOURCC_NV12 == fourcc) ? 2 : 1);
+    }
+
+    static View viewOf(const Frame &f) noexcept {
+        View v;
+        v.fourcc = f.fourcc;
+        v.width = static_cast<int>(f.width);
+        v.height = static_cast<int>(f.height);
+        for (uint32_t i{0}; i < numberOfPlanes(f.fourcc); i++) {
+            v.plane[i] = f.plane(i);
+            v.stride[i] = static_cast<int>(f.pitch[i]);
+        }
+        return v;
+    }
+
+    // Returns the rows [y, y+rows) of v; y is even.
+    static View band(const View &v, int y, int rows) noexcept {
+        View b{v};
+        b.height = rows;
+        for (uint32_t i{0}; i < numberOfPlanes(v.fourcc); i++) {
+            b.plane[i] += static_cast<std::ptrdiff_t>((0 == i) ? y : y/2) * v.stride[i];
+        }
+        return b;
+    }
+
+    static View crop(const View &v, uint32_t x, uint32_t y, uint32_t width, uint32_t height) noexcept {
+        View c{band(v, static_cast<int>(y), static_cast<int>(height))};
+        c.width = static_cast<int>(width);
+        c.plane[0] += static_cast<int>(x) * bytesPerPixel(v.fourcc);
+        if (FOURCC_I420 == v.fourcc) {
+            c.plane[1] += x/2;
+            c.plane[2] += x/2;
+        }
+        else if (FOURCC_NV12 == v.fourcc) {
+            c.plane[1] += x;
+        }
+        return c;
+    }
+
+    static View flipVertically(const View &v) noexcept {
+        View f{v};
+        for (uint32_t i{0}; i < numberOfPlanes(v.fourcc); i++) {
+            const int ROWS{(0 == i) ? v.height : v.height/2};
+            f.plane[i] += static_cast<std::ptrdiff_t>(ROWS - 1) * v.stride[i];
+            f.stride[i] = -v.stride[i];
+        }
+        return f;
+    }
+
+    // Runs task for horizontal bands covering height rows in parallel.
+    void inBands(uint32_t height, const std::function<void(int, int)> &task) noexcept {
+        const uint32_t MIN_ROWS_PER_BAND{64};
+        const uint32_t LARGE_FRAME{1280*720};
+        uint32_t bands{1};
+        if ( (nullptr != m_threadPool) && (m_cropWidth * height >= LARGE_FRAME) ) {
+            bands = std::max(1u, std::min(m_threadPool->size() + 1, height / MIN_ROWS_PER_BAND));
+        }
+        // Bands must start at even rows to keep 4:2:0 chroma rows aligned.
+        const uint32_t ROWS_PER_BAND{(((height + bands - 1) / bands) + 1) & ~1u};
+        auto runBand = [&](uint32_t b) {
+            const uint32_t Y0{b * ROWS_PER_BAND};
+            const uint32_t Y1{std::min(height, Y0 + ROWS_PER_BAND)};
+            if (Y0 < Y1) {
+                task(static_cast<int>(Y0), static_cast<int>(Y1 - Y0));
+            }
+        };
+        if (1 < bands) {
+            m_threadPool->parallelFor(bands, runBand);
+        }
+        else {
+            runBand(0);
+        }
+    }
+
+    static void convert(const View &s, const View &d) noexcept {
+        const int W{s.width};
+        const int H{s.height};
+        if (FOURCC_I420 == d.fourcc) {
+            switch (s.fourcc) {
+                case FOURCC_NV12: libyuv::NV12ToI420(s.plane[0], s.stride[0], s.plane[1], s.stride[1], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], W, H); break;
+                case FOURCC_YUYV: libyuv::YUY2ToI420(s.plane[0], s.stride[0], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], W, H); break;
+                case FOURCC_BGR:  libyuv::RGB24ToI420(s.plane[0], s.stride[0], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], W, H); break;
+                case FOURCC_RGB:  libyuv::RAWToI420(s.plane[0], s.stride[0], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], W, H); break;
+                default: libyuv::I420Copy(s.plane[0], s.stride[0], s.plane[1], s.stride[1], s.plane[2], s.stride[2], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], W, H); break;
+            }
+        }
+        else if (FOURCC_NV12 == d.fourcc) {
+            switch (s.fourcc) {
+                case FOURCC_YUYV: libyuv::YUY2ToNV12(s.plane[0], s.stride[0], d.plane[0], d.stride[0], d.plane[1], d.stride[1], W, H); break;
+                default: libyuv::I420ToNV12(s.plane[0], s.stride[0], s.plane[1], s.stride[1], s.plane[2], s.stride[2], d.plane[0], d.stride[0], d.plane[1], d.stride[1], W, H); break;
+            }
+        }
+    }
+
+    static void mirror(const View &s, const View &d) noexcept {
+        libyuv::I420Mirror(s.plane[0], s.stride[0], s.plane[1], s.stride[1], s.plane[2], s.stride[2], d.plane[0], d.stride[0], d.plane[1], d.stride[1], d.plane[2], d.stride[2], s.width, s.height);
+    }
+
+   private:
+    uint32_t m_sourceFourcc{0};
+    uint32_t m_sourceWidth{0};
+    uint32_t m_sourceHeight{0};
+    uint32_t m_targetFourcc{0};
+    uint32_t m_cropX{0};
+    uint32_t m_cropY{0};
+    uint32_t m_cropWidth{0};
+    uint32_t m_cropHeight{0};
+    bool m_flipHorizontal{false};
+    bool m_flipVertical{false};
+    bool m_scales{false};
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    ThreadPool *m_threadPool{nullptr};
+    std::unique_ptr<FramePool> m_framePool{nullptr};
+    std::unique_ptr<FramePool> m_scratchPool{nullptr};
+};
+
+#endif
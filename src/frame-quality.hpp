@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_QUALITY_HPP
+#define FRAME_QUALITY_HPP
+
+#include "frame.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cstdint>
+
+/**
+ * @return SSIM of two 8x8 blocks; the integer arithmetic follows libyuv's
+ *         Ssim8x8_C so that results are comparable with its tools.
+ */
+inline double ssim8x8(const uint8_t *a, uint32_t strideA, const uint8_t *b, uint32_t strideB) noexcept {
+    int64_t sumA{0};
+    int64_t sumB{0};
+    int64_t sumSquaresA{0};
+    int64_t sumSquaresB{0};
+    int64_t sumAB{0};
+#if defined(__SSE2__) && defined(__x86_64__)
+    const __m128i ZERO = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    __m128i squaresA = _mm_setzero_si128();
+    __m128i squaresB = _mm_setzero_si128();
+    __m128i products = _mm_setzero_si128();
+    for (uint32_t y{0}; y < 8; y++) {
+        const __m128i A8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * strideA));
+        const __m128i B8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * strideB));
+        // Sum of A in the lower and of B in the upper 64 bits.
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_unpacklo_epi64(A8, B8), ZERO));
+        const __m128i A = _mm_unpacklo_epi8(A8, ZERO);
+        const __m128i B = _mm_unpacklo_epi8(B8, ZERO);
+        squaresA = _mm_add_epi32(squaresA, _mm_madd_epi16(A, A));
+        squaresB = _mm_add_epi32(squaresB, _mm_madd_epi16(B, B));
+        products = _mm_add_epi32(products, _mm_madd_epi16(A, B));
+    }
+    auto horizontalSum = [](__m128i v) {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<int64_t>(_mm_cvtsi128_si32(v));
+    };
+    sumA = _mm_cvtsi128_si64(sums);
+    sumB = _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+    sumSquaresA = horizontalSum(squaresA);
+    sumSquaresB = horizontalSum(squaresB);
+    sumAB = horizontalSum(products);
+#else
+    for (uint32_t y{0}; y < 8; y++) {
+        for (uint32_t x{0}; x < 8; x++) {
+            const int64_t A{a[y * strideA + x]};
+            const int64_t B{b[y * strideB + x]};
+            sumA += A;
+            sumB += B;
+            sumSquaresA += A * A;
+            sumSquaresB += B * B;
+            sumAB += A * B;
+        }
+    }
+#endif
+    // (0.01 * 255)^2 and (0.03 * 255)^2, scaled by 64^2 and by the number of samples.
+    const int64_t COUNT{64};
+    const int64_t C1{(26634 * COUNT * COUNT) >> 12};
+    const int64_t C2{(239708 * COUNT * COUNT) >> 12};
+    const int64_t SUM_A_X_SUM_B{sumA * sumB};
+    const int64_t SUM_A_SQUARED{sumA * sumA};
+    const int64_t SUM_B_SQUARED{sumB * sumB};
+    const int64_t N{(2 * SUM_A_X_SUM_B + C1) * (2 * COUNT * sumAB - 2 * SUM_A_X_SUM_B + C2)};
+    const int64_t D{(SUM_A_SQUARED + SUM_B_SQUARED + C1) * (COUNT * sumSquaresA - SUM_A_SQUARED + COUNT * sumSquaresB - SUM_B_SQUARED + C2)};
+    return static_cast<double>(N) / static_cast<double>(D);
+}
+
+/**
+ * @return Mean SSIM of two planes over 8x8 blocks at every fourth row and
+ *         column, as libyuv's CalcFrameSsim; 1 for planes smaller than a block.
+ */
+inline double planeSsim(const uint8_t *a, uint32_t strideA, const uint8_t *b, uint32_t strideB, uint32_t width, uint32_t height) noexcept {
+    double sum{0};
+    uint64_t blocks{0};
+    for (uint32_t y{0}; y + 8 < height; y += 4) {
+        for (uint32_t x{0}; x + 8 < width; x += 4) {
+            sum += ssim8x8(a + y * strideA + x, strideA, b + y * strideB + x, strideB);
+            blocks++;
+        }
+    }
+    return (0 < blocks) ? sum / static_cast<double>(blocks) : 1.0;
+}
+
+/**
+ * @return SSIM of two I420 frames of the same size, weighted 0.8 Y, 0.1 U, and 0.1 V as libyuv's I420Ssim.
+ */
+inline double i420Ssim(const Frame &a, const Frame &b) noexcept {
+    double ssim{0};
+    for (uint32_t i{0}; i < 3; i++) {
+        const uint32_t W{(0 == i) ? a.width : (a.width + 1) / 2};
+        const uint32_t H{(0 == i) ? a.height : (a.height + 1) / 2};
+        ssim += ((0 == i) ? 0.8 : 0.1) * planeSsim(a.plane(i), a.pitch[i], b.plane(i), b.pitch[i], W, H);
+    }
+    return ssim;
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * FrameRing is a layout for a shared memory area that holds several frames
+ * so that the producer writes one slot while the recorder reads another one
+ * without copying and without sharing a lock:
+ *
+ *   offset 0:   RingHeader (64 bytes)
+ *   offset 64:  slotCount RingSlot descriptors (64 bytes each)
+ *   slotOffset: slotCount frames of slotSize bytes each (64-byte aligned)
+ *
+ * The producer creates the area with sizeOf(), calls initialize() once, and
+ * then for each frame beginWrite(), writes the frame, and calls endWrite()
+ * before cluon::SharedMemory::notifyAll(); it never writes into the slot
+ * with the newest frame or into a slot that a consumer reads. A consumer
+ * calls acquire() for the newest frame and release() when done with it.
+ *
+ * A producer that does not initialize the header keeps the single-frame
+ * layout, which valid() tells apart by the magic value, the version, and a
+ * geometry that matches the size of the area.
+ */
+class FrameRing {
+   private:
+    FrameRing(const FrameRing &) = delete;
+    FrameRing(FrameRing &&)      = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+    FrameRing &operator=(FrameRing &&) = delete;
+
+    enum SlotState : uint32_t {
+        FREE    = 0,
+        WRITING = 1,
+        READY   = 2,
+        READING = 3,
+    };
+
+    struct RingHeader {
+        // "FRMRING1"
+        char magic[8];
+        uint32_t version;
+        uint32_t slotCount;
+        uint32_t slotSize;
+        uint32_t slotOffset;
+        // Sequence number of the newest frame and index of the slot holding it.
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint32_t> latest;
+        uint8_t reserved[28];
+    };
+    static_assert(sizeof(RingHeader) == 64, "RingHeader needs to have the same layout for all producers.");
+
+    struct RingSlot {
+        std::atomic<uint32_t> state;
+        uint32_t size;
+        uint64_t sequence;
+        // Sample time stamp in microseconds.
+        int64_t timeStamp;
+        uint8_t reserved[40];
+    };
+    static_assert(sizeof(RingSlot) == 64, "RingSlot needs to have the same layout for all producers.");
+
+    static const uint32_t VERSION{1};
+    static const uint32_t ALIGNMENT{64};
+    static const uint32_t MAX_SLOTS{16};
+
+   public:
+    /**
+     * @return Size of an area for slotCount frames of frameSize bytes.
+     */
+    static uint32_t sizeOf(uint32_t frameSize, uint32_t slotCount) noexcept {
+        return slotOffset(slotCount) + slotCount * alignedSize(frameSize);
+    }
+
+    /**
+     * Constructor.
+     *
+     * @param data Beginning of the shared memory area.
+     * @param size Size of the shared memory area.
+     */
+    FrameRing(char *data, uint32_t size) noexcept
+        : m_data(reinterpret_cast<uint8_t*>(data))
+        , m_size(size) {}
+
+    /**
+     * This method lays out the area for slotCount frames of frameSize bytes;
+     * it is called by the producer before the first frame.
+     *
+     * @return true if the area is large enough.
+     */
+    bool initialize(uint32_t frameSize, uint32_t slotCount) noexcept {
+        if ( (nullptr == m_data) || (slotCount < 2) || (slotCount > MAX_SLOTS) || (sizeOf(frameSize, slotCount) > m_size) ) {
+            return false;
+        }
+        RingHeader *h{header()};
+        std::memset(m_data, 0, slotOffset(slotCount));
+        h->version = VERSION;
+        h->slotCount = slotCount;
+        h->slotSize = alignedSize(frameSize);
+        h->slotOffset = slotOffset(slotCount);
+        // The magic value is written last as it marks the header as complete.
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(h->magic, magic(), sizeof(h->magic));
+        return true;
+    }
+
+    /**
+     * @return true if the area holds a ring for frames of at least frameSize bytes.
+     */
+    bool valid(uint32_t frameSize) const noexcept {
+        if ( (nullptr == m_data) || (m_size < sizeof(RingHeader)) ) {
+            return false;
+        }
+        const RingHeader *h{header()};
+        if (0 != std::memcmp(h->magic, magic(), sizeof(h->magic))) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (VERSION == h->version) &&
+               (2 <= h->slotCount) && (h->slotCount <= MAX_SLOTS) &&
+               (frameSize <= h->slotSize) && (0 == (h->slotSize % ALIGNMENT)) &&
+               (slotOffset(h->slotCount) == h->slotOffset) &&
+               (static_cast<uint64_t>(h->slotOffset) + static_cast<uint64_t>(h->slotCount) * h->slotSize <= m_size);
+    }
+
+    uint32_t slotCount() const noexcept {
+        return header()->slotCount;
+    }
+
+    /**
+     * @return Sequence number of the newest frame; 0 before the first one.
+     */
+    uint64_t sequence() const noexcept {
+        return header()->sequence.load(std::memory_order_acquire);
+    }
+
+    /**
+     * This method reserves a slot for the next frame (producer).
+     *
+     * @return Slot index or -1 if all slots are in use.
+     */
+    int32_t beginWrite() noexcept {
+        RingHeader *h{header()};
+        const uint32_t LATEST{h->latest.load(std::memory_order_acquire)};
+        for (uint32_t i{1}; i <= h->slotCount; i++) {
+            const uint32_t INDEX{(LATEST + i) % h->slotCount};
+            if ( (INDEX == LATEST) && (0 < sequence()) ) {
+                continue;
+            }
+            for (uint32_t expected : {static_cast<uint32_t>(FREE), static_cast<uint32_t>(READY)}) {
+                if (slot(INDEX)->state.compare_exchange_strong(expected, WRITING, std::memory_order_acq_rel)) {
+                    return static_cast<int32_t>(INDEX);
+                }
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * This method publishes the frame written into the given slot (producer).
+     */
+    void endWrite(int32_t index, uint32_t size, int64_t timeStamp) noexcept {
+        RingHeader *h{header()};
+        RingSlot *s{slot(static_cast<uint32_t>(index))};
+        s->size = size;
+        s->timeStamp = timeStamp;
+        s->sequence = h->sequence.load(std::memory_order_relaxed) + 1;
+        s->state.store(READY, std::memory_order_release);
+        h->latest.store(static_cast<uint32_t>(index), std::memory_order_release);
+        h->sequence.store(s->sequence, std::memory_order_release);
+    }
+
+    /**
+     * This method reserves the slot with the newest frame (consumer); the
+     * producer does not write into it until release() is called.
+     *
+     * @return Slot index or -1 if there is no frame.
+     */
+    int32_t acquire() noexcept {
+        const uint32_t ATTEMPTS{64};
+        RingHeader *h{header()};
+        for (uint32_t attempt{0}; (attempt < ATTEMPTS) && (0 < sequence()); attempt++) {
+            const uint32_t INDEX{h->latest.load(std::memory_order_acquire)};
+            uint32_t expected{READY};
+            // Fails if the producer reuses the slot after having published a newer frame elsewhere; try again then.
+            if ( (INDEX < h->slotCount) && slot(INDEX)->state.compare_exchange_strong(expected, READING, std::memory_order_acq_rel) ) {
+                return static_cast<int32_t>(INDEX);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * This method returns a slot reserved by acquire() (consumer); its frame
+     * can be acquired again as long as it is the newest one.
+     */
+    void release(int32_t index) noexcept {
+        slot(static_cast<uint32_t>(index))->state.store(READY, std::memory_order_release);
+    }
+
+    uint8_t *data(int32_t index) noexcept {
+        return m_data + header()->slotOffset + static_cast<uint32_t>(index) * header()->slotSize;
+    }
+
+    uint64_t sequence(int32_t index) const noexcept {
+        return slot(static_cast<uint32_t>(index))->sequence;
+    }
+
+    int64_t timeStamp(int32_t index) const noexcept {
+        return slot(static_cast<uint32_t>(index))->timeStamp;
+    }
+
+   private:
+    static const char *magic() noexcept {
+        return "FRMRING1";
+    }
+
+    static uint32_t alignedSize(uint32_t size) noexcept {
+        return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    static uint32_t slotOffset(uint32_t slotCount) noexcept {
+        return static_cast<uint32_t>(sizeof(RingHeader) + slotCount * sizeof(RingSlot));
+    }
+
+    RingHeader *header() const noexcept {
+        return reinterpret_cast<RingHeader*>(m_data);
+    }
+
+    RingSlot *slot(uint32_t index) const noexcept {
+        return reinterpret_cast<RingSlot*>(m_data + sizeof(RingHeader)) + index;
+    }
+
+   private:
+    uint8_t *m_data{nullptr};
+    uint32_t m_size{0};
+};
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_STATISTICS_HPP
+#define FRAME_STATISTICS_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * @return Name of the sidecar file with per-frame statistics that belongs to the given .rec file.
+ */
+inline std::string recStatsName(const std::string &nameOfRecFile) noexcept {
+    return nameOfRecFile + ".stats";
+}
+
+/**
+ * @return base_q_idx (0..255) from the uncompressed header of a VP9 frame,
+ *         i.e., the quantizer of all blocks without a segment delta, or -1 if
+ *         the frame only shows an earlier one or cannot be parsed.
+ */
+inline int32_t vp9BaseQIndex(const uint8_t *data, uint32_t size) noexcept {
+    uint64_t position{0};
+    auto bits = [data, size, &position](uint32_t n) {
+        uint32_t v{0};
+        for (uint32_t i{0}; i < n; i++, position++) {
+            const uint32_t BYTE{static_cast<uint32_t>(position / 8)};
+            const uint32_t BIT{(BYTE < size) ? (data[BYTE] >> (7 - position % 8)) & 0x1u : 0u};
+            v = (v << 1) | BIT;
+        }
+        return v;
+    };
+    auto colorConfig = [&bits](uint32_t profile) {
+        if (2 <= profile) {
+            bits(1); // ten_or_twelve_bit
+        }
+        const uint32_t CS_RGB{7};
+        if (CS_RGB != bits(3)) {
+            bits(1); // color_range
+            if ( (1 == profile) || (3 == profile) ) {
+                bits(3); // subsampling_x, subsampling_y, reserved_zero
+            }
+        }
+        else if ( (1 == profile) || (3 == profile) ) {
+            bits(1); // reserved_zero
+        }
+    };
+    auto renderSize = [&bits]() {
+        if (1 == bits(1)) {
+            bits(32);
+        }
+    };
+    const uint32_t SYNC_CODE{0x498342};
+
+    if ( (nullptr == data) || (0 == size) || (2 != bits(2)) ) {
+        return -1;
+    }
+    const uint32_t LOW{bits(1)};
+    const uint32_t PROFILE{(bits(1) << 1) | LOW};
+    if (3 == PROFILE) {
+        bits(1);
+    }
+    if (1 == bits(1)) { // show_existing_frame
+        return -1;
+    }
+    const bool KEY_FRAME{0 == bits(1)};
+    const bool SHOW_FRAME{1 == bits(1)};
+    const bool ERROR_RESILIENT{1 == bits(1)};
+    if (KEY_FRAME) {
+        if (SYNC_CODE != bits(24)) {
+            return -1;
+        }
+        colorConfig(PROFILE);
+        bits(32); // frame_size
+        renderSize();
+    }
+    else {
+        const bool INTRA_ONLY{SHOW_FRAME ? false : (1 == bits(1))};
+        if (!ERROR_RESILIENT) {
+            bits(2); // reset_frame_context
+        }
+        if (INTRA_ONLY) {
+            if (SYNC_CODE != bits(24)) {
+                return -1;
+            }
+            if (0 < PROFILE) {
+                colorConfig(PROFILE);
+            }
+            bits(8); // refresh_frame_flags
+            bits(32); // frame_size
+            renderSize();
+        }
+        else {
+            bits(8); // refresh_frame_flags
+            bits(3 * 4); // ref_frame_idx and ref_frame_sign_bias
+            bool foundRef{false};
+            for (uint32_t i{0}; (i < 3) && !foundRef; i++) {
+                foundRef = (1 == bits(1));
+            }
+            if (!foundRef) {
+                bits(32); // frame_size
+            }
+            renderSize();
+            bits(1); // allow_high_precision_mv
+            if (0 == bits(1)) { // is_filter_switchable
+                bits(2);
+            }
+        }
+    }
+    if (!ERROR_RESILIENT) {
+        bits(2); // refresh_frame_context, frame_parallel_decoding_mode
+    }
+    bits(2); // frame_context_idx
+
+    // loop_filter_params
+    bits(6 + 3);
+    if (1 == bits(1)) { // loop_filter_delta_enabled
+        if (1 == bits(1)) { // loop_filter_delta_update
+            for (uint32_t i{0}; i < 4 + 2; i++) {
+                if (1 == bits(1)) {
+                    bits(7);
+                }
+            }
+        }
+    }
+    const uint32_t BASE_Q_IDX{bits(8)};
+    return (position <= 8ull * size) ? static_cast<int32_t>(BASE_Q_IDX) : -1;
+}
+
+/**
+ * Statistics of one frame as stored in a .stats file.
+ */
+struct FrameStatistics {
+    enum Type : uint8_t {
+        KEY    = 0,
+        INTER  = 1,
+        REPEAT = 2, // Skipped as it repeats the previous frame; not encoded.
+    };
+
+    int64_t timeStamp; // Sample time stamp in microseconds.
+    uint32_t senderStamp;
+    uint32_t size; // Bytes of the encoded frame.
+    uint32_t encodingDuration; // Microseconds spent in the encoder.
+    uint32_t queueDelay; // Microseconds from the sample time stamp until the encoder started.
+    int16_t qIndex; // VP9 base_q_idx (0..255); -1 if unknown.
+    uint8_t type;
+    uint8_t reserved[5];
+};
+static_assert(sizeof(FrameStatistics) == 32, "FrameStatistics needs to have the same layout for all readers.");
+
+/**
+ * FrameStatisticsFile appends FrameStatistics to a memory-mapped file so that
+ * recording them costs a copy of 32 bytes per frame and no system call; the
+ * file grows in steps of 1 MiB and is truncated to its content when closed.
+ *
+ * The file starts with a Header of 32 bytes followed by the records, all in
+ * the byte order of the host. Header::count is updated after each record so
+ * that tools can map the file and follow the statistics during a recording.
+ */
+class FrameStatisticsFile {
+   private:
+    FrameStatisticsFile(const FrameStatisticsFile &) = delete;
+    FrameStatisticsFile(FrameStatisticsFile &&)      = delete;
+    FrameStatisticsFile &operator=(const FrameStatisticsFile &) = delete;
+    FrameStatisticsFile &operator=(FrameStatisticsFile &&) = delete;
+
+    static const uint32_t VERSION{1};
+    static const uint64_t GROWTH{1024 * 1024};
+
+   public:
+    struct Header {
+        // "RECSTAT1"
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        std::atomic<uint64_t> count;
+        uint8_t reserved[8];
+    };
+    static_assert(sizeof(Header) == 32, "Header needs to have the same layout for all readers.");
+
+    explicit FrameStatisticsFile(const std::string &name) noexcept {
+        m_fd = ::open(name.c_str(), O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if ( (-1 != m_fd) && grow() ) {
+            Header *h{header()};
+            h->version = VERSION;
+            h->recordSize = sizeof(FrameStatistics);
+            h->count.store(0, std::memory_order_relaxed);
+            std::memcpy(h->magic, "RECSTAT1", sizeof(h->magic));
+        }
+    }
+
+    ~FrameStatisticsFile() {
+        if (nullptr != m_data) {
+            const uint64_t COUNT{header()->count.load(std::memory_order_relaxed)};
+            ::munmap(m_data, m_size);
+            (void)::ftruncate(m_fd, static_cast<off_t>(sizeof(Header) + COUNT * sizeof(FrameStatistics)));
+        }
+        if (-1 != m_fd) {
+            ::close(m_fd);
+        }
+    }
+
+    /**
+     * @return true if the file is open and mapped.
+     */
+    bool good() const noexcept {
+        return nullptr != m_data;
+    }
+
+    /**
+     * This method appends a record.
+     *
+     * @return false if the file could not be extended.
+     */
+    bool append(const FrameStatistics &record) noexcept {
+        if (!good()) {
+            return false;
+        }
+        Header *h{header()};
+        const uint64_t COUNT{h->count.load(std::memory_order_relaxed)};
+        const uint64_t END{sizeof(Header) + (COUNT + 1) * sizeof(FrameStatistics)};
+        if ( (END > m_size) && !grow() ) {
+            return false;
+        }
+        h = header();
+        std::memcpy(m_data + sizeof(Header) + COUNT * sizeof(FrameStatistics), &record, sizeof(FrameStatistics));
+        h->count.store(COUNT + 1, std::memory_order_release);
+        return true;
+    }
+
+   private:
+    Header *header() const noexcept {
+        return reinterpret_cast<Header*>(m_data);
+    }
+
+    bool grow() noexcept {
+        const uint64_t SIZE{m_size + GROWTH};
+        if (0 != ::ftruncate(m_fd, static_cast<off_t>(SIZE))) {
+            return false;
+        }
+        void *p{(nullptr == m_data) ? ::mmap(nullptr, SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, m_fd, 0)
+                                    : ::mremap(m_data, m_size, SIZE, MREMAP_MAYMOVE)};
+        if (MAP_FAILED == p) {
+            return false;
+        }
+        m_data = static_cast<uint8_t*>(p);
+        m_size = SIZE;
+        return true;
+    }
+
+   private:
+    int m_fd{-1};
+    uint8_t *m_data{nullptr};
+    uint64_t m_size{0};
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @return FOURCC code with the same byte order as libyami's YAMI_FOURCC.
+ */
+constexpr uint32_t makeFourcc(char c0, char c1, char c2, char c3) noexcept {
+    return static_cast<uint32_t>(static_cast<uint8_t>(c0)) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c1)) << 8) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c2)) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c3)) << 24);
+}
+
+constexpr uint32_t FOURCC_I420{makeFourcc('I', '4', '2', '0')};
+constexpr uint32_t FOURCC_NV12{makeFourcc('N', 'V', '1', '2')};
+constexpr uint32_t FOURCC_YUYV{makeFourcc('Y', 'U', 'Y', 'V')};
+// Packed 24 bit pixels in memory order B, G, R and R, G, B, respectively.
+constexpr uint32_t FOURCC_BGR{makeFourcc('B', 'G', 'R', '3')};
+constexpr uint32_t FOURCC_RGB{makeFourcc('R', 'G', 'B', '3')};
+
+/**
+ * @return FOURCC code for the value of --format or 0 if unknown.
+ */
+inline uint32_t fourccFromFormat(const std::string &format) noexcept {
+    uint32_t fourcc{0};
+    if ( format.empty() || ("i420" == format) ) {
+        fourcc = FOURCC_I420;
+    }
+    else if ("nv12" == format) {
+        fourcc = FOURCC_NV12;
+    }
+    else if ("yuyv" == format) {
+        fourcc = FOURCC_YUYV;
+    }
+    else if ("bgr" == format) {
+        fourcc = FOURCC_BGR;
+    }
+    else if ("rgb" == format) {
+        fourcc = FOURCC_RGB;
+    }
+    return fourcc;
+}
+
+/**
+ * @return Number of bytes of a tightly packed image in the given format.
+ */
+inline uint32_t frameSize(uint32_t fourcc, uint32_t width, uint32_t height) noexcept {
+    uint32_t size{0};
+    if ( (FOURCC_I420 == fourcc) || (FOURCC_NV12 == fourcc) ) {
+        size = width * height * 3/2;
+    }
+    else if (FOURCC_YUYV == fourcc) {
+        size = width * height * 2;
+    }
+    else if ( (FOURCC_BGR == fourcc) || (FOURCC_RGB == fourcc) ) {
+        size = width * height * 3;
+    }
+    return size;
+}
+
+/**
+ * Frame describes an uncompressed image at data; like libyami's
+ * VideoFrameRawData, planes are given as offset and pitch relative to data.
+ * If the image resides in a buffer from a FramePool, buffer keeps it alive.
+ * If it resides in an imported DMA-BUF, dmaBuf refers to that buffer and
+ * data to its mapping, which might be nullptr if it cannot be mapped.
+ */
+struct Frame {
+    uint32_t fourcc{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint8_t *data{nullptr};
+    uint32_t size{0};
+    uint32_t pitch[3]{0, 0, 0};
+    uint32_t offset[3]{0, 0, 0};
+    int64_t timeStamp{0}; // Sample time stamp in microseconds.
+    std::shared_ptr<uint8_t> buffer{nullptr};
+    int32_t dmaBuf{-1}; // File descriptor; owned by the FrameImport.
+
+    uint8_t *plane(uint32_t i) const noexcept {
+        return data + offset[i];
+    }
+};
+
+/**
+ * @return Frame describing a tightly packed image in the given format at data.
+ */
+inline Frame describeFrame(uint32_t fourcc, uint32_t width, uint32_t height, uint8_t *data) noexcept {
+    Frame f;
+    f.fourcc = fourcc;
+    f.width = width;
+    f.height = height;
+    f.data = data;
+    f.size = frameSize(fourcc, width, height);
+    if (FOURCC_I420 == fourcc) {
+        f.pitch[0] = width;
+        f.pitch[1] = width/2;
+        f.pitch[2] = width/2;
+        f.offset[1] = width * height;
+        f.offset[2] = f.offset[1] + (width * height)/4;
+    }
+    else if (FOURCC_NV12 == fourcc) {
+        f.pitch[0] = width;
+        f.pitch[1] = width;
+        f.offset[1] = width * height;
+    }
+    else if (FOURCC_YUYV == fourcc) {
+        f.pitch[0] = width * 2;
+    }
+    else if ( (FOURCC_BGR == fourcc) || (FOURCC_RGB == fourcc) ) {
+        f.pitch[0] = width * 3;
+    }
+    return f;
+}
+
+#endif
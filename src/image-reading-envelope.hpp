@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_READING_ENVELOPE_HPP
+#define IMAGE_READING_ENVELOPE_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <string>
+
+/**
+ * ImageReadingEnvelope is a serialized Envelope (including the OD4 header)
+ * carrying an opendlv.proxy.ImageReading whose image data is referenced
+ * rather than copied; it is written as head, data, tail via writev.
+ *
+ * As Protobuf fields may appear in any order, the fields holding the data,
+ * i.e., Envelope.serializedData (2) and ImageReading.data (4), are encoded
+ * first, followed by the regularly serialized remaining fields from which the
+ * empty copies of these two fields are removed.
+ */
+class ImageReadingEnvelope {
+   private:
+    ImageReadingEnvelope(const ImageReadingEnvelope &) = delete;
+    ImageReadingEnvelope(ImageReadingEnvelope &&)      = delete;
+    ImageReadingEnvelope &operator=(const ImageReadingEnvelope &) = delete;
+    ImageReadingEnvelope &operator=(ImageReadingEnvelope &&) = delete;
+
+   public:
+    ImageReadingEnvelope(const std::string &fourcc, uint32_t width, uint32_t height, const uint8_t *data, uint32_t size,
+                         const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept
+        : m_data(data)
+        , m_size(size) {
+        opendlv::proxy::ImageReading ir;
+        ir.fourcc(fourcc).width(width).height(height);
+        cluon::ToProtoVisitor irEncoder;
+        ir.accept(irEncoder);
+        std::string imageReading{irEncoder.encodedData()};
+        removeEmptyField(imageReading, 4);
+
+        std::string dataField;
+        appendVarInt(dataField, (4 << 3) | LENGTH_DELIMITED);
+        appendVarInt(dataField, size);
+
+        cluon::data::Envelope envelope;
+        envelope.dataType(ir.ID()).sent(cluon::time::now()).sampleTimeStamp(sampleTimeStamp).senderStamp(senderStamp);
+        cluon::ToProtoVisitor envelopeEncoder;
+        envelope.accept(envelopeEncoder);
+        std::string envelopeFields{envelopeEncoder.encodedData()};
+        removeEmptyField(envelopeFields, 2);
+        m_tail = imageReading + envelopeFields;
+
+        std::string serializedDataField;
+        appendVarInt(serializedDataField, (2 << 3) | LENGTH_DELIMITED);
+        appendVarInt(serializedDataField, dataField.size() + size + imageReading.size());
+
+        // OD4 header: 0x0D 0xA4 followed by the length as 24 bit little endian.
+        const uint64_t LENGTH{serializedDataField.size() + dataField.size() + size + m_tail.size()};
+        m_valid = (LENGTH < (1u << 24));
+        m_head.push_back(static_cast<char>(0x0D));
+        m_head.push_back(static_cast<char>(0xA4));
+        m_head.push_back(static_cast<char>(LENGTH & 0xFF));
+        m_head.push_back(static_cast<char>((LENGTH >> 8) & 0xFF));
+        m_head.push_back(static_cast<char>((LENGTH >> 16) & 0xFF));
+        m_head += serializedDataField + dataField;
+    }
+
+    /**
+     * @return false if the envelope exceeds the maximum size of an OD4 container (16 MiB).
+     */
+    bool valid() const noexcept {
+        return m_valid;
+    }
+
+    /**
+     * @return Number of bytes of the serialized envelope.
+     */
+    std::size_t size() const noexcept {
+        return m_head.size() + m_size + m_tail.size();
+    }
+
+    /**
+     * This method fills iov[0..2] with the parts of the serialized envelope.
+     */
+    void toIovec(struct iovec iov[3]) const noexcept {
+        iov[0].iov_base = const_cast<char*>(m_head.data());
+        iov[0].iov_len = m_head.size();
+        iov[1].iov_base = const_cast<uint8_t*>(m_data);
+        iov[1].iov_len = m_size;
+        iov[2].iov_base = const_cast<char*>(m_tail.data());
+        iov[2].iov_len = m_tail.size();
+    }
+
+    /**
+     * This method copies the serialized envelope into out, reusing its capacity.
+     */
+    void serialize(std::string &out) const noexcept {
+        out.reserve(size());
+        out.assign(m_head);
+        out.append(reinterpret_cast<const char*>(m_data), m_size);
+        out.append(m_tail);
+    }
+
+   private:
+    static bool readVarInt(const std::string &s, std::size_t &pos, uint64_t &v) noexcept {
+        v = 0;
+        for (uint32_t shift{0}; (pos < s.size()) && (shift < 64); shift += 7) {
+            const uint8_t BYTE{static_cast<uint8_t>(s[pos++])};
+            v |= static_cast<uint64_t>(BYTE & 0x7F) << shift;
+            if (0 == (BYTE & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Removes the first length-delimited field with the given id if it is empty.
+    static void removeEmptyField(std::string &proto, uint32_t fieldId) noexcept {
+        std::size_t pos{0};
+        uint64_t key{0};
+        uint64_t value{0};
+        while (pos < proto.size()) {
+            const std::size_t START{pos};
+            if (!readVarInt(proto, pos, key)) {
+                return;
+            }
+            switch (key & 0x7) {
+                case 0: { if (!readVarInt(proto, pos, value)) { return; } break; }
+                case 1: { pos += 8; break; }
+                case 5: { pos += 4; break; }
+                case LENGTH_DELIMITED: {
+                    if (!readVarInt(proto, pos, value)) {
+                        return;
+                    }
+                    if ( ((key >> 3) == fieldId) && (0 == value) ) {
+                        proto.erase(START, pos - START);
+                        return;
+                    }
+                    pos += value;
+                    break;
+                }
+                default: return;
+            }
+        }
+    }
+
+    static void appendVarInt(std::string &s, uint64_t v) noexcept {
+        do {
+            const uint8_t BYTE{static_cast<uint8_t>(v & 0x7F)};
+            v >>= 7;
+            s.push_back(static_cast<char>(BYTE | ((0 != v) ? 0x80 : 0x00)));
+        } while (0 != v);
+    }
+
+   private:
+    static const uint8_t LENGTH_DELIMITED{2};
+
+    const uint8_t *m_data{nullptr};
+    uint32_t m_size{0};
+    bool m_valid{false};
+    std::string m_head{};
+    std::string m_tail{};
+};
+
+#endif
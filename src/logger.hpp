@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+enum class LogLevel : uint8_t {
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+/**
+ * @return LogLevel for debug, info, warning, or error; Info otherwise.
+ */
+inline LogLevel parseLogLevel(const std::string &level) noexcept {
+    return ("debug" == level) ? LogLevel::Debug : (("warning" == level) ? LogLevel::Warning : (("error" == level) ? LogLevel::Error : LogLevel::Info));
+}
+
+/**
+ * Logger writes messages of the form "[video-qsv-vp9-recorder]: ..." from a
+ * background thread. The calling thread only copies the format string's
+ * address and the arguments into a preallocated slot of a bounded queue;
+ * converting them to text and writing to std::clog (or std::cerr for warnings
+ * and errors) happens on the background thread. When the queue is full,
+ * messages are dropped and counted instead of blocking the caller.
+ *
+ * Messages are rate limited per format string, i.e., per call site; the next
+ * message that passes reports how many similar messages were suppressed.
+ */
+class Logger {
+   private:
+    Logger(const Logger &) = delete;
+    Logger(Logger &&)      = delete;
+    Logger &operator=(const Logger &) = delete;
+    Logger &operator=(Logger &&) = delete;
+
+    static const uint32_t MAX_ARGUMENTS{8};
+    static const uint32_t CAPACITY{1024};
+
+    struct Argument {
+        enum class Type : uint8_t { Signed, Unsigned, Floating, Text };
+        Type type{Type::Signed};
+        int64_t i{0};
+        uint64_t u{0};
+        double d{0};
+        std::string text{};
+    };
+
+    struct Record {
+        LogLevel level{LogLevel::Info};
+        // Must point to a string literal as it is read later from the background thread.
+        const char *format{nullptr};
+        uint32_t count{0};
+        uint64_t suppressed{0};
+        Argument arguments[MAX_ARGUMENTS];
+    };
+
+    struct Bucket {
+        double tokens{0};
+        std::chrono::steady_clock::time_point last{};
+        uint64_t suppressed{0};
+    };
+
+   public:
+    static Logger &instance() noexcept {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_running = false;
+        }
+        m_condition.notify_all();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    void level(LogLevel level) noexcept {
+        m_level = level;
+    }
+
+    /**
+     * @param messagesPerSecond Maximum rate of messages per call site; 0 disables rate limiting.
+     */
+    void rateLimit(uint32_t messagesPerSecond) noexcept {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_messagesPerSecond = messagesPerSecond;
+    }
+
+    bool enabled(LogLevel level) const noexcept {
+        return static_cast<uint8_t>(level) >= static_cast<uint8_t>(m_level.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * This method queues a message; each {} in format is replaced by the next
+     * argument. format must be a string literal.
+     */
+    template <typename... Arguments>
+    void log(LogLevel level, const char *format, const Arguments &... arguments) noexcept {
+        static_assert(sizeof...(Arguments) <= MAX_ARGUMENTS, "Too many arguments for Logger::log.");
+        if (!enabled(level)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            uint64_t suppressed{0};
+            if (!admit(format, suppressed)) {
+                return;
+            }
+            if (CAPACITY == m_size) {
+                m_dropped++;
+                return;
+            }
+            Record &r{m_records[(m_first + m_size) % CAPACITY]};
+            r.level = level;
+            r.format = format;
+            r.count = 0;
+            r.suppressed = suppressed;
+            set(r, arguments...);
+            m_size++;
+        }
+        m_condition.notify_one();
+    }
+
+   private:
+    Logger() noexcept
+        : m_records(CAPACITY) {
+        m_thread = std::thread(&Logger::run, this);
+    }
+
+    // Token bucket per call site that allows bursts of one second's worth of messages.
+    bool admit(const char *format, uint64_t &suppressed) noexcept {
+        if (0 == m_messagesPerSecond) {
+            return true;
+        }
+        const auto NOW{std::chrono::steady_clock::now()};
+        auto inserted = m_buckets.emplace(format, Bucket());
+        Bucket &b{inserted.first->second};
+        if (inserted.second) {
+            b.tokens = m_messagesPerSecond;
+            b.last = NOW;
+        }
+        b.tokens += std::chrono::duration<double>(NOW - b.last).count() * m_messagesPerSecond;
+        b.tokens = (b.tokens > m_messagesPerSecond) ? m_messagesPerSecond : b.tokens;
+        b.last = NOW;
+        if (b.tokens < 1.0) {
+            b.suppressed++;
+            return false;
+        }
+        b.tokens -= 1.0;
+        suppressed = b.suppressed;
+        b.suppressed = 0;
+        return true;
+    }
+
+    static void set(Record &) noexcept {}
+
+    template <typename T, typename... Arguments>
+    static void set(Record &r, const T &first, const Arguments &... rest) noexcept {
+        assign(r.arguments[r.count++], first);
+        set(r, rest...);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type assign(Argument &a, const T &v) noexcept {
+        a.type = Argument::Type::Signed;
+        a.i = v;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type assign(Argument &a, const T &v) noexcept {
+        a.type = Argument::Type::Unsigned;
+        a.u = v;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_enum<T>::value>::type assign(Argument &a, const T &v) noexcept {
+        a.type = Argument::Type::Signed;
+        a.i = static_cast<int64_t>(v);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type assign(Argument &a, const T &v) noexcept {
+        a.type = Argument::Type::Floating;
+        a.d = v;
+    }
+
+    static void assign(Argument &a, const std::string &v) noexcept {
+        a.type = Argument::Type::Text;
+        a.text = v;
+    }
+
+    static void assign(Argument &a, const char *v) noexcept {
+        a.type = Argument::Type::Text;
+        a.text = (nullptr != v) ? v : "";
+    }
+
+    static std::string format(const Record &r) noexcept {
+        std::stringstream sstr;
+        sstr << "[video-qsv-vp9-recorder]: ";
+        uint32_t next{0};
+        for (const char *c{r.format}; '\0' != *c; c++) {
+            if ( ('{' == c[0]) && ('}' == c[1]) && (next < r.count) ) {
+                const Argument &a{r.arguments[next++]};
+                switch (a.type) {
+                    case Argument::Type::Signed: sstr << a.i; break;
+                    case Argument::Type::Unsigned: sstr << a.u; break;
+                    case Argument::Type::Floating: sstr << a.d; break;
+                    case Argument::Type::Text: sstr << a.text; break;
+                }
+                c++;
+            }
+            else {
+                sstr << *c;
+            }
+        }
+        if (0 < r.suppressed) {
+            sstr << " (suppressed " << r.suppressed << " similar messages)";
+        }
+        return sstr.str();
+    }
+
+    void run() noexcept {
+        // Signals are left to the threads that handle them.
+        sigset_t signals;
+        sigfillset(&signals);
+        ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        // The record is swapped out of the queue so that formatting does not block log(); the queue keeps the strings' memory.
+        Record record;
+        std::unique_lock<std::mutex> lck(m_mutex);
+        while (true) {
+            m_condition.wait(lck, [this](){ return !m_running || (0 < m_size) || (0 < m_dropped); });
+            if (!m_running && (0 == m_size) && (0 == m_dropped)) {
+                break;
+            }
+            const uint64_t DROPPED{m_dropped};
+            m_dropped = 0;
+            const bool HAS_RECORD{0 < m_size};
+            if (HAS_RECORD) {
+                std::swap(record, m_records[m_first]);
+                m_first = (m_first + 1) % CAPACITY;
+                m_size--;
+            }
+            lck.unlock();
+            if (0 < DROPPED) {
+                std::cerr << "[video-qsv-vp9-recorder]: Dropped " << DROPPED << " log messages." << std::endl;
+            }
+            if (HAS_RECORD) {
+                const bool TO_ERROR_STREAM{(LogLevel::Warning == record.level) || (LogLevel::Error == record.level)};
+                (TO_ERROR_STREAM ? std::cerr : std::clog) << format(record) << std::endl;
+            }
+            lck.lock();
+        }
+    }
+
+   private:
+    std::atomic<LogLevel> m_level{LogLevel::Info};
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::vector<Record> m_records;
+    uint32_t m_first{0};
+    uint32_t m_size{0};
+    uint64_t m_dropped{0};
+    bool m_running{true};
+    uint32_t m_messagesPerSecond{0};
+    std::unordered_map<const char*, Bucket> m_buckets{};
+    std::thread m_thread{};
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OBJECT_REGIONS_HPP
+#define OBJECT_REGIONS_HPP
+
+#include "encoder-backend.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/**
+ * ObjectRegions collects the perceived objects from opendlv.logic.perception
+ * (ObjectDirection and ObjectAngularBlob, matched by objectId) and projects
+ * them into the camera image as regions of interest using a pinhole model
+ * with the given field of view. Azimuth grows to the left and zenith upwards
+ * from the optical axis; all angles are in radians. Objects that are not
+ * updated within the timeout are dropped; updates and queries are compared
+ * by sample time stamps, i.e., in the clock of the camera that the objects
+ * were perceived in, so that delays in delivering them do not matter.
+ *
+ * Updates arrive from the OD4Session's thread while the encoder branches read
+ * the regions; all methods are thread-safe.
+ */
+class ObjectRegions {
+   private:
+    ObjectRegions(const ObjectRegions &) = delete;
+    ObjectRegions(ObjectRegions &&)      = delete;
+    ObjectRegions &operator=(const ObjectRegions &) = delete;
+    ObjectRegions &operator=(ObjectRegions &&) = delete;
+
+   private:
+    struct Object {
+        bool hasDirection{false};
+        bool hasExtent{false};
+        float azimuth{0};
+        float zenith{0};
+        float width{0};
+        float height{0};
+        int64_t lastUpdate{0};
+    };
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param width Width of the camera image.
+     * @param height Height of the camera image.
+     * @param horizontalFieldOfView Horizontal field of view in radians.
+     * @param verticalFieldOfView Vertical field of view in radians; 0 derives it from the aspect ratio.
+     * @param timeout Time in microseconds after which an object is dropped.
+     * @param qpDelta QP delta for the regions.
+     * @param backgroundQpDelta QP delta for everything else.
+     */
+    ObjectRegions(uint32_t width, uint32_t height, float horizontalFieldOfView, float verticalFieldOfView, int64_t timeout, int32_t qpDelta, int32_t backgroundQpDelta) noexcept
+        : m_width(width)
+        , m_height(height)
+        , m_timeout(timeout)
+        , m_qpDelta(qpDelta)
+        , m_backgroundQpDelta(backgroundQpDelta) {
+        const float TAN_H{std::tan(horizontalFieldOfView / 2.0f)};
+        const float TAN_V{(0.0f < verticalFieldOfView) ? std::tan(verticalFieldOfView / 2.0f) : TAN_H * static_cast<float>(height) / static_cast<float>(width)};
+        m_focalLengthX = (static_cast<float>(width) / 2.0f) / TAN_H;
+        m_focalLengthY = (static_cast<float>(height) / 2.0f) / TAN_V;
+    }
+
+    int32_t backgroundQpDelta() const noexcept {
+        return m_backgroundQpDelta;
+    }
+
+    void direction(uint32_t objectId, float azimuth, float zenith, int64_t timeStamp) noexcept {
+        std::lock_guard<std::mutex> lck(m_objectsMutex);
+        Object &o = m_objects[objectId];
+        o.hasDirection = true;
+        o.azimuth = azimuth;
+        o.zenith = zenith;
+        o.lastUpdate = timeStamp;
+    }
+
+    void extent(uint32_t objectId, float width, float height, int64_t timeStamp) noexcept {
+        std::lock_guard<std::mutex> lck(m_objectsMutex);
+        Object &o = m_objects[objectId];
+        o.hasExtent = true;
+        o.width = width;
+        o.height = height;
+        o.lastUpdate = timeStamp;
+    }
+
+    /**
+     * @return Regions in image coordinates of all objects seen within the timeout before now (sample time stamp of the frame).
+     */
+    std::vector<RegionOfInterest> regions(int64_t now) noexcept {
+        std::vector<RegionOfInterest> retVal;
+        std::lock_guard<std::mutex> lck(m_objectsMutex);
+        for (auto it = m_objects.begin(); it != m_objects.end();) {
+            if (now - it->second.lastUpdate > m_timeout) {
+                it = m_objects.erase(it);
+                continue;
+            }
+            const Object &o = it->second;
+            if (o.hasDirection && o.hasExtent) {
+                // Angles beyond +/-89 degrees are not projectable.
+                const float LIMIT{1.553f};
+                auto project = [LIMIT](float angle, float focalLength, uint32_t size) {
+                    const float P{static_cast<float>(size) / 2.0f - focalLength * std::tan(std::min(std::max(angle, -LIMIT), LIMIT))};
+                    return static_cast<int64_t>(std::min(std::max(P, 0.0f), static_cast<float>(size)));
+                };
+                const int64_t X0{project(o.azimuth + o.width / 2.0f, m_focalLengthX, m_width)};
+                const int64_t X1{project(o.azimuth - o.width / 2.0f, m_focalLengthX, m_width)};
+                const int64_t Y0{project(o.zenith + o.height / 2.0f, m_focalLengthY, m_height)};
+                const int64_t Y1{project(o.zenith - o.height / 2.0f, m_focalLengthY, m_height)};
+                if ( (X0 < X1) && (Y0 < Y1) ) {
+                    RegionOfInterest r;
+                    r.x = static_cast<uint32_t>(X0);
+                    r.y = static_cast<uint32_t>(Y0);
+                    r.width = static_cast<uint32_t>(X1 - X0);
+                    r.height = static_cast<uint32_t>(Y1 - Y0);
+                    r.qpDelta = m_qpDelta;
+                    retVal.push_back(r);
+                }
+            }
+            ++it;
+        }
+        return retVal;
+    }
+
+   private:
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    float m_focalLengthX{0};
+    float m_focalLengthY{0};
+    int64_t m_timeout{0};
+    int32_t m_qpDelta{0};
+    int32_t m_backgroundQpDelta{0};
+
+    std::mutex m_objectsMutex{};
+    std::map<uint32_t, Object> m_objects{};
+};
+
+#endif
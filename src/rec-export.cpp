@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "container-writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{1};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if ( (0 == commandlineArguments.count("rec")) || (0 == commandlineArguments.count("out")) ) {
+        std::cerr << argv[0] << " copies the VP9 (or VP8) frames of one stream from a .rec file into an IVF or WebM file without re-encoding them." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --rec=<file.rec> --out=<file.ivf|file.webm> [--id=<senderStamp>] [--format=<ivf|webm>] [--verbose]" << std::endl;
+        std::cerr << "         --rec:     .rec file to read" << std::endl;
+        std::cerr << "         --out:     file to write" << std::endl;
+        std::cerr << "         --id:      optional: senderStamp of the stream to export (default: senderStamp of the first VP9 frame)" << std::endl;
+        std::cerr << "         --format:  optional: container format (default: derived from the extension of --out; ivf otherwise)" << std::endl;
+        std::cerr << "         --verbose: print information about skipped envelopes" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --rec=2019-06-01_120000.rec --out=2019-06-01_120000.webm --id=0" << std::endl;
+        return retCode;
+    }
+
+    const std::string REC{commandlineArguments["rec"]};
+    const std::string OUT{commandlineArguments["out"]};
+    const bool HAS_ID{commandlineArguments["id"].size() != 0};
+    const uint32_t ID{HAS_ID ? static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
+    const bool VERBOSE{commandlineArguments.count("verbose") != 0};
+    const std::string EXTENSION{".webm"};
+    const bool WEBM{("webm" == commandlineArguments["format"]) ||
+                    ( commandlineArguments["format"].empty() && (OUT.size() > EXTENSION.size()) && (EXTENSION == OUT.substr(OUT.size() - EXTENSION.size())) )};
+
+    std::ifstream in(REC, std::ios::binary);
+    if (!in.good()) {
+        std::cerr << "[rec-export]: Could not open '" << REC << "'." << std::endl;
+        return retCode;
+    }
+    std::unique_ptr<ContainerWriter> writer{WEBM ? static_cast<ContainerWriter*>(new WebmWriter(OUT)) : static_cast<ContainerWriter*>(new IvfWriter(OUT))};
+    if (!writer->good()) {
+        std::cerr << "[rec-export]: Could not create '" << OUT << "'." << std::endl;
+        return retCode;
+    }
+
+    // Envelopes are processed one at a time so that memory use does not depend on the size of the .rec file.
+    bool started{false};
+    uint32_t senderStamp{ID};
+    std::string fourcc;
+    uint32_t width{0};
+    uint32_t height{0};
+    int64_t firstTimeStamp{0};
+    int64_t lastTimeStamp{0};
+    uint64_t frames{0};
+    uint64_t skipped{0};
+    while (in.good() && writer->good()) {
+        auto retVal = cluon::extractEnvelope(in);
+        if (!retVal.first) {
+            break;
+        }
+        cluon::data::Envelope &envelope{retVal.second};
+        if ( (opendlv::proxy::ImageReading::ID() != envelope.dataType()) || (started && (senderStamp != envelope.senderStamp())) || (HAS_ID && (ID != envelope.senderStamp())) ) {
+            continue;
+        }
+        const int64_t SAMPLE_TIME_STAMP{cluon::time::toMicroseconds(envelope.sampleTimeStamp())};
+        const uint32_t SENDER_STAMP{envelope.senderStamp()};
+        opendlv::proxy::ImageReading ir{cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(envelope))};
+        if ( (started && ((fourcc != ir.fourcc()) || (width != ir.width()) || (height != ir.height()))) ||
+             (!started && ("VP90" != ir.fourcc()) && ("VP80" != ir.fourcc())) ) {
+            if (VERBOSE) {
+                std::clog << "[rec-export]: Skipping " << ir.fourcc() << " " << ir.width() << "x" << ir.height() << " frame from senderStamp " << SENDER_STAMP << "." << std::endl;
+            }
+            skipped++;
+            continue;
+        }
+
+        const std::string DATA{ir.data()};
+        if (!started) {
+            // The stream needs to start with a key frame.
+            if (!isVpxKeyFrame(ir.fourcc(), DATA)) {
+                skipped++;
+                continue;
+            }
+            started = true;
+            senderStamp = SENDER_STAMP;
+            fourcc = ir.fourcc();
+            width = ir.width();
+            height = ir.height();
+            firstTimeStamp = SAMPLE_TIME_STAMP;
+            writer->begin(fourcc, width, height);
+            std::clog << "[rec-export]: Exporting " << fourcc << " " << width << "x" << height << " from senderStamp " << senderStamp << " to " << OUT << "." << std::endl;
+        }
+        // Presentation time stamps must not decrease.
+        lastTimeStamp = std::max(SAMPLE_TIME_STAMP - firstTimeStamp, lastTimeStamp);
+        writer->write(DATA, lastTimeStamp, isVpxKeyFrame(fourcc, DATA));
+        frames++;
+    }
+
+    if (started) {
+        writer->end();
+    }
+    if (!started) {
+        std::cerr << "[rec-export]: No VP9 or VP8 frames found in '" << REC << "'" << (HAS_ID ? " for the given senderStamp." : ".") << std::endl;
+    }
+    else if (!writer->good()) {
+        std::cerr << "[rec-export]: Failed to write '" << OUT << "': " << ::strerror(errno) << std::endl;
+    }
+    else {
+        std::clog << "[rec-export]: Wrote " << frames << " frames (" << lastTimeStamp / 1000 << " ms); skipped " << skipped << " frames." << std::endl;
+        retCode = 0;
+    }
+    return retCode;
+}
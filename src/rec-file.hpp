@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_FILE_HPP
+#define REC_FILE_HPP
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @return Name of the sidecar index file that belongs to the given .rec file.
+ */
+inline std::string recIndexName(const std::string &nameOfRecFile) noexcept {
+    return nameOfRecFile + ".idx";
+}
+
+/**
+ * This method reads all checkpoints from the sidecar index of the given .rec
+ * file. The sidecar index is a sequence of little-endian uint64_t values, each
+ * denoting the end of the last complete envelope that was durable on disk at
+ * the time of the checkpoint; a torn last entry is ignored.
+ *
+ * @param nameOfRecFile .rec file to read the checkpoints for.
+ * @return List of checkpoints in the order they were written; empty if no sidecar exists.
+ */
+inline std::vector<uint64_t> readCheckpoints(const std::string &nameOfRecFile) noexcept {
+    std::vector<uint64_t> checkpoints;
+    int fd = ::open(recIndexName(nameOfRecFile).c_str(), O_RDONLY);
+    if (-1 != fd) {
+        struct stat fileStatus;
+        if (0 == ::fstat(fd, &fileStatus)) {
+            const std::size_t ENTRIES{static_cast<std::size_t>(fileStatus.st_size) / sizeof(uint64_t)};
+            checkpoints.resize(ENTRIES);
+            const ssize_t SIZE{static_cast<ssize_t>(ENTRIES * sizeof(uint64_t))};
+            if (SIZE != ::pread(fd, checkpoints.data(), static_cast<std::size_t>(SIZE), 0)) {
+                checkpoints.clear();
+            }
+            for (auto &c : checkpoints) {
+                c = le64toh(c);
+            }
+        }
+        ::close(fd);
+    }
+    return checkpoints;
+}
+
+/**
+ * RecFile writes envelopes into a .rec file via a plain file descriptor so that
+ * written data can be made durable with fdatasync. Every checkpoint() syncs the
+ * data written so far and appends the resulting durable offset to the sidecar
+ * index <name>.idx so that rec-repair can truncate a damaged file quickly.
+ *
+ * To start recording without delay, a file can be prepared ahead of time as
+ * unnamed file in its directory with space reserved for it; publish() gives
+ * it its name once recording starts.
+ */
+class RecFile {
+   private:
+    RecFile(const RecFile &) = delete;
+    RecFile(RecFile &&)      = delete;
+    RecFile &operator=(const RecFile &) = delete;
+    RecFile &operator=(RecFile &&) = delete;
+
+   public:
+    explicit RecFile(const std::string &name) noexcept
+        : m_name(name) {
+        m_fd = ::open(m_name.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if (-1 != m_fd) {
+            m_indexFd = ::open(recIndexName(m_name).c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+        }
+    }
+
+    ~RecFile() noexcept {
+        close();
+    }
+
+    /**
+     * This method creates an unnamed .rec file and index in the given
+     * directory that are linked under their names by publish().
+     *
+     * @return nullptr if the file system does not support unnamed files.
+     */
+    static std::unique_ptr<RecFile> prepare(const std::string &directory, uint64_t preallocate) noexcept {
+        std::unique_ptr<RecFile> f{new RecFile(std::string())};
+        const std::string DIRECTORY{directory.empty() ? "." : directory};
+        f->m_fd = ::open(DIRECTORY.c_str(), O_TMPFILE|O_WRONLY|O_CLOEXEC, 0644);
+        f->m_indexFd = ::open(DIRECTORY.c_str(), O_TMPFILE|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+        if ( (-1 == f->m_fd) || (-1 == f->m_indexFd) ) {
+            return nullptr;
+        }
+        f->preallocate(preallocate);
+        return f;
+    }
+
+    /**
+     * This method gives a file from prepare() its name; an existing file with
+     * that name is replaced.
+     *
+     * @return true on success.
+     */
+    bool publish(const std::string &name) noexcept {
+        if ( !m_name.empty() || !good() || !link(m_fd, name) || !link(m_indexFd, recIndexName(name)) ) {
+            return false;
+        }
+        m_name = name;
+        return true;
+    }
+
+    /**
+     * This method reserves disk space for the given number of bytes without
+     * changing the file's size; space that is not used is released on close().
+     *
+     * @return true on success.
+     */
+    bool preallocate(uint64_t bytes) noexcept {
+        m_preallocated = good() && (0 < bytes) && (0 == ::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(bytes)));
+        return m_preallocated;
+    }
+
+    /**
+     * @return true if the file is open and no write has failed so far.
+     */
+    bool good() const noexcept {
+        return (-1 != m_fd) && !m_failed;
+    }
+
+    const std::string &name() const noexcept {
+        return m_name;
+    }
+
+    /**
+     * @return Number of bytes written so far.
+     */
+    uint64_t offset() const noexcept {
+        return m_offset;
+    }
+
+    /**
+     * @return Number of bytes known to be on disk since the last checkpoint.
+     */
+    uint64_t durableOffset() const noexcept {
+        return m_durableOffset;
+    }
+
+    /**
+     * This method writes the given bytes completely; callers are expected to
+     * pass complete serialized envelopes so that offset() is always located
+     * at an envelope boundary.
+     *
+     * @return true if all bytes were written.
+     */
+    bool write(const char *data, std::size_t size) noexcept {
+        while (good() && (0 < size)) {
+            ssize_t n = ::write(m_fd, data, size);
+            if (0 == n) {
+                // No progress without an error, e.g., on a full device; retrying would not end.
+                m_failed = true;
+                continue;
+            }
+            if (0 > n) {
+                if (EINTR != errno) {
+                    m_failed = true;
+                }
+                continue;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+            m_offset += static_cast<uint64_t>(n);
+        }
+        return good();
+    }
+
+    bool write(const std::string &data) noexcept {
+        return write(data.data(), data.size());
+    }
+
+    /**
+     * This method writes the given buffers completely with as few system
+     * calls as possible; iov is modified while writing.
+     *
+     * @return true if all bytes were written.
+     */
+    bool write(struct iovec *iov, int count) noexcept {
+        while (good() && (0 < count)) {
+            if (0 == iov->iov_len) {
+                iov++;
+                count--;
+                continue;
+            }
+            ssize_t n = ::writev(m_fd, iov, count);
+            if (0 == n) {
+                // No progress without an error, e.g., on a full device; retrying would not end.
+                m_failed = true;
+                continue;
+            }
+            if (0 > n) {
+                if (EINTR != errno) {
+                    m_failed = true;
+                }
+                continue;
+            }
+            m_offset += static_cast<uint64_t>(n);
+            // Skip all completely written buffers and advance into the partially written one.
+            std::size_t written{static_cast<std::size_t>(n)};
+            while ( (0 < count) && (iov->iov_len <= written) ) {
+                written -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (0 < count) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+        return good();
+    }
+
+    /**
+     * This method syncs all data written so far to disk and records the
+     * resulting durable offset in the sidecar index.
+     *
+     * @return true if the checkpoint was recorded.
+     */
+    bool checkpoint() noexcept {
+        bool retVal{false};
+        if (good() && (m_offset != m_durableOffset) && (0 == ::fdatasync(m_fd))) {
+            m_durableOffset = m_offset;
+            retVal = true;
+            if (-1 != m_indexFd) {
+                const uint64_t ENTRY{htole64(m_durableOffset)};
+                retVal = (sizeof(ENTRY) == static_cast<std::size_t>(::write(m_indexFd, &ENTRY, sizeof(ENTRY))));
+            }
+        }
+        return retVal;
+    }
+
+    /**
+     * This method checkpoints and closes the file.
+     */
+    void close() noexcept {
+        if (-1 != m_fd) {
+            checkpoint();
+            if (m_preallocated) {
+                // Blocks reserved beyond the end of the file stay allocated until they are truncated.
+                (void)::ftruncate(m_fd, static_cast<off_t>(m_offset));
+            }
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        if (-1 != m_indexFd) {
+            ::close(m_indexFd);
+            m_indexFd = -1;
+        }
+    }
+
+   private:
+    static bool link(int fd, const std::string &name) noexcept {
+        const std::string PATH{"/proc/self/fd/" + std::to_string(fd)};
+        if (0 == ::linkat(AT_FDCWD, PATH.c_str(), AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW)) {
+            return true;
+        }
+        // linkat does not replace existing files.
+        return (EEXIST == errno) && (0 == ::unlink(name.c_str())) && (0 == ::linkat(AT_FDCWD, PATH.c_str(), AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW));
+    }
+
+   private:
+    std::string m_name{""};
+    int m_fd{-1};
+    int m_indexFd{-1};
+    bool m_failed{false};
+    bool m_preallocated{false};
+    uint64_t m_offset{0};
+    uint64_t m_durableOffset{0};
+};
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_READER_HPP
+#define REC_READER_HPP
+
+#include "cluon-complete.hpp"
+#include "rec-file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * EnvelopeView describes an Envelope inside a memory-mapped .rec file. The
+ * serialized message is not copied; serializedData points into the mapping
+ * and is valid as long as the RecReader exists.
+ */
+struct EnvelopeView {
+    // Offset of the OD4 header in the file and size including the header.
+    uint64_t offset{0};
+    uint32_t size{0};
+    int32_t dataType{0};
+    uint32_t senderStamp{0};
+    // Time stamps in microseconds.
+    int64_t sent{0};
+    int64_t received{0};
+    int64_t sampleTimeStamp{0};
+    const char *serializedData{""};
+    uint32_t serializedSize{0};
+
+    /**
+     * @return Copy of this envelope for use with cluon::extractMessage.
+     */
+    cluon::data::Envelope toEnvelope() const noexcept {
+        cluon::data::Envelope envelope;
+        envelope.dataType(dataType)
+            .serializedData(std::string(serializedData, serializedSize))
+            .sent(cluon::time::fromMicroseconds(sent))
+            .received(cluon::time::fromMicroseconds(received))
+            .sampleTimeStamp(cluon::time::fromMicroseconds(sampleTimeStamp))
+            .senderStamp(senderStamp);
+        return envelope;
+    }
+};
+
+/**
+ * RecReader maps a .rec file into memory and iterates over its envelopes in
+ * place, i.e., without reading them into intermediate buffers as
+ * cluon::Player does. The file can be split into disjoint ranges that start
+ * at envelope boundaries so that several threads scan it concurrently.
+ */
+class RecReader {
+   private:
+    RecReader(const RecReader &) = delete;
+    RecReader(RecReader &&)      = delete;
+    RecReader &operator=(const RecReader &) = delete;
+    RecReader &operator=(RecReader &&) = delete;
+
+   public:
+    explicit RecReader(const std::string &name) noexcept
+        : m_name(name) {
+        m_fd = ::open(name.c_str(), O_RDONLY);
+        struct stat fileStatus;
+        if ( (-1 == m_fd) || (0 != ::fstat(m_fd, &fileStatus)) ) {
+            return;
+        }
+        m_size = static_cast<uint64_t>(fileStatus.st_size);
+        if (0 < m_size) {
+            void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+            if (MAP_FAILED == data) {
+                return;
+            }
+            m_data = static_cast<const uint8_t*>(data);
+            ::madvise(const_cast<uint8_t*>(m_data), m_size, MADV_SEQUENTIAL);
+        }
+        m_good = true;
+    }
+
+    ~RecReader() {
+        if (nullptr != m_data) {
+            ::munmap(const_cast<uint8_t*>(m_data), m_size);
+        }
+        if (-1 != m_fd) {
+            ::close(m_fd);
+        }
+    }
+
+    bool good() const noexcept {
+        return m_good;
+    }
+
+    uint64_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * This method decodes the envelope at the given offset.
+     *
+     * @return true if a complete envelope with a dataType starts at offset.
+     */
+    bool envelopeAt(uint64_t offset, EnvelopeView &view) const noexcept {
+        if ( (offset + OD4_HEADER_SIZE > m_size) || (0x0D != m_data[offset]) || (0xA4 != m_data[offset + 1]) ) {
+            return false;
+        }
+        const uint32_t LENGTH{static_cast<uint32_t>(m_data[offset + 2]) | (static_cast<uint32_t>(m_data[offset + 3]) << 8) | (static_cast<uint32_t>(m_data[offset + 4]) << 16)};
+        if (offset + OD4_HEADER_SIZE + LENGTH > m_size) {
+            return false;
+        }
+        view = EnvelopeView{};
+        view.offset = offset;
+        view.size = OD4_HEADER_SIZE + LENGTH;
+        return decodeEnvelope(m_data + offset + OD4_HEADER_SIZE, m_data + offset + view.size, view) && (0 != view.dataType);
+    }
+
+    /**
+     * This method finds the first envelope that starts at or after offset. A
+     * candidate header counts only if it is followed by further envelopes (or
+     * the end of the file) so that 0x0D 0xA4 in payloads is not mistaken for
+     * an envelope.
+     *
+     * @return Offset of the envelope or size() if there is none.
+     */
+    uint64_t synchronize(uint64_t offset) const noexcept {
+        const uint32_t CHAIN{3};
+        EnvelopeView view;
+        for (uint64_t candidate{offset}; candidate + 1 < m_size; candidate++) {
+            const void *NEXT{::memchr(m_data + candidate, 0x0D, m_size - candidate - 1)};
+            if (nullptr == NEXT) {
+                break;
+            }
+            candidate = static_cast<uint64_t>(static_cast<const uint8_t*>(NEXT) - m_data);
+            uint64_t position{candidate};
+            uint32_t chain{0};
+            while ( (chain < CHAIN) && (position < m_size) && envelopeAt(position, view) ) {
+                position += view.size;
+                chain++;
+            }
+            if ( (0 < chain) && ((CHAIN == chain) || (position == m_size)) ) {
+                return candidate;
+            }
+        }
+        return m_size;
+    }
+
+    /**
+     * This method splits the file into at most count disjoint ranges
+     * [first, second) that each start at an envelope. Boundaries are taken
+     * from the sidecar index when one exists.
+     */
+    std::vector<std::pair<uint64_t, uint64_t>> split(uint32_t count) const noexcept {
+        std::vector<uint64_t> checkpoints{readCheckpoints(m_name)};
+        std::vector<uint64_t> boundaries{0};
+        EnvelopeView view;
+        for (uint32_t i{1}; i < count; i++) {
+            const uint64_t TARGET{m_size / count * i};
+            uint64_t boundary{m_size};
+            for (uint64_t c : checkpoints) {
+                if ( (TARGET <= c) && (c < m_size) && envelopeAt(c, view) ) {
+                    boundary = c;
+                    break;
+                }
+            }
+            if (m_size == boundary) {
+                boundary = synchronize(TARGET);
+            }
+            if (boundaries.back() < boundary) {
+                boundaries.push_back(boundary);
+            }
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        for (std::size_t i{0}; i < boundaries.size(); i++) {
+            const uint64_t END{(i + 1 < boundaries.size()) ? boundaries[i + 1] : m_size};
+            if (boundaries[i] < END) {
+                ranges.emplace_back(boundaries[i], END);
+            }
+        }
+        return ranges;
+    }
+
+    /**
+     * This method calls delegate(const EnvelopeView&) for each envelope that
+     * starts within [begin, end); begin needs to be an envelope boundary.
+     * Iteration stops at the first incomplete or undecodable envelope.
+     *
+     * @return Offset after the last visited envelope.
+     */
+    template <typename Delegate>
+    uint64_t forEach(Delegate &&delegate, uint64_t begin = 0, uint64_t end = std::numeric_limits<uint64_t>::max()) const noexcept {
+        EnvelopeView view;
+        uint64_t offset{begin};
+        while ( (offset < end) && envelopeAt(offset, view) ) {
+            delegate(view);
+            offset += view.size;
+        }
+        return offset;
+    }
+
+   private:
+    static bool readVarInt(const uint8_t *&p, const uint8_t *end, uint64_t &v) noexcept {
+        v = 0;
+        for (uint32_t shift{0}; (p < end) && (shift < 64); shift += 7) {
+            const uint8_t BYTE{*p++};
+            v |= static_cast<uint64_t>(BYTE & 0x7F) << shift;
+            if (0 == (BYTE & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static int32_t fromZigZag32(uint64_t v) noexcept {
+        const uint32_t V{static_cast<uint32_t>(v)};
+        return static_cast<int32_t>((V >> 1) ^ (~(V & 1) + 1));
+    }
+
+    // Decodes cluon.data.TimeStamp into microseconds.
+    static bool decodeTimeStamp(const uint8_t *p, const uint8_t *end, int64_t &microseconds) noexcept {
+        int64_t seconds{0};
+        int64_t us{0};
+        uint64_t key{0};
+        uint64_t value{0};
+        while (p < end) {
+            if (!readVarInt(p, end, key) || (0 != (key & 0x7)) || !readVarInt(p, end, value)) {
+                return false;
+            }
+            if (1 == (key >> 3)) {
+                seconds = fromZigZag32(value);
+            }
+            else if (2 == (key >> 3)) {
+                us = fromZigZag32(value);
+            }
+        }
+        microseconds = seconds * 1000 * 1000 + us;
+        return true;
+    }
+
+    // Decodes cluon.data.Envelope; as with cluon, the last occurrence of a field wins.
+    static bool decodeEnvelope(const uint8_t *p, const uint8_t *end, EnvelopeView &view) noexcept {
+        uint64_t key{0};
+        uint64_t value{0};
+        while (p < end) {
+            if (!readVarInt(p, end, key)) {
+                return false;
+            }
+            const uint64_t FIELD{key >> 3};
+            switch (key & 0x7) {
+                case 0: {
+                    if (!readVarInt(p, end, value)) {
+                        return false;
+                    }
+                    if (1 == FIELD) {
+                        view.dataType = fromZigZag32(value);
+                    }
+                    else if (6 == FIELD) {
+                        view.senderStamp = static_cast<uint32_t>(value);
+                    }
+                    break;
+                }
+                case 1:
+                case 5: {
+                    const std::ptrdiff_t SIZE{(1 == (key & 0x7)) ? 8 : 4};
+                    if (end - p < SIZE) {
+                        return false;
+                    }
+                    p += SIZE;
+                    break;
+                }
+                case 2: {
+                    if (!readVarInt(p, end, value) || (value > static_cast<uint64_t>(end - p))) {
+                        return false;
+                    }
+                    const uint8_t *FIELD_END{p + value};
+                    if (2 == FIELD) {
+                        view.serializedData = reinterpret_cast<const char*>(p);
+                        view.serializedSize = static_cast<uint32_t>(value);
+                    }
+                    else if ( ((3 == FIELD) && !decodeTimeStamp(p, FIELD_END, view.sent)) ||
+                              ((4 == FIELD) && !decodeTimeStamp(p, FIELD_END, view.received)) ||
+                              ((5 == FIELD) && !decodeTimeStamp(p, FIELD_END, view.sampleTimeStamp)) ) {
+                        return false;
+                    }
+                    p = FIELD_END;
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return (p == end);
+    }
+
+   private:
+    static const uint32_t OD4_HEADER_SIZE{5};
+    std::string m_name;
+    int m_fd{-1};
+    bool m_good{false};
+    uint64_t m_size{0};
+    const uint8_t *m_data{nullptr};
+};
+
+#endif
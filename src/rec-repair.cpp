@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "rec-file.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+constexpr uint8_t OD4_HEADER_SIZE{5};
+
+// Returns the end of the envelope starting at offset or 0 if there is no complete and decodable envelope.
+static uint64_t validEnvelopeAt(int fd, uint64_t offset, uint64_t fileSize) noexcept {
+    uint64_t end{0};
+    if (offset + OD4_HEADER_SIZE <= fileSize) {
+        uint8_t header[OD4_HEADER_SIZE];
+        if ( (OD4_HEADER_SIZE == ::pread(fd, header, OD4_HEADER_SIZE, static_cast<off_t>(offset))) &&
+             (0x0D == header[0]) && (0xA4 == header[1]) ) {
+            const uint32_t LENGTH{static_cast<uint32_t>(header[2]) | (static_cast<uint32_t>(header[3]) << 8) | (static_cast<uint32_t>(header[4]) << 16)};
+            if (offset + OD4_HEADER_SIZE + LENGTH <= fileSize) {
+                std::string payload(LENGTH, '\0');
+                if (static_cast<ssize_t>(LENGTH) == ::pread(fd, &payload[0], LENGTH, static_cast<off_t>(offset + OD4_HEADER_SIZE))) {
+                    std::stringstream sstr(payload);
+                    cluon::data::Envelope envelope;
+                    cluon::FromProtoVisitor protoDecoder;
+                    protoDecoder.decodeFrom(sstr, envelope);
+                    if (0 != envelope.dataType()) {
+                        end = offset + OD4_HEADER_SIZE + LENGTH;
+                    }
+                }
+            }
+        }
+    }
+    return end;
+}
+
+// Searches backwards from the end of the file for the last envelope that is both complete and followed by either
+// the end of the file or another envelope header; this avoids treating 0x0D 0xA4 inside payloads as envelope start.
+static uint64_t lastValidEnvelopeBackwards(int fd, uint64_t fileSize) noexcept {
+    const uint64_t BLOCK_SIZE{1024*1024};
+    std::vector<uint8_t> block(BLOCK_SIZE + 1);
+    uint64_t blockEnd{fileSize};
+    while (0 < blockEnd) {
+        const uint64_t BLOCK_START{(blockEnd > BLOCK_SIZE) ? blockEnd - BLOCK_SIZE : 0};
+        // Read one additional byte to detect headers spanning two blocks.
+        const uint64_t BYTES{std::min(blockEnd + 1, fileSize) - BLOCK_START};
+        if (static_cast<ssize_t>(BYTES) != ::pread(fd, block.data(), BYTES, static_cast<off_t>(BLOCK_START))) {
+            break;
+        }
+        for (uint64_t i{blockEnd - BLOCK_START}; i-- > 0;) {
+            if ( (i + 1 < BYTES) && (0x0D == block[i]) && (0xA4 == block[i + 1]) ) {
+                const uint64_t CANDIDATE{BLOCK_START + i};
+                const uint64_t END{validEnvelopeAt(fd, CANDIDATE, fileSize)};
+                if (0 < END) {
+                    uint8_t next[2]{0, 0};
+                    const bool FOLLOWED_BY_HEADER{(END + 2 <= fileSize) && (2 == ::pread(fd, next, 2, static_cast<off_t>(END))) && (0x0D == next[0]) && (0xA4 == next[1])};
+                    if ( (END == fileSize) || FOLLOWED_BY_HEADER || (0 == CANDIDATE) ) {
+                        return CANDIDATE;
+                    }
+                }
+            }
+        }
+        blockEnd = BLOCK_START;
+    }
+    return 0;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{1};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 == commandlineArguments.count("rec")) {
+        std::cerr << argv[0] << " truncates a .rec file that was damaged by an interrupted write to its last complete envelope." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --rec=<file.rec> [--dry-run] [--verbose]" << std::endl;
+        std::cerr << "         --rec:     .rec file to repair; the sidecar index <file.rec>.idx is used when present" << std::endl;
+        std::cerr << "         --dry-run: only report what would be truncated" << std::endl;
+        std::cerr << "         --verbose: print details while scanning" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --rec=2019-06-01_120000.rec" << std::endl;
+    }
+    else {
+        const std::string REC{commandlineArguments["rec"]};
+        const bool DRY_RUN{commandlineArguments.count("dry-run") != 0};
+        const bool VERBOSE{commandlineArguments.count("verbose") != 0};
+
+        int fd = ::open(REC.c_str(), (DRY_RUN ? O_RDONLY : O_RDWR));
+        struct stat fileStatus;
+        if ( (-1 == fd) || (0 != ::fstat(fd, &fileStatus)) ) {
+            std::cerr << "[rec-repair]: Could not open '" << REC << "': " << ::strerror(errno) << std::endl;
+            return retCode;
+        }
+        const uint64_t FILE_SIZE{static_cast<uint64_t>(fileStatus.st_size)};
+
+        // Start at the last checkpoint that lies within the file; all bytes before were synced to disk.
+        uint64_t start{0};
+        bool foundCheckpoint{false};
+        {
+            auto checkpoints = readCheckpoints(REC);
+            for (auto it = checkpoints.rbegin(); it != checkpoints.rend(); it++) {
+                if (*it <= FILE_SIZE) {
+                    start = *it;
+                    foundCheckpoint = true;
+                    break;
+                }
+            }
+        }
+        if (!foundCheckpoint) {
+            start = lastValidEnvelopeBackwards(fd, FILE_SIZE);
+        }
+        if (VERBOSE) {
+            std::clog << "[rec-repair]: Scanning '" << REC << "' (" << FILE_SIZE << " bytes) from offset " << start
+                      << (foundCheckpoint ? " (checkpoint)." : " (backward scan).") << std::endl;
+        }
+
+        // Walk forward over all complete envelopes written after the starting point.
+        uint64_t validEnd{start};
+        uint32_t envelopes{0};
+        for (uint64_t end{0}; 0 < (end = validEnvelopeAt(fd, validEnd, FILE_SIZE)); validEnd = end) {
+            envelopes++;
+        }
+
+        if (validEnd == FILE_SIZE) {
+            std::clog << "[rec-repair]: '" << REC << "' is intact (" << FILE_SIZE << " bytes)." << std::endl;
+            retCode = 0;
+        }
+        else {
+            std::clog << "[rec-repair]: " << (DRY_RUN ? "Would truncate" : "Truncating") << " '" << REC << "' from " << FILE_SIZE << " to " << validEnd
+                      << " bytes (" << envelopes << " complete envelopes after offset " << start << ")." << std::endl;
+            if (DRY_RUN || (0 == ::ftruncate(fd, static_cast<off_t>(validEnd)) && (0 == ::fsync(fd)))) {
+                retCode = 0;
+            }
+            else {
+                std::cerr << "[rec-repair]: Failed to truncate '" << REC << "': " << ::strerror(errno) << std::endl;
+            }
+        }
+        ::close(fd);
+    }
+    return retCode;
+}
@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "encoder-backends.hpp"
+#include "encoder-branch.hpp"
+#include "frame-decoders.hpp"
+#include "rec-file.hpp"
+#include "thread-pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A segment is a contiguous range of envelopes of a .rec file that is
+ * transcoded independently of all other segments. For predictive input
+ * streams, priming holds the frames since the last key frame before the
+ * segment so that decoding can start within a GOP; they are not re-encoded.
+ */
+struct Segment {
+    uint64_t index{0};
+    uint64_t bytes{0}; // Size of the serialized data of all envelopes.
+    std::vector<cluon::data::Envelope> envelopes{};
+    std::map<uint32_t, std::vector<cluon::data::Envelope>> priming{};
+};
+
+/**
+ * SegmentBudget bounds the segments in memory by their number and by the
+ * size of their input; a segment holds its share from being submitted until
+ * its output is written, as later segments wait in memory for earlier ones.
+ */
+class SegmentBudget {
+   private:
+    SegmentBudget(const SegmentBudget &) = delete;
+    SegmentBudget(SegmentBudget &&)      = delete;
+    SegmentBudget &operator=(const SegmentBudget &) = delete;
+    SegmentBudget &operator=(SegmentBudget &&) = delete;
+
+   public:
+    SegmentBudget(uint32_t maxSegments, uint64_t maxBytes) noexcept
+        : m_maxSegments(maxSegments)
+        , m_maxBytes(maxBytes) {}
+
+    /**
+     * This method waits until the given segment fits; a segment larger than
+     * the budget waits until no other segment is in memory.
+     */
+    void acquire(uint64_t bytes) noexcept {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_condition.wait(lck, [&](){ return (0 == m_segments) || ((m_segments < m_maxSegments) && (m_bytes + bytes <= m_maxBytes)); });
+        m_segments++;
+        m_bytes += bytes;
+    }
+
+    void release(uint32_t segments, uint64_t bytes) noexcept {
+        // Notify while holding the lock as main returns as soon as no segment is in memory.
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_segments -= segments;
+        m_bytes -= bytes;
+        m_condition.notify_all();
+    }
+
+    void waitUntilEmpty() noexcept {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_condition.wait(lck, [&](){ return 0 == m_segments; });
+    }
+
+   private:
+    const uint32_t m_maxSegments;
+    const uint64_t m_maxBytes;
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    uint32_t m_segments{0};
+    uint64_t m_bytes{0};
+};
+
+/**
+ * OutputFile collects the transcoded segments of one .rec file and writes
+ * them in their original order as soon as all preceding ones are complete.
+ */
+class OutputFile {
+   private:
+    OutputFile(const OutputFile &) = delete;
+    OutputFile(OutputFile &&)      = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+    OutputFile &operator=(OutputFile &&) = delete;
+
+   public:
+    explicit OutputFile(const std::string &name) noexcept
+        : m_recFile(name) {}
+
+    bool good() const noexcept {
+        return m_recFile.good();
+    }
+
+    /**
+     * This method adds the output of the given segment and writes all segments that are next in order.
+     *
+     * @return Number of segments written and the sum of their bytes as passed to this method.
+     */
+    std::pair<uint32_t, uint64_t> complete(uint64_t index, std::string &&data, uint64_t bytes) noexcept {
+        std::pair<uint32_t, uint64_t> written{0, 0};
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_completed[index] = std::make_pair(std::move(data), bytes);
+        for (auto it = m_completed.find(m_next); it != m_completed.end(); it = m_completed.find(m_next)) {
+            m_recFile.write(it->second.first);
+            written.first++;
+            written.second += it->second.second;
+            m_completed.erase(it);
+            m_next++;
+        }
+        closeWhenDone();
+        return written;
+    }
+
+    /**
+     * This method marks the end of the input after the given number of segments.
+     */
+    void finish(uint64_t segments) noexcept {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_segments = segments;
+        m_finished = true;
+        closeWhenDone();
+    }
+
+    std::atomic<uint64_t> framesTranscoded{0};
+    std::atomic<uint64_t> framesCopied{0};
+    std::atomic<uint64_t> framesDropped{0};
+
+   private:
+    void closeWhenDone() noexcept {
+        if (m_finished && (m_next == m_segments) && m_recFile.good()) {
+            m_recFile.close();
+            std::clog << "[rec-transcode]: Wrote " << m_recFile.name() << ": transcoded " << framesTranscoded << " frames, copied " << framesCopied
+                      << " frames, dropped " << framesDropped << " undecodable frames." << std::endl;
+        }
+    }
+
+   private:
+    RecFile m_recFile;
+    std::mutex m_mutex{};
+    uint64_t m_next{0};
+    uint64_t m_segments{0};
+    bool m_finished{false};
+    std::map<uint64_t, std::pair<std::string, uint64_t>> m_completed{};
+};
+
+/**
+ * Decoder and encoder for the ImageReadings of one senderStamp within a segment.
+ */
+struct Stream {
+    std::string fourcc{};
+    uint32_t width{0};
+    uint32_t height{0};
+    std::string data{}; // Payload of the last decoded frame as raw frames refer to it.
+    std::unique_ptr<FrameDecoder> decoder{nullptr};
+    std::unique_ptr<EncoderBranch> branch{nullptr};
+    // Envelopes of the frames inside of the encoder and their places in the output.
+    std::deque<std::pair<cluon::data::Envelope, uint64_t>> pending{};
+};
+
+static std::string transcodeSegment(const Segment &segment, const std::string &encoder, const EncoderSettings &settings, OutputFile &outputFile) noexcept {
+    std::string output;
+    std::map<uint32_t, Stream> streams;
+
+    // The output keeps the order of the input: every envelope takes a slot, and the slots of
+    // frames inside of an encoder hold back all following envelopes until the frames are returned.
+    struct Slot {
+        std::string data{};
+        bool ready{false};
+    };
+    std::deque<Slot> slots;
+    uint64_t firstSlot{0};
+    auto fill = [&output, &slots, &firstSlot](uint64_t slot, std::string &&data) {
+        slots[slot - firstSlot].data = std::move(data);
+        slots[slot - firstSlot].ready = true;
+        while (!slots.empty() && slots.front().ready) {
+            output += slots.front().data;
+            slots.pop_front();
+            firstSlot++;
+        }
+    };
+    auto reserve = [&slots, &firstSlot]() {
+        slots.emplace_back();
+        return firstSlot + slots.size() - 1;
+    };
+
+    auto drain = [&fill, &outputFile](Stream &s) {
+        if (s.branch) {
+            s.branch->drain(std::chrono::steady_clock::time_point::max());
+            s.branch.reset();
+        }
+        for (auto &p : s.pending) {
+            fill(p.second, "");
+            outputFile.framesDropped++;
+        }
+        s.pending.clear();
+    };
+
+    // @return Decoded frame of the given envelope's ImageReading or a frame without data.
+    auto decode = [&streams, &drain](const cluon::data::Envelope &envelope, const opendlv::proxy::ImageReading &ir) {
+        Stream &s = streams[envelope.senderStamp()];
+        if (!s.decoder || (s.fourcc != ir.fourcc()) || (s.width != ir.width()) || (s.height != ir.height())) {
+            drain(s);
+            s.fourcc = ir.fourcc();
+            s.width = ir.width();
+            s.height = ir.height();
+            s.decoder = createFrameDecoder(s.fourcc, s.width, s.height);
+        }
+        Frame frame;
+        s.data = ir.data();
+        if (!s.decoder->decode(s.data, frame)) {
+            frame.data = nullptr;
+        }
+        frame.timeStamp = cluon::time::toMicroseconds(envelope.sampleTimeStamp());
+        return frame;
+    };
+
+    for (const auto &p : segment.priming) {
+        for (const auto &envelope : p.second) {
+            cluon::data::Envelope e{envelope};
+            decode(envelope, cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(e)));
+        }
+    }
+
+    for (const auto &envelope : segment.envelopes) {
+        bool copy{opendlv::proxy::ImageReading::ID() != envelope.dataType()};
+        if (!copy) {
+            cluon::data::Envelope e{envelope};
+            const opendlv::proxy::ImageReading IR{cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(e))};
+            copy = !isDecodable(IR.fourcc(), IR.width(), IR.height());
+            if (copy) {
+                outputFile.framesCopied++;
+            }
+            else {
+                const Frame FRAME{decode(envelope, IR)};
+                Stream &s = streams[envelope.senderStamp()];
+                if (nullptr == FRAME.data) {
+                    outputFile.framesDropped++;
+                    continue;
+                }
+                if (!s.branch || (s.branch->preprocessor().width() != FRAME.width) || (s.branch->preprocessor().height() != FRAME.height)) {
+                    drain(s);
+                    Stream *stream{&s};
+                    auto writer = [stream, &fill, &outputFile](const EncoderBranch &branch, const EncodedFrame &encodedFrame) {
+                        // Encoders return the frames in their order but might drop some; the envelope keeps all original time stamps.
+                        while ( (1 < stream->pending.size()) && (cluon::time::toMicroseconds(stream->pending.front().first.sampleTimeStamp()) < encodedFrame.timeStamp) ) {
+                            fill(stream->pending.front().second, "");
+                            stream->pending.pop_front();
+                            outputFile.framesDropped++;
+                        }
+                        cluon::data::Envelope out{stream->pending.front().first};
+                        const uint64_t SLOT{stream->pending.front().second};
+                        stream->pending.pop_front();
+                        opendlv::proxy::ImageReading ir;
+                        ir.fourcc(branch.encoder().fourcc()).width(branch.settings().width).height(branch.settings().height)
+                          .data(std::string(reinterpret_cast<const char*>(encodedFrame.data), encodedFrame.size));
+                        cluon::ToProtoVisitor protoEncoder;
+                        ir.accept(protoEncoder);
+                        out.serializedData(protoEncoder.encodedData());
+                        fill(SLOT, cluon::serializeEnvelope(std::move(out)));
+                        outputFile.framesTranscoded++;
+                    };
+                    s.branch.reset(new EncoderBranch(envelope.senderStamp(), createEncoderBackend(encoder), FRAME.fourcc, FRAME.width, FRAME.height,
+                                                     Preprocessing(), settings, nullptr, writer));
+                    if (!s.branch->open()) {
+                        s.branch.reset();
+                        outputFile.framesDropped++;
+                        continue;
+                    }
+                }
+                s.pending.emplace_back(envelope, reserve());
+                if (!s.branch->encode(s.branch->preprocessor().process(FRAME))) {
+                    fill(s.pending.back().second, "");
+                    s.pending.pop_back();
+                    outputFile.framesDropped++;
+                }
+            }
+        }
+        if (copy) {
+            cluon::data::Envelope e{envelope};
+            fill(reserve(), cluon::serializeEnvelope(std::move(e)));
+        }
+    }
+
+    for (auto &s : streams) {
+        drain(s.second);
+    }
+    return output;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{1};
+    const uint32_t ONE{1};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 == commandlineArguments.count("rec")) {
+        std::cerr << argv[0] << " re-encodes the raw (I420, NV12, YUYV, BGR3, RGB3, I4LZ, I4ZS) and h264 ImageReadings of existing .rec files into VP9 in parallel; all other envelopes and all time stamps and senderStamps are kept." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --rec=<list of .rec files> [--suffix=<suffix>] [--encoder=<encoder>] [--threads=<threads>] [--encoder-threads=<threads>] [--segment=<frames>] [--memory=<MiB>] "
+                  << "[--gop=<GOP>] [--bitrate=<bitrate>] [--rc-mode=<rc-mode>] [--init-qp=<init-qp>] [--qpmin=<qpmin>] [--qpmax=<qpmax>] [--lossless]" << std::endl;
+        std::cerr << "         --rec:             comma-separated list of .rec files to transcode" << std::endl;
+        std::cerr << "         --suffix:          optional: suffix for the resulting .rec files (default: -vp9, i.e., a.rec becomes a-vp9.rec)" << std::endl;
+        std::cerr << "         --encoder:         optional: encoder backend to use: qsv, vpx (software), raw, lz4, zstd (default: vpx)" << std::endl;
+        std::cerr << "         --threads:         optional: number of segments to transcode in parallel (default: #cores)" << std::endl;
+        std::cerr << "         --encoder-threads: optional: threads per encoder (default: 1)" << std::endl;
+        std::cerr << "         --segment:         optional: number of frames per stream and independently transcoded segment; rounded up to a multiple of --gop (default: 300)" << std::endl;
+        std::cerr << "         --memory:          optional: approximate limit in MiB for the envelopes of all segments in memory; segments get shorter for large frames (default: 4096)" << std::endl;
+        std::cerr << "         --gop:             optional: length of group of pictures (default = 1)" << std::endl;
+        std::cerr << "         --bitrate:         optional: (default = 8000)" << std::endl;
+        std::cerr << "         --rc-mode:         optional: rate control mode (default: 4, 0: NONE, 1: CBR, 2: VBR, 3: VCM, 4: CQP)" << std::endl;
+        std::cerr << "         --init-qp          optional: initial QP (default: 26)" << std::endl;
+        std::cerr << "         --qpmin            optional: minimum QP (default: 0)" << std::endl;
+        std::cerr << "         --qpmax            optional: maximum QP (default: 51)" << std::endl;
+        std::cerr << "         --lossless:        optional: encode lossless VP9 (implies --encoder=vpx)" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --rec=2019-06-01_120000.rec,2019-06-01_130000.rec --gop=10" << std::endl;
+        return retCode;
+    }
+
+    std::vector<std::string> recFiles;
+    {
+        std::stringstream sstr(commandlineArguments["rec"]);
+        std::string rec;
+        while (std::getline(sstr, rec, ',')) {
+            if (!rec.empty()) {
+                recFiles.push_back(rec);
+            }
+        }
+    }
+    const std::string SUFFIX{(commandlineArguments["suffix"].size() != 0) ? commandlineArguments["suffix"] : "-vp9"};
+    const bool LOSSLESS{commandlineArguments.count("lossless") != 0};
+    const std::string ENCODER{(commandlineArguments["encoder"].size() != 0) ? commandlineArguments["encoder"] : "vpx"};
+    const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : std::max(std::thread::hardware_concurrency(), ONE)};
+    const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : 1};
+    const uint32_t SEGMENT_DEFAULT{300};
+    const uint32_t SEGMENT_REQUESTED{(commandlineArguments["segment"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["segment"])) : SEGMENT_DEFAULT};
+    const uint32_t SEGMENT{std::max((SEGMENT_REQUESTED + std::max(GOP, ONE) - 1) / std::max(GOP, ONE), ONE) * std::max(GOP, ONE)};
+    const uint64_t MEMORY{((commandlineArguments["memory"].size() != 0) ? static_cast<uint64_t>(std::stoll(commandlineArguments["memory"])) : 4096) * 1024 * 1024};
+    // All workers are busy with a segment while the next one is read.
+    const uint64_t SEGMENT_BYTES{MEMORY / (THREADS + 1)};
+
+    EncoderSettings settings;
+    {
+        settings.gop = GOP;
+        settings.bitrate = ((commandlineArguments["bitrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["bitrate"])) : 8000) * 1024;
+        settings.rcMode = (commandlineArguments["rc-mode"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["rc-mode"])) : 4;
+        settings.initQP = (commandlineArguments["init-qp"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["init-qp"])) : 26;
+        settings.qpMin = (commandlineArguments["qpmin"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["qpmin"])) : 0;
+        settings.qpMax = (commandlineArguments["qpmax"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["qpmax"])) : 51;
+        settings.threads = (commandlineArguments["encoder-threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["encoder-threads"])) : 1;
+        settings.lossless = LOSSLESS;
+    }
+    if (recFiles.empty() || !createEncoderBackend(LOSSLESS ? "vpx" : ENCODER)) {
+        std::cerr << "[rec-transcode]: Nothing to transcode or unknown encoder '" << ENCODER << "'." << std::endl;
+        return retCode;
+    }
+
+    // Segments of all files share the workers; the number and the size of the segments in memory are bounded.
+    ThreadPool threadPool(THREADS);
+    SegmentBudget budget{2 * THREADS + 1, MEMORY};
+
+    std::vector<std::unique_ptr<OutputFile>> outputFiles;
+    for (const auto &rec : recFiles) {
+        std::ifstream in(rec, std::ios::binary);
+        const std::string BASE{((4 < rec.size()) && (".rec" == rec.substr(rec.size() - 4))) ? rec.substr(0, rec.size() - 4) : rec};
+        outputFiles.emplace_back(new OutputFile(BASE + SUFFIX + ".rec"));
+        OutputFile *outputFile{outputFiles.back().get()};
+        if (!in.good() || !outputFile->good()) {
+            std::cerr << "[rec-transcode]: Could not open '" << rec << "' or '" << BASE + SUFFIX + ".rec" << "'." << std::endl;
+            outputFile->finish(0);
+            continue;
+        }
+        std::clog << "[rec-transcode]: Transcoding " << rec << " to " << BASE + SUFFIX + ".rec" << "." << std::endl;
+
+        // Frames since the last key frame of predictive streams.
+        std::map<uint32_t, std::vector<cluon::data::Envelope>> sinceKeyFrame;
+        uint64_t index{0};
+        auto submit = [&](std::shared_ptr<Segment> segment) {
+            budget.acquire(segment->bytes);
+            threadPool.submit([segment, outputFile, &ENCODER, &settings, LOSSLESS, &budget]() {
+                const std::pair<uint32_t, uint64_t> WRITTEN{outputFile->complete(segment->index, transcodeSegment(*segment, (LOSSLESS ? "vpx" : ENCODER), settings, *outputFile), segment->bytes)};
+                budget.release(WRITTEN.first, WRITTEN.second);
+            });
+        };
+
+        std::shared_ptr<Segment> segment{std::make_shared<Segment>()};
+        // Frames per senderStamp in the segment and the senderStamps that are re-encoded.
+        std::map<uint32_t, uint32_t> framesInSegment;
+        std::set<uint32_t> reencoded;
+        while (in.good()) {
+            auto retVal = cluon::extractEnvelope(in);
+            if (!retVal.first) {
+                break;
+            }
+            cluon::data::Envelope &envelope{retVal.second};
+            if (opendlv::proxy::ImageReading::ID() == envelope.dataType()) {
+                cluon::data::Envelope e{envelope};
+                const opendlv::proxy::ImageReading IR{cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(e))};
+
+                // Segments end after complete GOPs of all re-encoded streams so that the GOP structure is the same as when
+                // encoding the file in one pass. If the GOPs of the streams never end together, e.g., for different frame
+                // rates, the segment ends after twice its length or size anyway and the GOPs of some streams restart early.
+                uint32_t longest{0};
+                bool gopsComplete{true};
+                for (const auto &f : framesInSegment) {
+                    longest = std::max(longest, f.second);
+                    gopsComplete = gopsComplete && ((0 == reencoded.count(f.first)) || (0 == f.second % std::max(GOP, ONE)));
+                }
+                const bool FULL{(SEGMENT <= longest) || (SEGMENT_BYTES <= segment->bytes)};
+                const bool OVERFULL{(2 * SEGMENT <= longest) || (2 * SEGMENT_BYTES <= segment->bytes)};
+                if ( (FULL && gopsComplete) || OVERFULL ) {
+                    segment->index = index++;
+                    submit(segment);
+                    segment = std::make_shared<Segment>();
+                    framesInSegment.clear();
+                    reencoded.clear();
+                    for (const auto &s : sinceKeyFrame) {
+                        segment->priming[s.first] = s.second;
+                        for (const auto &p : s.second) {
+                            segment->bytes += p.serializedData().size();
+                        }
+                    }
+                }
+                framesInSegment[envelope.senderStamp()]++;
+                if (isDecodable(IR.fourcc(), IR.width(), IR.height())) {
+                    reencoded.insert(envelope.senderStamp());
+                }
+                if (isPredictive(IR.fourcc())) {
+                    auto &frames = sinceKeyFrame[envelope.senderStamp()];
+                    if (isKeyFrame(IR.fourcc(), IR.data())) {
+                        frames.clear();
+                    }
+                    frames.push_back(envelope);
+                }
+            }
+            segment->bytes += envelope.serializedData().size();
+            segment->envelopes.push_back(envelope);
+        }
+        if (!segment->envelopes.empty()) {
+            segment->index = index++;
+            submit(segment);
+        }
+        outputFile->finish(index);
+    }
+
+    budget.waitUntilEmpty();
+    retCode = 0;
+    return retCode;
+}
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_WRITER_HPP
+#define REC_WRITER_HPP
+
+#include "frame-statistics.hpp"
+#include "image-reading-envelope.hpp"
+#include "logger.hpp"
+#include "rec-file.hpp"
+#include "recording-metadata.hpp"
+#include "trace.hpp"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * RecWriter does all I/O on .rec files on its own thread: serialized envelopes
+ * and the commands to open, close, and prepare files are queued and carried
+ * out in the order they were given. Callers only hold the queue's lock while
+ * adding an entry, so neither the encoders nor the OD4Session's receiver wait
+ * for a slow disk. The queue is bounded; envelopes that do not fit are
+ * dropped and counted. As the following frames of a stream refer to a
+ * dropped one, these are dropped as well until the stream's next key frame
+ * so that a recording never holds frames that cannot be decoded.
+ *
+ * Buffers for serialized envelopes are recycled through buffer() to avoid
+ * allocations per frame. Frames whose buffers outlive the encoder's next
+ * output (see EncodedFrame::buffer) are not copied but referenced until they
+ * are written with writev. The metadata of the streams (see RecordingMetadata)
+ * is written into each file between the frames it refers to; optionally,
+ * the statistics of every frame go into a FrameStatisticsFile next to it.
+ */
+class RecWriter {
+   private:
+    RecWriter(const RecWriter &) = delete;
+    RecWriter(RecWriter &&)      = delete;
+    RecWriter &operator=(const RecWriter &) = delete;
+    RecWriter &operator=(RecWriter &&) = delete;
+
+    static const uint64_t MAX_QUEUED_BYTES{256 * 1024 * 1024};
+    static const std::size_t MAX_BUFFERS{16};
+
+    struct Entry {
+        enum class Type : uint8_t { Open, Close, Prepare, Describe, Write };
+        Type type{Type::Write};
+        // File name for Open, directory for Prepare.
+        std::string name{};
+        std::chrono::steady_clock::time_point requested{};
+        // Serialized envelope, or its head if payload is set.
+        std::string data{};
+        // Frame of an envelope given in parts, written from where it is between data and tail.
+        std::shared_ptr<uint8_t> payload{nullptr};
+        const uint8_t *payloadData{nullptr};
+        std::size_t payloadSize{0};
+        std::string tail{};
+        bool frame{false};
+        FrameRecord record{};
+        std::unique_ptr<recorder::StreamSettings> settings{nullptr};
+
+        std::size_t bytes() const noexcept {
+            return data.size() + payloadSize + tail.size();
+        }
+    };
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param started Start of the program to report the time to the first frame.
+     * @param checkpoint Interval in microseconds to make the file durable; 0 disables checkpoints.
+     * @param preallocate Bytes to reserve on disk for each file.
+     * @param statistics true to write the statistics of each frame into <file>.stats.
+     */
+    RecWriter(std::chrono::steady_clock::time_point started, int64_t checkpoint, uint64_t preallocate, bool statistics) noexcept
+        : m_started(started)
+        , m_checkpoint(checkpoint)
+        , m_preallocate(preallocate)
+        , m_statistics(statistics) {
+        m_thread = std::thread(&RecWriter::run, this);
+    }
+
+    ~RecWriter() {
+        stop(std::chrono::steady_clock::time_point::max());
+    }
+
+    /**
+     * This method queues creating a file and writing into it from now on; a
+     * file that is open is closed before.
+     *
+     * @param requested Time the recording was requested.
+     */
+    void open(const std::string &name, std::chrono::steady_clock::time_point requested) noexcept {
+        Entry e;
+        e.type = Entry::Type::Open;
+        e.name = name;
+        e.requested = requested;
+        m_recording = true;
+        push(std::move(e));
+    }
+
+    /**
+     * This method queues closing the file.
+     */
+    void close() noexcept {
+        Entry e;
+        e.type = Entry::Type::Close;
+        m_recording = false;
+        push(std::move(e));
+    }
+
+    /**
+     * This method queues preparing the next file in the given directory ahead
+     * of time, and again after every close, so that open() only needs to name it.
+     */
+    void prepare(const std::string &directory) noexcept {
+        Entry e;
+        e.type = Entry::Type::Prepare;
+        e.name = directory;
+        push(std::move(e));
+    }
+
+    /**
+     * This method queues new settings of the stream with the given senderStamp
+     * for the metadata in the file.
+     */
+    void describe(uint32_t senderStamp, const recorder::StreamSettings &settings) noexcept {
+        Entry e;
+        e.type = Entry::Type::Describe;
+        e.record.senderStamp = senderStamp;
+        e.settings.reset(new recorder::StreamSettings(settings));
+        push(std::move(e));
+    }
+
+    /**
+     * @return true if envelopes given to write() are written into a file.
+     */
+    bool recording() const noexcept {
+        return m_recording.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return Empty buffer for a serialized envelope, possibly with capacity from an earlier one.
+     */
+    std::string buffer() noexcept {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        std::string b;
+        if (!m_buffers.empty()) {
+            b = std::move(m_buffers.back());
+            m_buffers.pop_back();
+            b.clear();
+        }
+        return b;
+    }
+
+    /**
+     * This method queues a serialized envelope for a frame; envelopes carrying
+     * an encoded frame, i.e., no repeat, are counted.
+     *
+     * @param record Description of the frame for the metadata and for tracing.
+     * @return false if the envelope was dropped as the queue is full or the
+     *         stream waits for a key frame after an earlier drop.
+     */
+    bool write(std::string &&data, const FrameRecord &record) noexcept {
+        Entry e;
+        e.data = std::move(data);
+        e.frame = !record.repeat;
+        e.record = record;
+        return enqueue(std::move(e));
+    }
+
+    /**
+     * This method queues an envelope carrying an encoded frame. If owner keeps
+     * the frame alive, only the envelope around it is copied and the frame is
+     * written from where it is; otherwise, the whole envelope is serialized
+     * into a recycled buffer as the frame might be overwritten.
+     *
+     * @param owner Buffer holding the frame referenced by envelope, or nullptr.
+     * @return false if the envelope was dropped; see write().
+     */
+    bool write(const ImageReadingEnvelope &envelope, const std::shared_ptr<uint8_t> &owner, const FrameRecord &record) noexcept {
+        Entry e;
+        e.frame = !record.repeat;
+        e.record = record;
+        e.data = buffer();
+        if (owner) {
+            struct iovec iov[3];
+            envelope.toIovec(iov);
+            e.data.assign(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+            e.payload = owner;
+            e.payloadData = static_cast<const uint8_t*>(iov[1].iov_base);
+            e.payloadSize = iov[1].iov_len;
+            e.tail = buffer();
+            e.tail.assign(static_cast<const char*>(iov[2].iov_base), iov[2].iov_len);
+        }
+        else {
+            envelope.serialize(e.data);
+        }
+        return enqueue(std::move(e));
+    }
+
+    /**
+     * This method counts a frame that could not be serialized.
+     */
+    void failed() noexcept {
+        m_framesFailed++;
+    }
+
+    /**
+     * This method writes all queued entries until the given deadline, drops
+     * the remaining ones, closes the file, and stops the thread.
+     */
+    void stop(std::chrono::steady_clock::time_point deadline) noexcept {
+        if (m_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lck(m_mutex);
+                m_stopping = true;
+                m_deadline = deadline;
+            }
+            m_condition.notify_all();
+            m_thread.join();
+        }
+    }
+
+    uint64_t framesWritten() const noexcept {
+        return m_framesWritten;
+    }
+
+    uint64_t framesFailed() const noexcept {
+        return m_framesFailed;
+    }
+
+    /**
+     * @return Number of frames that were not written as the writer fell behind.
+     */
+    uint64_t framesDropped() const noexcept {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        return m_framesDropped;
+    }
+
+   private:
+    /**
+     * This method queues a frame if it fits into the queue.
+     *
+     * @return false if the frame was dropped.
+     */
+    bool enqueue(Entry &&e) noexcept {
+        const FrameRecord record{e.record};
+
+        // Frames after a dropped one refer to it; drop them as well until the stream's next key frame.
+        bool dropped{false};
+        bool gapStarted{false};
+        uint64_t gapLength{0};
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            auto gap = m_gaps.find(record.senderStamp);
+            if ( e.frame && (m_gaps.end() != gap) && !record.keyFrame ) {
+                dropped = true;
+                gap->second++;
+            }
+            else if (m_queuedBytes + e.bytes() > MAX_QUEUED_BYTES) {
+                dropped = true;
+                if (e.frame) {
+                    gapStarted = (m_gaps.end() == gap);
+                    m_gaps[record.senderStamp]++;
+                }
+            }
+            else {
+                if (e.frame && (m_gaps.end() != gap)) {
+                    gapLength = gap->second;
+                    m_gaps.erase(gap);
+                }
+                m_queuedBytes += e.bytes();
+                m_queue.push_back(std::move(e));
+            }
+            m_framesDropped += (dropped && !record.repeat) ? 1 : 0;
+        }
+        if (gapStarted) {
+            Logger::instance().log(LogLevel::Warning, "Writer fell behind by {} MB; dropping the frames of senderStamp {} from {} until its next key frame.",
+                                   MAX_QUEUED_BYTES / (1024 * 1024), record.senderStamp, record.timeStamp);
+        }
+        if (0 < gapLength) {
+            Logger::instance().log(LogLevel::Info, "Writing the frames of senderStamp {} again from key frame {} after dropping {} frames.", record.senderStamp, record.timeStamp, gapLength);
+        }
+        if (!dropped) {
+            m_condition.notify_all();
+        }
+        return !dropped;
+    }
+
+    void push(Entry &&e) noexcept {
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_queue.push_back(std::move(e));
+        }
+        m_condition.notify_all();
+    }
+
+    void run() noexcept {
+        Tracer::instance().nameThread("writer");
+        std::unique_lock<std::mutex> lck(m_mutex);
+        while (true) {
+            m_condition.wait(lck, [this](){ return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty() || (m_stopping && (std::chrono::steady_clock::now() >= m_deadline))) {
+                break;
+            }
+            Entry e{std::move(m_queue.front())};
+            m_queue.pop_front();
+            m_queuedBytes -= e.bytes();
+            lck.unlock();
+            process(e);
+            // Return the frame's buffer to its owner without holding the lock.
+            e.payload.reset();
+            lck.lock();
+            if ( (0 < e.data.capacity()) && (m_buffers.size() < MAX_BUFFERS) ) {
+                m_buffers.push_back(std::move(e.data));
+            }
+            if ( (0 < e.tail.capacity()) && (m_buffers.size() < MAX_BUFFERS) ) {
+                m_buffers.push_back(std::move(e.tail));
+            }
+        }
+        for (const auto &e : m_queue) {
+            m_framesDropped += (e.frame ? 1 : 0);
+        }
+        m_queue.clear();
+        m_queuedBytes = 0;
+        lck.unlock();
+        closeFile();
+        m_spare.reset();
+    }
+
+    void process(Entry &e) noexcept {
+        switch (e.type) {
+            case Entry::Type::Open: {
+                closeFile();
+                if (m_spare && m_spare->publish(e.name)) {
+                    m_file = std::move(m_spare);
+                }
+                else {
+                    m_file.reset(new RecFile(e.name));
+                    m_file->preallocate(m_preallocate);
+                }
+                if (m_file->good()) {
+                    Logger::instance().log(LogLevel::Info, "Created {}.", e.name);
+                }
+                else {
+                    Logger::instance().log(LogLevel::Error, "Failed to create {}.", e.name);
+                }
+                if (m_statistics) {
+                    m_statisticsFile.reset(new FrameStatisticsFile(recStatsName(e.name)));
+                    if (!m_statisticsFile->good()) {
+                        Logger::instance().log(LogLevel::Warning, "Failed to create {}.", recStatsName(e.name));
+                    }
+                }
+                m_requested = e.requested;
+                m_firstFramePending = true;
+                m_lastCheckpoint = std::chrono::steady_clock::now();
+                m_metadata.begin();
+                break;
+            }
+            case Entry::Type::Close: {
+                closeFile();
+                prepareSpare();
+                break;
+            }
+            case Entry::Type::Prepare: {
+                m_spareDirectory = e.name;
+                m_keepSpare = true;
+                prepareSpare();
+                break;
+            }
+            case Entry::Type::Describe: {
+                const std::string CHANGE{m_metadata.describe(e.record.senderStamp, *e.settings)};
+                if (!CHANGE.empty() && m_file && m_file->good()) {
+                    m_file->write(CHANGE);
+                }
+                break;
+            }
+            case Entry::Type::Write: {
+                if (m_file && m_file->good()) {
+                    bool written{false};
+                    {
+                        TraceScope trace(TraceSpan::Write, e.record.timeStamp);
+                        m_metadata.frame(e.record, m_pending);
+                        for (const auto &p : m_pending) {
+                            m_file->write(p);
+                        }
+                        m_pending.clear();
+                        if (e.payload) {
+                            struct iovec iov[3];
+                            iov[0].iov_base = const_cast<char*>(e.data.data());
+                            iov[0].iov_len = e.data.size();
+                            iov[1].iov_base = const_cast<uint8_t*>(e.payloadData);
+                            iov[1].iov_len = e.payloadSize;
+                            iov[2].iov_base = const_cast<char*>(e.tail.data());
+                            iov[2].iov_len = e.tail.size();
+                            written = m_file->write(iov, 3);
+                        }
+                        else {
+                            written = m_file->write(e.data);
+                        }
+                    }
+                    if (e.frame) {
+                        (written ? m_framesWritten : m_framesFailed)++;
+                    }
+                    if (written && m_statisticsFile) {
+                        appendStatistics(e.record);
+                    }
+                    if (written && e.frame && m_firstFramePending) {
+                        const auto NOW{std::chrono::steady_clock::now()};
+                        Logger::instance().log(LogLevel::Info, "Recorded first frame into {} {} ms after it was requested ({} ms after start).", m_file->name(),
+                                               std::chrono::duration_cast<std::chrono::milliseconds>(NOW - m_requested).count(),
+                                               std::chrono::duration_cast<std::chrono::milliseconds>(NOW - m_started).count());
+                        m_firstFramePending = false;
+                    }
+
+                    // Periodically sync the file to disk so that an interrupted recording can be repaired quickly.
+                    const auto NOW{std::chrono::steady_clock::now()};
+                    if ( (0 < m_checkpoint) && (std::chrono::duration_cast<std::chrono::microseconds>(NOW - m_lastCheckpoint).count() >= m_checkpoint) ) {
+                        m_file->checkpoint();
+                        m_lastCheckpoint = NOW;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    void closeFile() noexcept {
+        if (m_file) {
+            if (m_file->good()) {
+                m_metadata.end(m_pending);
+                for (const auto &p : m_pending) {
+                    m_file->write(p);
+                }
+                m_pending.clear();
+                m_file->close();
+                Logger::instance().log(LogLevel::Info, "Closed {}.", m_file->name());
+            }
+            m_file.reset();
+        }
+        m_statisticsFile.reset();
+    }
+
+    void appendStatistics(const FrameRecord &record) noexcept {
+        FrameStatistics s;
+        std::memset(&s, 0, sizeof(s));
+        s.timeStamp = record.timeStamp;
+        s.senderStamp = record.senderStamp;
+        s.size = record.size;
+        s.encodingDuration = static_cast<uint32_t>(std::max<int64_t>(record.encodingDuration, 0));
+        s.queueDelay = static_cast<uint32_t>(std::max<int64_t>(record.queueDelay, 0));
+        s.qIndex = static_cast<int16_t>(record.qIndex);
+        s.type = record.repeat ? FrameStatistics::REPEAT : (record.keyFrame ? FrameStatistics::KEY : FrameStatistics::INTER);
+        m_statisticsFile->append(s);
+    }
+
+    void prepareSpare() noexcept {
+        if (m_keepSpare && !m_spare) {
+            m_spare = RecFile::prepare(m_spareDirectory, m_preallocate);
+        }
+    }
+
+   private:
+    std::chrono::steady_clock::time_point m_started;
+    int64_t m_checkpoint{0};
+    uint64_t m_preallocate{0};
+    bool m_statistics{false};
+    std::atomic<bool> m_recording{false};
+
+    // Accessed by the thread only.
+    std::unique_ptr<RecFile> m_file{nullptr};
+    std::unique_ptr<RecFile> m_spare{nullptr};
+    std::unique_ptr<FrameStatisticsFile> m_statisticsFile{nullptr};
+    std::string m_spareDirectory{};
+    bool m_keepSpare{false};
+    std::chrono::steady_clock::time_point m_requested{};
+    bool m_firstFramePending{false};
+    std::chrono::steady_clock::time_point m_lastCheckpoint{};
+    RecordingMetadata m_metadata{};
+    std::vector<std::string> m_pending{};
+
+    std::atomic<uint64_t> m_framesWritten{0};
+    std::atomic<uint64_t> m_framesFailed{0};
+
+    mutable std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::deque<Entry> m_queue{};
+    uint64_t m_queuedBytes{0};
+    std::vector<std::string> m_buffers{};
+    uint64_t m_framesDropped{0};
+    // Frames dropped per senderStamp since the stream's last key frame that was queued.
+    std::map<uint32_t, uint64_t> m_gaps{};
+    bool m_stopping{false};
+    std::chrono::steady_clock::time_point m_deadline{};
+    std::thread m_thread{};
+};
+
+#endif
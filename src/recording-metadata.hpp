@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDING_METADATA_HPP
+#define RECORDING_METADATA_HPP
+
+#include "cluon-complete.hpp"
+#include "recorder-message-set.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef RECORDER_VERSION
+#define RECORDER_VERSION "unknown"
+#endif
+
+/**
+ * Description of an Envelope written for a stream.
+ */
+struct FrameRecord {
+    uint32_t senderStamp{0};
+    int64_t timeStamp{0}; // Sample time stamp in microseconds.
+    uint32_t size{0}; // Size of the encoded frame.
+    bool keyFrame{false};
+    bool repeat{false}; // TimeStamp for a skipped frame instead of an ImageReading.
+    int64_t encodingDuration{0}; // Microseconds.
+    int64_t queueDelay{0}; // Microseconds from the sample time stamp until the encoder started.
+    int32_t qIndex{-1}; // Quantizer as found in the encoded frame; -1 if unknown.
+};
+
+/**
+ * RecordingMetadata turns the settings and the statistics of all streams of a
+ * recording into Envelopes for the .rec file: recorder.StreamSettings are
+ * written before the first frame of a stream in each file and again whenever
+ * they change, and recorder.GopStatistics after the last frame of each GOP.
+ *
+ * The Envelopes take their sample time stamps from the neighbouring frames of
+ * the same stream, so tools that process a recording ordered by sample time
+ * see the metadata before the frames it refers to.
+ */
+class RecordingMetadata {
+   private:
+    RecordingMetadata(const RecordingMetadata &) = delete;
+    RecordingMetadata(RecordingMetadata &&)      = delete;
+    RecordingMetadata &operator=(const RecordingMetadata &) = delete;
+    RecordingMetadata &operator=(RecordingMetadata &&) = delete;
+
+    // GOPs shorter than this are combined so that all-intra streams do not add an Envelope per frame.
+    static const int64_t MIN_PERIOD{1000 * 1000};
+
+   public:
+    RecordingMetadata() = default;
+
+    /**
+     * This method starts a new file: the settings of all streams are written
+     * again and the statistics start over.
+     */
+    void begin() noexcept {
+        for (auto &s : m_streams) {
+            s.second.settingsPending = true;
+            s.second.statistics = recorder::GopStatistics();
+        }
+    }
+
+    /**
+     * This method sets the settings of a stream.
+     *
+     * @return Envelope announcing the change if the file already holds frames of the stream, empty otherwise.
+     */
+    std::string describe(uint32_t senderStamp, const recorder::StreamSettings &settings) noexcept {
+        Stream &s{m_streams[senderStamp]};
+        s.settings = settings;
+        s.settings.recorderVersion(RECORDER_VERSION);
+        s.described = true;
+        if (s.settingsPending) {
+            return "";
+        }
+        return serialize(s.settings, senderStamp, s.lastTimeStamp);
+    }
+
+    /**
+     * This method accounts for a frame about to be written and appends the
+     * Envelopes that need to precede it to out.
+     */
+    void frame(const FrameRecord &record, std::vector<std::string> &out) noexcept {
+        Stream &s{m_streams[record.senderStamp]};
+        if (s.described && s.settingsPending) {
+            out.push_back(serialize(s.settings, record.senderStamp, record.timeStamp));
+        }
+        s.settingsPending = false;
+
+        recorder::GopStatistics &g{s.statistics};
+        const bool EMPTY{0 == (g.frames() + g.repeatedFrames())};
+        if ( !EMPTY && record.keyFrame && !record.repeat && (record.timeStamp - g.firstSampleTimeStamp() >= MIN_PERIOD) ) {
+            out.push_back(serialize(g, record.senderStamp, g.lastSampleTimeStamp()));
+            g = recorder::GopStatistics();
+        }
+
+        if (0 == (g.frames() + g.repeatedFrames())) {
+            g.firstSampleTimeStamp(record.timeStamp);
+        }
+        g.lastSampleTimeStamp(record.timeStamp);
+        if (record.repeat) {
+            g.repeatedFrames(g.repeatedFrames() + 1);
+        }
+        else {
+            const uint32_t DURATION{static_cast<uint32_t>(std::max<int64_t>(record.encodingDuration, 0))};
+            // The mean is kept as sum until the statistics are written.
+            g.meanEncodingDuration(g.meanEncodingDuration() + DURATION);
+            g.maxEncodingDuration(std::max(g.maxEncodingDuration(), DURATION));
+            g.frames(g.frames() + 1);
+            g.gops(g.gops() + (record.keyFrame ? 1 : 0));
+            g.bytes(g.bytes() + record.size);
+            g.maxFrameSize(std::max(g.maxFrameSize(), record.size));
+        }
+        s.lastTimeStamp = record.timeStamp;
+    }
+
+    /**
+     * This method appends the statistics of all incomplete GOPs to out before
+     * the file is closed.
+     */
+    void end(std::vector<std::string> &out) noexcept {
+        for (auto &s : m_streams) {
+            recorder::GopStatistics &g{s.second.statistics};
+            if (0 < (g.frames() + g.repeatedFrames())) {
+                out.push_back(serialize(g, s.first, g.lastSampleTimeStamp()));
+                g = recorder::GopStatistics();
+            }
+            s.second.settingsPending = true;
+        }
+    }
+
+   private:
+    static std::string serialize(recorder::StreamSettings &settings, uint32_t senderStamp, int64_t timeStamp) noexcept {
+        return envelope(settings, senderStamp, timeStamp);
+    }
+
+    static std::string serialize(recorder::GopStatistics g, uint32_t senderStamp, int64_t timeStamp) noexcept {
+        if (0 < g.frames()) {
+            g.meanEncodingDuration(g.meanEncodingDuration() / g.frames());
+        }
+        return envelope(g, senderStamp, timeStamp);
+    }
+
+    template <typename T>
+    static std::string envelope(T &message, uint32_t senderStamp, int64_t timeStamp) noexcept {
+        cluon::ToProtoVisitor protoEncoder;
+        message.accept(protoEncoder);
+        cluon::data::Envelope e;
+        e.dataType(T::ID()).serializedData(protoEncoder.encodedData()).sent(cluon::time::now()).sampleTimeStamp(cluon::time::fromMicroseconds(timeStamp)).senderStamp(senderStamp);
+        return cluon::serializeEnvelope(std::move(e));
+    }
+
+   private:
+    struct Stream {
+        recorder::StreamSettings settings{};
+        bool described{false};
+        bool settingsPending{true};
+        recorder::GopStatistics statistics{};
+        int64_t lastTimeStamp{0};
+    };
+
+    std::map<uint32_t, Stream> m_streams{};
+};
+
+#endif
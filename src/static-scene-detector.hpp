@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATIC_SCENE_DETECTOR_HPP
+#define STATIC_SCENE_DETECTOR_HPP
+
+#include "frame.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/**
+ * StaticSceneDetector decides whether a frame may be skipped because it does
+ * not differ from the last encoded frame. It compares every fourth row of the
+ * luma plane (SAD with SSE2) and skips the frame if the mean absolute
+ * difference per pixel is below the threshold. To bound the time between two
+ * encoded frames, a frame is never skipped if the last encoded one is older
+ * than maxSkip. As the comparison is always against the last encoded frame,
+ * slow changes accumulate until they exceed the threshold.
+ */
+class StaticSceneDetector {
+   private:
+    StaticSceneDetector(const StaticSceneDetector &) = delete;
+    StaticSceneDetector(StaticSceneDetector &&)      = delete;
+    StaticSceneDetector &operator=(const StaticSceneDetector &) = delete;
+    StaticSceneDetector &operator=(StaticSceneDetector &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param width Width of the frames.
+     * @param height Height of the frames.
+     * @param threshold Mean absolute luma difference per pixel below which a frame is static.
+     * @param maxSkip Maximum time in microseconds between two encoded frames.
+     */
+    StaticSceneDetector(uint32_t width, uint32_t height, float threshold, int64_t maxSkip) noexcept
+        : m_width(width)
+        , m_rows((height + ROW_STEP - 1) / ROW_STEP)
+        , m_threshold(static_cast<uint64_t>(threshold * static_cast<float>(width) * static_cast<float>((height + ROW_STEP - 1) / ROW_STEP)))
+        , m_maxSkip(maxSkip)
+        , m_reference(static_cast<std::size_t>(width) * ((height + ROW_STEP - 1) / ROW_STEP)) {}
+
+    /**
+     * @return true if the frame may be skipped; otherwise, the frame becomes the new reference.
+     */
+    bool skip(const Frame &frame) noexcept {
+        const uint8_t *luma{frame.plane(0)};
+        if (m_hasReference && (frame.timeStamp - m_lastEncoded < m_maxSkip)) {
+            uint64_t sum{0};
+            for (uint32_t r{0}; (r < m_rows) && (sum < m_threshold); r++) {
+                sum += sad(luma + static_cast<std::size_t>(r * ROW_STEP) * frame.pitch[0], &m_reference[static_cast<std::size_t>(r) * m_width], m_width);
+            }
+            if (sum < m_threshold) {
+                return true;
+            }
+        }
+
+        for (uint32_t r{0}; r < m_rows; r++) {
+            std::memcpy(&m_reference[static_cast<std::size_t>(r) * m_width], luma + static_cast<std::size_t>(r * ROW_STEP) * frame.pitch[0], m_width);
+        }
+        m_hasReference = true;
+        m_lastEncoded = frame.timeStamp;
+        return false;
+    }
+
+   private:
+    static uint64_t sad(const uint8_t *a, const uint8_t *b, uint32_t length) noexcept {
+        uint64_t sum{0};
+        uint32_t i{0};
+#if defined(__SSE2__) && defined(__x86_64__)
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            const __m128i A = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(A, B));
+        }
+        sum = static_cast<uint64_t>(_mm_cvtsi128_si64(acc)) + static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+#endif
+        for (; i < length; i++) {
+            sum += static_cast<uint64_t>(std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+        }
+        return sum;
+    }
+
+   private:
+    static const uint32_t ROW_STEP{4};
+
+    uint32_t m_width{0};
+    uint32_t m_rows{0};
+    uint64_t m_threshold{0};
+    int64_t m_maxSkip{0};
+    std::vector<uint8_t> m_reference{};
+    bool m_hasReference{false};
+    int64_t m_lastEncoded{0};
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_PLACEMENT_HPP
+#define THREAD_PLACEMENT_HPP
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/**
+ * This function parses a list of CPUs like "2", "2,3", or "4-7,12".
+ *
+ * @return false if the list is empty or malformed.
+ */
+inline bool parseCpuList(const std::string &list, cpu_set_t &cpus) noexcept {
+    CPU_ZERO(&cpus);
+    std::stringstream sstr(list);
+    std::string range;
+    bool retVal{false};
+    while (std::getline(sstr, range, ',')) {
+        const std::size_t DASH{range.find('-')};
+        try {
+            const int32_t FIRST{std::stoi(range.substr(0, DASH))};
+            const int32_t LAST{(std::string::npos != DASH) ? std::stoi(range.substr(DASH + 1)) : FIRST};
+            if ( (FIRST < 0) || (LAST < FIRST) || (LAST >= CPU_SETSIZE) ) {
+                return false;
+            }
+            for (int32_t cpu{FIRST}; cpu <= LAST; cpu++) {
+                CPU_SET(cpu, &cpus);
+            }
+            retVal = true;
+        }
+        catch (...) {
+            return false;
+        }
+    }
+    return retVal;
+}
+
+/**
+ * ThreadPlacement describes where and how a stage's threads are scheduled.
+ */
+struct ThreadPlacement {
+    // CPUs as accepted by parseCpuList; empty leaves the affinity unchanged.
+    std::string cpus{};
+    // SCHED_FIFO priority from 1 to 99; 0 leaves the scheduling policy unchanged.
+    int32_t priority{0};
+
+    bool empty() const noexcept {
+        return cpus.empty() && (0 == priority);
+    }
+};
+
+/**
+ * This function applies a placement to a thread; threads that this thread
+ * creates afterwards inherit it. SCHED_FIFO needs CAP_SYS_NICE or an
+ * RLIMIT_RTPRIO of at least the given priority.
+ *
+ * @return true on success.
+ */
+inline bool placeThread(pthread_t thread, const ThreadPlacement &placement) noexcept {
+    bool retVal{true};
+    if (!placement.cpus.empty()) {
+        cpu_set_t set;
+        retVal = parseCpuList(placement.cpus, set) && (0 == ::pthread_setaffinity_np(thread, sizeof(set), &set));
+    }
+    if (0 < placement.priority) {
+        struct sched_param parameter;
+        parameter.sched_priority = placement.priority;
+        retVal = (0 == ::pthread_setschedparam(thread, SCHED_FIFO, &parameter)) && retVal;
+    }
+    return retVal;
+}
+
+inline bool placeCurrentThread(const ThreadPlacement &placement) noexcept {
+    return placeThread(::pthread_self(), placement);
+}
+
+/**
+ * ScopedThreadPlacement applies a placement to the calling thread and
+ * restores the previous one when it goes out of scope. This places threads
+ * that are started by third-party code, which inherit the placement of the
+ * thread creating them.
+ */
+class ScopedThreadPlacement {
+   private:
+    ScopedThreadPlacement(const ScopedThreadPlacement &) = delete;
+    ScopedThreadPlacement(ScopedThreadPlacement &&)      = delete;
+    ScopedThreadPlacement &operator=(const ScopedThreadPlacement &) = delete;
+    ScopedThreadPlacement &operator=(ScopedThreadPlacement &&) = delete;
+
+   public:
+    explicit ScopedThreadPlacement(const ThreadPlacement &placement) noexcept
+        : m_active(!placement.empty()) {
+        if (m_active) {
+            ::pthread_getaffinity_np(::pthread_self(), sizeof(m_cpus), &m_cpus);
+            ::pthread_getschedparam(::pthread_self(), &m_policy, &m_parameter);
+            m_good = placeCurrentThread(placement);
+        }
+    }
+
+    ~ScopedThreadPlacement() {
+        if (m_active) {
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(m_cpus), &m_cpus);
+            ::pthread_setschedparam(::pthread_self(), m_policy, &m_parameter);
+        }
+    }
+
+    bool good() const noexcept {
+        return m_good;
+    }
+
+   private:
+    bool m_active{false};
+    bool m_good{true};
+    cpu_set_t m_cpus{};
+    int m_policy{SCHED_OTHER};
+    struct sched_param m_parameter{};
+};
+
+/**
+ * This function makes the kernel allocate the memory of the calling thread,
+ * and of the threads it creates afterwards, on the given NUMA node whenever
+ * possible; it needs to be called before the frame buffers are allocated.
+ *
+ * @return true on success.
+ */
+inline bool preferNumaNode(uint32_t node) noexcept {
+    const uint32_t BITS_PER_WORD{sizeof(unsigned long) * 8};
+    unsigned long nodes[4]{0, 0, 0, 0};
+    if (node >= sizeof(nodes) * 8) {
+        return false;
+    }
+    nodes[node / BITS_PER_WORD] = 1UL << (node % BITS_PER_WORD);
+    return 0 == ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, sizeof(nodes) * 8);
+}
+
+#endif
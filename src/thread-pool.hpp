@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include "thread-placement.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * ThreadPool runs tasks on a fixed number of worker threads.
+ */
+class ThreadPool {
+   private:
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool(ThreadPool &&)      = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param numberOfThreads Number of worker threads; 0 runs all tasks on the calling thread.
+     */
+    explicit ThreadPool(uint32_t numberOfThreads) noexcept {
+        for (uint32_t i{0}; i < numberOfThreads; i++) {
+            m_threads.emplace_back(std::thread(&ThreadPool::run, this));
+        }
+    }
+
+    ~ThreadPool() noexcept {
+        {
+            std::lock_guard<std::mutex> lck(m_tasksMutex);
+            m_stop = true;
+        }
+        m_tasksCondition.notify_all();
+        for (auto &t : m_threads) {
+            t.join();
+        }
+    }
+
+    /**
+     * @return Number of worker threads.
+     */
+    uint32_t size() const noexcept {
+        return static_cast<uint32_t>(m_threads.size());
+    }
+
+    /**
+     * This method applies a placement to all worker threads.
+     *
+     * @return true on success.
+     */
+    bool place(const ThreadPlacement &placement) noexcept {
+        bool retVal{true};
+        for (auto &t : m_threads) {
+            retVal = placeThread(t.native_handle(), placement) && retVal;
+        }
+        return retVal;
+    }
+
+    /**
+     * This method enqueues a task to be run asynchronously.
+     */
+    void submit(std::function<void()> &&task) noexcept {
+        if (m_threads.empty()) {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lck(m_tasksMutex);
+            m_tasks.emplace_back(std::move(task));
+        }
+        m_tasksCondition.notify_one();
+    }
+
+    /**
+     * This method runs task(0) ... task(count-1) in parallel and returns when
+     * all have finished; the calling thread takes part in the work.
+     */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)> &task) noexcept {
+        struct Job {
+            std::atomic<uint32_t> next{0};
+            std::atomic<uint32_t> done{0};
+            std::mutex mutex{};
+            std::condition_variable finished{};
+        };
+        auto job = std::make_shared<Job>();
+        auto work = [job, count, &task]() {
+            for (uint32_t i{job->next++}; i < count; i = job->next++) {
+                task(i);
+                if (count == ++(job->done)) {
+                    std::lock_guard<std::mutex> lck(job->mutex);
+                    job->finished.notify_all();
+                }
+            }
+        };
+
+        const uint32_t HELPERS{std::min(size(), (0 < count) ? count - 1 : 0)};
+        for (uint32_t i{0}; i < HELPERS; i++) {
+            submit(work);
+        }
+        work();
+
+        std::unique_lock<std::mutex> lck(job->mutex);
+        job->finished.wait(lck, [&job, count](){ return count == job->done.load(); });
+    }
+
+   private:
+    void run() noexcept {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lck(m_tasksMutex);
+                m_tasksCondition.wait(lck, [this](){ return m_stop || !m_tasks.empty(); });
+                if (m_stop && m_tasks.empty()) {
+                    break;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+   private:
+    std::vector<std::thread> m_threads{};
+    std::mutex m_tasksMutex{};
+    std::condition_variable m_tasksCondition{};
+    std::deque<std::function<void()>> m_tasks{};
+    bool m_stop{false};
+};
+
+#endif
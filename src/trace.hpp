@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "logger.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Operations of the recording hot path that are traced.
+ */
+enum class TraceSpan : uint8_t {
+    Wait,
+    Lock,
+    Preprocess,
+    Encode,
+    GetOutput,
+    Serialize,
+    Write,
+};
+
+inline const char *traceSpanName(TraceSpan span) noexcept {
+    switch (span) {
+        case TraceSpan::Wait: return "wait";
+        case TraceSpan::Lock: return "lock";
+        case TraceSpan::Preprocess: return "preprocess";
+        case TraceSpan::Encode: return "encode";
+        case TraceSpan::GetOutput: return "get-output";
+        case TraceSpan::Serialize: return "serialize";
+        case TraceSpan::Write: return "write";
+    }
+    return "unknown";
+}
+
+/**
+ * TraceBuffer holds the most recent spans of one thread. Only the owning
+ * thread writes; a dump reads concurrently and discards the slots that were
+ * overwritten while it copied them. Slots consist of relaxed atomics, which
+ * compile to plain loads and stores.
+ */
+class TraceBuffer {
+   private:
+    TraceBuffer(const TraceBuffer &) = delete;
+    TraceBuffer(TraceBuffer &&)      = delete;
+    TraceBuffer &operator=(const TraceBuffer &) = delete;
+    TraceBuffer &operator=(TraceBuffer &&) = delete;
+
+   public:
+    struct Event {
+        int64_t begin{0};    // Nanoseconds on the steady clock.
+        int64_t duration{0}; // Nanoseconds.
+        int64_t frame{0};    // Sample time stamp of the frame in microseconds; 0 if unknown.
+        TraceSpan span{TraceSpan::Wait};
+    };
+
+    TraceBuffer(uint32_t id, const std::string &name) noexcept
+        : m_id(id)
+        , m_name(name) {}
+
+    uint32_t id() const noexcept {
+        return m_id;
+    }
+
+    const std::string &name() const noexcept {
+        return m_name;
+    }
+
+    void name(const std::string &name) noexcept {
+        m_name = name;
+    }
+
+    void record(TraceSpan span, int64_t begin, int64_t duration, int64_t frame) noexcept {
+        const uint64_t POSITION{m_next.load(std::memory_order_relaxed)};
+        Slot &s{m_slots[POSITION & (CAPACITY - 1)]};
+        // Mark the slot as being written before changing it so that a concurrent dump skips it.
+        s.position.store(~uint64_t{0}, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.begin.store(begin, std::memory_order_relaxed);
+        s.duration.store(duration, std::memory_order_relaxed);
+        s.frame.store(frame, std::memory_order_relaxed);
+        s.span.store(static_cast<uint8_t>(span), std::memory_order_relaxed);
+        s.position.store(POSITION, std::memory_order_release);
+        m_next.store(POSITION + 1, std::memory_order_release);
+    }
+
+    /**
+     * @return Copy of the spans in the buffer, oldest first.
+     */
+    std::vector<Event> snapshot() const noexcept {
+        std::vector<Event> events;
+        const uint64_t NEXT{m_next.load(std::memory_order_acquire)};
+        const uint64_t FIRST{(NEXT > CAPACITY) ? NEXT - CAPACITY : 0};
+        events.reserve(NEXT - FIRST);
+        for (uint64_t p{FIRST}; p < NEXT; p++) {
+            const Slot &s{m_slots[p & (CAPACITY - 1)]};
+            if (p != s.position.load(std::memory_order_acquire)) {
+                continue;
+            }
+            Event e;
+            e.begin = s.begin.load(std::memory_order_relaxed);
+            e.duration = s.duration.load(std::memory_order_relaxed);
+            e.frame = s.frame.load(std::memory_order_relaxed);
+            e.span = static_cast<TraceSpan>(s.span.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (p == s.position.load(std::memory_order_relaxed)) {
+                events.push_back(e);
+            }
+        }
+        return events;
+    }
+
+   private:
+    static const uint64_t CAPACITY{8192};
+    struct Slot {
+        std::atomic<uint64_t> position{~uint64_t{0}};
+        std::atomic<int64_t> begin{0};
+        std::atomic<int64_t> duration{0};
+        std::atomic<int64_t> frame{0};
+        std::atomic<uint8_t> span{0};
+    };
+
+    uint32_t m_id{0};
+    std::string m_name;
+    std::atomic<uint64_t> m_next{0};
+    std::unique_ptr<Slot[]> m_slots{new Slot[CAPACITY]};
+};
+
+/**
+ * Tracer collects the spans of all threads in per-thread ring buffers and
+ * writes them as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on
+ * SIGUSR1 or when an anomaly is reported. Files are written by a background
+ * thread at most once per second, so the traced threads only pay for two
+ * clock reads and a few stores per span.
+ */
+class Tracer {
+   private:
+    Tracer(const Tracer &) = delete;
+    Tracer(Tracer &&)      = delete;
+    Tracer &operator=(const Tracer &) = delete;
+    Tracer &operator=(Tracer &&) = delete;
+
+   public:
+    static Tracer &instance() noexcept {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    ~Tracer() {
+        m_running = false;
+        if (m_dumper.joinable()) {
+            m_dumper.join();
+        }
+    }
+
+    /**
+     * This method enables tracing; traces are written to <prefix>-<n>.json.
+     * It needs to be called before any other thread is started as SIGUSR1 is
+     * blocked for all threads but received synchronously by the dump thread;
+     * this way, the signal does not interrupt blocking calls of the hot path.
+     */
+    void enable(const std::string &prefix) noexcept {
+        if (m_enabled.exchange(true)) {
+            return;
+        }
+        m_prefix = prefix;
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        m_running = true;
+        m_dumper = std::thread(&Tracer::run, this);
+    }
+
+    bool enabled() const noexcept {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * This method names the calling thread in the traces.
+     */
+    void nameThread(const std::string &name) noexcept {
+        if (enabled()) {
+            TraceBuffer *b{buffer()};
+            std::lock_guard<std::mutex> lck(m_buffersMutex);
+            b->name(name);
+        }
+    }
+
+    void record(TraceSpan span, int64_t begin, int64_t duration, int64_t frame) noexcept {
+        buffer()->record(span, begin, duration, frame);
+    }
+
+    /**
+     * This method requests a dump of the recent spans, e.g., because encoding
+     * took too long; it is safe to call from the hot path.
+     */
+    void anomaly(const std::string &reason) noexcept {
+        if (enabled() && !m_dumpRequested) {
+            std::lock_guard<std::mutex> lck(m_reasonMutex);
+            m_reason = reason;
+            m_dumpRequested = true;
+        }
+    }
+
+    static int64_t now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+   private:
+    // The Logger is used by the dump thread and needs to outlive this instance.
+    Tracer() {
+        Logger::instance();
+    }
+
+    TraceBuffer *buffer() noexcept {
+        static thread_local TraceBuffer *threadBuffer{nullptr};
+        if (nullptr == threadBuffer) {
+            std::lock_guard<std::mutex> lck(m_buffersMutex);
+            const uint32_t ID{static_cast<uint32_t>(m_buffers.size()) + 1};
+            m_buffers.emplace_back(new TraceBuffer(ID, "thread-" + std::to_string(ID)));
+            threadBuffer = m_buffers.back().get();
+        }
+        return threadBuffer;
+    }
+
+    void run() noexcept {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        const struct timespec TIMEOUT{0, 100*1000*1000};
+        auto lastDump{std::chrono::steady_clock::now() - std::chrono::seconds(1)};
+        while (m_running) {
+            if (SIGUSR1 == ::sigtimedwait(&signals, nullptr, &TIMEOUT)) {
+                m_dumpRequested = true;
+            }
+            if (m_dumpRequested && (std::chrono::steady_clock::now() - lastDump >= std::chrono::seconds(1))) {
+                std::string reason{"SIGUSR1"};
+                {
+                    std::lock_guard<std::mutex> lck(m_reasonMutex);
+                    reason = m_reason.empty() ? reason : m_reason;
+                    m_reason.clear();
+                }
+                dump(reason);
+                lastDump = std::chrono::steady_clock::now();
+                m_dumpRequested = false;
+            }
+        }
+    }
+
+    void dump(const std::string &reason) noexcept {
+        const std::string NAME{m_prefix + "-" + std::to_string(m_dumps++) + ".json"};
+        std::ofstream out(NAME, std::ios::trunc);
+        const auto PID{::getpid()};
+        out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"reason\":\"" << reason << "\"},\"traceEvents\":[";
+        bool first{true};
+        uint64_t events{0};
+        std::lock_guard<std::mutex> lck(m_buffersMutex);
+        for (const auto &b : m_buffers) {
+            out << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << PID << ",\"tid\":" << b->id() << ",\"args\":{\"name\":\"" << b->name() << "\"}}";
+            first = false;
+            for (const auto &e : b->snapshot()) {
+                out << ",{\"name\":\"" << traceSpanName(e.span) << "\",\"ph\":\"X\",\"pid\":" << PID << ",\"tid\":" << b->id()
+                    << ",\"ts\":" << e.begin / 1000 << "." << ((e.begin % 1000) / 100) << ",\"dur\":" << e.duration / 1000 << "." << ((e.duration % 1000) / 100)
+                    << ",\"args\":{\"frame\":" << e.frame << "}}";
+                events++;
+            }
+        }
+        out << "]}" << std::endl;
+        Logger::instance().log(LogLevel::Info, "Wrote {} trace events to {} ({}).", events, NAME, reason);
+    }
+
+   private:
+    std::atomic<bool> m_enabled{false};
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_dumpRequested{false};
+    std::string m_prefix{};
+    uint32_t m_dumps{0};
+    std::thread m_dumper{};
+    std::mutex m_buffersMutex{};
+    std::vector<std::unique_ptr<TraceBuffer>> m_buffers{};
+    std::mutex m_reasonMutex{};
+    std::string m_reason{};
+};
+
+/**
+ * TraceScope records the time from its construction to its destruction as a
+ * span of the calling thread if tracing is enabled.
+ */
+class TraceScope {
+   private:
+    TraceScope(const TraceScope &) = delete;
+    TraceScope(TraceScope &&)      = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    TraceScope &operator=(TraceScope &&) = delete;
+
+   public:
+    explicit TraceScope(TraceSpan span, int64_t frame = 0) noexcept
+        : m_span(span)
+        , m_frame(frame)
+        , m_begin(Tracer::instance().enabled() ? Tracer::now() : 0) {}
+
+    ~TraceScope() {
+        end();
+    }
+
+    /**
+     * This method ends the span before the scope is left.
+     */
+    void end() noexcept {
+        if (0 != m_begin) {
+            Tracer::instance().record(m_span, m_begin, Tracer::now() - m_begin, m_frame);
+            m_begin = 0;
+        }
+    }
+
+    /**
+     * This method sets the frame once it is known, e.g., after waiting for it.
+     */
+    void frame(int64_t frame) noexcept {
+        m_frame = frame;
+    }
+
+   private:
+    TraceSpan m_span;
+    int64_t m_frame;
+    int64_t m_begin;
+};
+
+#endif
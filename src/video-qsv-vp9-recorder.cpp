@@ -17,18 +17,38 @@
 
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
-
-#include <YamiC.h>
-
+#include "encoder-backends.hpp"
+#include "encoder-branch.hpp"
+#include "frame.hpp"
+#include "frame-handoff.hpp"
+#include "frame-import.hpp"
+#include "frame-pool.hpp"
+#include "frame-preprocessor.hpp"
+#include "image-reading-envelope.hpp"
+#include "logger.hpp"
+#include "object-regions.hpp"
+#include "frame-statistics.hpp"
+#include "rec-writer.hpp"
+#include "thread-placement.hpp"
+#include "thread-pool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <thread>
 
 // docker run --rm -ti --init --device /dev/dri/renderD128 -v /usr/lib/x86_64-linux-gnu/dri:/usr/lib/x86_64-linux-gnu/dri -v $PWD:/data qsv
 // ./video-qsv-vp9-recorder /data/in.yuv --cid=111 --name=data --width=640 --height=480
 
 int32_t main(int32_t argc, char **argv) {
+    const auto STARTED{std::chrono::steady_clock::now()};
     int32_t retCode{1};
     const uint32_t ZERO{0};
     const uint32_t ONE{1};
@@ -40,18 +60,50 @@ int32_t main(int32_t argc, char **argv) {
          (0 == commandlineArguments.count("width")) ||
          (0 == commandlineArguments.count("height")) ||
          (0 == commandlineArguments.count("cid")) ) {
-        std::cerr << argv[0] << " attaches to an I420-formatted image residing in a shared memory area to convert it into a corresponding h264 frame for publishing to a running OD4 session using Intel QuickSync; supports cropping, flipping, and scaling" << std::endl;
+        std::cerr << argv[0] << " attaches to an I420-formatted (or NV12, YUYV, BGR, RGB) image residing in a shared memory area to convert it into a corresponding h264 frame for publishing to a running OD4 session using Intel QuickSync; supports cropping, flipping, scaling, and simulcast" << std::endl;
         std::cerr << "Usage:   " << argv[0] << " --cid=<OpenDaVINCI session> --name=<name of shared memory area> --width=<width> --height=<height> [--gop=<GOP>] [--verbose] [--id=<identifier in case of multiple instances] [--bitrate=<bitrate>] [--ip-period=<ip-period>] "
-                "[--init-qp=<init-qp>] [--qpmin=<qpmin>] [--qpmax=<qpmax>] [--disable-frame-skip=<disable-frame-skip>] [--diff-qp-ip=<diff-qp-ip>] [--diff-qp-ib=<diff-qp-ib>] [--num-ref-frame=<num-ref-frame>] [--rc-mode=<rc-mode>] [--flip] "
-                "[--rc-mode=<rc-mode>] [--reference-mode=<reference-mode>]"<< std::endl;
+                "[--init-qp=<init-qp>] [--qpmin=<qpmin>] [--qpmax=<qpmax>] [--disable-frame-skip=<disable-frame-skip>] [--diff-qp-ip=<diff-qp-ip>] [--diff-qp-ib=<diff-qp-ib>] [--num-ref-frame=<num-ref-frame>] [--rc-mode=<rc-mode>] [--flip[=<h|v|hv>]] "
+                "[--rc-mode=<rc-mode>] [--reference-mode=<reference-mode>] [--checkpoint=<checkpoint>] [--preallocate=<MB>] [--stats] [--shutdown-timeout=<shutdown-timeout>] [--format=<format>] [--encoder=<encoder>] [--crop.x=<x>] [--crop.y=<y>] [--crop.width=<width>] [--crop.height=<height>] [--scale.width=<width>] [--scale.height=<height>] [--simulcast=<streams>] [--threads=<threads>] [--capture.spin=<us>] [--import=<socket>] [--<stage>.cpu=<cpus>] [--<stage>.priority=<priority>] [--numa.node=<node>] "
+                "[--roi] [--roi.fov.horizontal=<degrees>] [--roi.fov.vertical=<degrees>] [--roi.qp-delta=<delta>] [--roi.background-qp-delta=<delta>] [--roi.timeout=<ms>] [--roi.id=<senderStamp>] [--static.threshold=<threshold>] [--static.max-skip=<ms>] [--lossless] [--trace=<prefix>] [--log-level=<level>] [--log-rate=<messages per second>]"<< std::endl;
         std::cerr << "         --cid:             CID of the OD4Session to listen for Envelopes to record (also needed for remote control)" << std::endl;
         std::cerr << "         --id:              when using several instances, this identifier is used as senderStamp" << std::endl;
         std::cerr << "         --name:            name of the shared memory area to attach" << std::endl;
         std::cerr << "         --rec:             name of the recording file; default: YYYY-MM-DD_HHMMSS.rec" << std::endl;
         std::cerr << "         --recsuffix:       additional suffix to add to the .rec file" << std::endl;
         std::cerr << "         --remote:          enable remote control for start/stop recording" << std::endl;
+        std::cerr << "         --checkpoint:      optional: interval in ms to sync the .rec file to disk and record its durable size in <file>.rec.idx; 0 disables (default: 1000)" << std::endl;
+        std::cerr << "         --preallocate:     optional: disk space in MB to reserve for each .rec file when it is created; unused space is released when the file is closed (default: 0)" << std::endl;
+        std::cerr << "         --stats:           optional: write the statistics of each frame (size, frame type, VP9 quantizer, encoding time, queue delay) as 32 byte records into <file>.rec.stats" << std::endl;
+        std::cerr << "         --shutdown-timeout: optional: time in ms to drain the encoder and close the .rec file when terminated (default: 2000)" << std::endl;
         std::cerr << "         --width:           width of the frame" << std::endl;
         std::cerr << "         --height:          height of the frame" << std::endl;
+        std::cerr << "         --format:          optional: pixel format of the frame in the shared memory: i420, nv12, yuyv, bgr, rgb (default: i420)" << std::endl;
+        std::cerr << "         --encoder:         optional: encoder backend to use: qsv, vpx (software), raw (I420 as it is), lz4 or zstd (I420 compressed per plane as I4LZ or I4ZS) (default: qsv)" << std::endl;
+        std::cerr << "         --crop.x:          optional: left edge of the region to record (default: 0)" << std::endl;
+        std::cerr << "         --crop.y:          optional: top edge of the region to record (default: 0)" << std::endl;
+        std::cerr << "         --crop.width:      optional: width of the region to record (default: width - crop.x)" << std::endl;
+        std::cerr << "         --crop.height:     optional: height of the region to record (default: height - crop.y)" << std::endl;
+        std::cerr << "         --flip:            optional: flip the image vertically (--flip or --flip=v), horizontally (--flip=h), or both (--flip=hv)" << std::endl;
+        std::cerr << "         --scale.width:     optional: width to scale the (cropped) image to" << std::endl;
+        std::cerr << "         --scale.height:    optional: height to scale the (cropped) image to" << std::endl;
+        std::cerr << "         --simulcast:       optional: additional streams encoded from the same capture as comma-separated list of <width>x<height>[:<bitrate>[:<id>]]; id defaults to --id plus the position in the list" << std::endl;
+        std::cerr << "         --threads:         optional: number of worker threads to preprocess large frames (default: min(4, #cores) - 1)" << std::endl;
+        std::cerr << "         --capture.spin:    optional: time in microseconds to busy-poll for the next frame before sleeping until the producer notifies; needs a producer that publishes sequence numbers or uses a ring of frames (see src/frame-handoff.hpp and src/frame-ring.hpp); 0 disables (default: 0)" << std::endl;
+        std::cerr << "         --import:          optional: Unix domain socket of a producer that renders into DMA-BUFs or other buffers and hands them over as described in frame-import.hpp; frames are then encoded from these buffers" << std::endl;
+        std::cerr << "         --<stage>.cpu:     optional: CPUs to run the threads of a stage on, e.g., --capture.cpu=3 or --encoder.cpu=4-7; stages: capture (shared memory to encoder; also encodes without --simulcast), encoder (one thread per stream with --simulcast), workers (see --threads), od4 (receives --remote and --roi messages)" << std::endl;
+        std::cerr << "         --<stage>.priority: optional: SCHED_FIFO priority from 1 to 99 for the threads of a stage, e.g., --capture.priority=50; needs CAP_SYS_NICE (default: 0, regular scheduling)" << std::endl;
+        std::cerr << "         --numa.node:       optional: allocate frame buffers and encoder memory on this NUMA node; use with CPUs of the same node" << std::endl;
+        std::cerr << "         --roi:             optional: encode objects from opendlv.logic.perception.ObjectDirection/ObjectAngularBlob on the OD4Session with a different QP than the background (needs --encoder=vpx and --gop > 1)" << std::endl;
+        std::cerr << "         --roi.fov.horizontal: optional: horizontal field of view of the camera in degrees (default: 90)" << std::endl;
+        std::cerr << "         --roi.fov.vertical: optional: vertical field of view of the camera in degrees (default: derived from the aspect ratio)" << std::endl;
+        std::cerr << "         --roi.qp-delta:    optional: QP delta for the objects (default: 0)" << std::endl;
+        std::cerr << "         --roi.background-qp-delta: optional: QP delta for everything but the objects (default: 10)" << std::endl;
+        std::cerr << "         --roi.timeout:     optional: time in ms after which an object that is not updated is dropped (default: 500)" << std::endl;
+        std::cerr << "         --roi.id:          optional: only consider objects with this senderStamp (default: all)" << std::endl;
+        std::cerr << "         --static.threshold: optional: skip encoding frames whose mean absolute luma difference per pixel to the last encoded frame is below this value (e.g., 1.5); skipped frames are recorded as cluon.data.TimeStamp; 0 disables (default: 0)" << std::endl;
+        std::cerr << "         --static.max-skip: optional: maximum time in ms between two encoded frames when skipping (default: 1000)" << std::endl;
+        std::cerr << "         --lossless:        optional: archival mode; encode frames bit-exactly as lossless VP9 with the software encoder using all cores (implies --encoder=vpx); I420 frames are preserved as they are, other formats are recorded after their conversion to I420" << std::endl;
+        std::cerr << "         --trace:           optional: keep the most recent spans (wait, lock, preprocess, encode, get-output, serialize, write) of all threads in memory and write them as Chrome trace JSON to <prefix>-<n>.json on SIGUSR1 or when encoding a frame takes longer than two frame intervals" << std::endl;
         std::cerr << "         --gop:             optional: length of group of pictures (default = 1)" << std::endl;
         std::cerr << "         --bitrate:         optional: (default = 8000)" << std::endl;
         std::cerr << "         --ip-period:       optional: 0 (I frame only) | 1 (I and P frames) | N (I,P and B frames, B frame number is N-1) (default = 1)" << std::endl;
@@ -64,7 +116,9 @@ int32_t main(int32_t argc, char **argv) {
         std::cerr << "         --num-ref-frame:   optional: number of reference frame used (default: 1)" << std::endl;
         std::cerr << "         --rc-mode:         optional: rate control mode (default: 4, 0: NONE, 1: CBR, 2: VBR, 3: VCM, 4: CQP)" << std::endl;
         std::cerr << "         --reference-mode:  optional: reference frames mode (default: 0, 0: last(previous) gold/alt (previous key frame), 1: last (previous) gold (one before last) alt (one before gold))" << std::endl;
-        std::cerr << "         --verbose:         print encoding information" << std::endl;
+        std::cerr << "         --verbose:         print encoding information (same as --log-level=debug)" << std::endl;
+        std::cerr << "         --log-level:       optional: least severe messages to print: debug, info, warning, error (default: info)" << std::endl;
+        std::cerr << "         --log-rate:        optional: maximum number of messages per second from the same place in the code; further messages are counted and reported with the next one; 0 disables (default: 100)" << std::endl;
         std::cerr << "Example: " << argv[0] << " --cid=111 --name=video0.i420 --width=640 --height=480 --verbose" << std::endl;
     }
     else {
@@ -95,6 +149,13 @@ int32_t main(int32_t argc, char **argv) {
         const std::string RECSUFFIX{commandlineArguments["recsuffix"]};
         const std::string REC{(commandlineArguments["rec"].size() != 0) ? commandlineArguments["rec"] : ""};
         const std::string NAME_RECFILE{(REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec")};
+        const std::string RECDIRECTORY{(std::string::npos != NAME_RECFILE.find_last_of('/')) ? NAME_RECFILE.substr(0, NAME_RECFILE.find_last_of('/')) : ""};
+        const uint64_t PREALLOCATE{((commandlineArguments["preallocate"].size() != 0) ? static_cast<uint64_t>(std::stoi(commandlineArguments["preallocate"])) : 0) * 1024 * 1024};
+        const int64_t CHECKPOINT_DEFAULT{1000};
+        const int64_t CHECKPOINT{((commandlineArguments["checkpoint"].size() != 0) ? static_cast<int64_t>(std::stoi(commandlineArguments["checkpoint"])) : CHECKPOINT_DEFAULT) * 1000};
+        const bool STATS{commandlineArguments.count("stats") != 0};
+        const int64_t SHUTDOWN_TIMEOUT_DEFAULT{2000};
+        const int64_t SHUTDOWN_TIMEOUT{((commandlineArguments["shutdown-timeout"].size() != 0) ? static_cast<int64_t>(std::stoi(commandlineArguments["shutdown-timeout"])) : SHUTDOWN_TIMEOUT_DEFAULT) * 1000};
 
         const std::string NAME{commandlineArguments["name"]};
         const uint32_t WIDTH{static_cast<uint32_t>(std::stoi(commandlineArguments["width"]))};
@@ -102,6 +163,11 @@ int32_t main(int32_t argc, char **argv) {
         const uint32_t GOP_DEFAULT{1};
         const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : GOP_DEFAULT};
         const bool VERBOSE{commandlineArguments.count("verbose") != 0};
+        const LogLevel LOG_LEVEL{VERBOSE ? LogLevel::Debug : parseLogLevel(commandlineArguments["log-level"])};
+        const uint32_t LOG_RATE{(commandlineArguments["log-rate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["log-rate"])) : 100};
+        Logger::instance().level(LOG_LEVEL);
+        Logger::instance().rateLimit(LOG_RATE);
+        const std::string TRACE{commandlineArguments["trace"]};
         const uint32_t CID{(commandlineArguments["cid"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["cid"])) : 0};
         const uint32_t ID{(commandlineArguments["id"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
         const uint32_t FPS_DEFAULT{30};
@@ -120,249 +186,433 @@ int32_t main(int32_t argc, char **argv) {
 
         const uint32_t REFERENCE_MODE{(commandlineArguments["reference-mode"].size() != 0) ? std::min(std::max(static_cast<uint32_t>(std::stoi(commandlineArguments["reference-mode"])), ZERO), ONE): 0};
 
+        const bool LOSSLESS{commandlineArguments.count("lossless") != 0};
+        const std::string ENCODER{(commandlineArguments["encoder"].size() != 0) ? commandlineArguments["encoder"] : (LOSSLESS ? "vpx" : "")};
+        const uint32_t FORMAT{fourccFromFormat(commandlineArguments["format"])};
+        if (0 == FORMAT) {
+            Logger::instance().log(LogLevel::Error, "Unknown format '{}'.", commandlineArguments["format"]);
+            return retCode;
+        }
+        Preprocessing PREPROCESSING;
+        {
+            PREPROCESSING.cropX = (commandlineArguments["crop.x"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.x"])) : 0;
+            PREPROCESSING.cropY = (commandlineArguments["crop.y"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.y"])) : 0;
+            PREPROCESSING.cropWidth = (commandlineArguments["crop.width"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.width"])) : 0;
+            PREPROCESSING.cropHeight = (commandlineArguments["crop.height"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.height"])) : 0;
+            // A plain --flip flips vertically.
+            const std::string FLIP{commandlineArguments["flip"]};
+            PREPROCESSING.flipHorizontal = (std::string::npos != FLIP.find('h'));
+            PREPROCESSING.flipVertical = ("1" == FLIP) || (std::string::npos != FLIP.find('v'));
+            PREPROCESSING.scaledWidth = (commandlineArguments["scale.width"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["scale.width"])) : 0;
+            PREPROCESSING.scaledHeight = (commandlineArguments["scale.height"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["scale.height"])) : 0;
+        }
+        std::vector<SimulcastStream> SIMULCAST;
+        if (commandlineArguments["simulcast"].size() != 0) {
+            SIMULCAST = parseSimulcast(commandlineArguments["simulcast"], ID);
+            if (SIMULCAST.empty()) {
+                Logger::instance().log(LogLevel::Error, "Invalid value for --simulcast '{}'.", commandlineArguments["simulcast"]);
+                return retCode;
+            }
+        }
+        const bool ROI{commandlineArguments.count("roi") != 0};
+        const float DEG_TO_RAD{static_cast<float>(M_PI) / 180.0f};
+        const float ROI_FOV_HORIZONTAL{((commandlineArguments["roi.fov.horizontal"].size() != 0) ? std::stof(commandlineArguments["roi.fov.horizontal"]) : 90.0f) * DEG_TO_RAD};
+        const float ROI_FOV_VERTICAL{((commandlineArguments["roi.fov.vertical"].size() != 0) ? std::stof(commandlineArguments["roi.fov.vertical"]) : 0.0f) * DEG_TO_RAD};
+        const int32_t ROI_QP_DELTA{(commandlineArguments["roi.qp-delta"].size() != 0) ? std::stoi(commandlineArguments["roi.qp-delta"]) : 0};
+        const int32_t ROI_BACKGROUND_QP_DELTA{(commandlineArguments["roi.background-qp-delta"].size() != 0) ? std::stoi(commandlineArguments["roi.background-qp-delta"]) : 10};
+        const int64_t ROI_TIMEOUT{((commandlineArguments["roi.timeout"].size() != 0) ? static_cast<int64_t>(std::stoi(commandlineArguments["roi.timeout"])) : 500) * 1000};
+        const bool ROI_HAS_ID{commandlineArguments["roi.id"].size() != 0};
+        const uint32_t ROI_ID{ROI_HAS_ID ? static_cast<uint32_t>(std::stoi(commandlineArguments["roi.id"])) : 0};
+
+        const float STATIC_THRESHOLD{(commandlineArguments["static.threshold"].size() != 0) ? std::stof(commandlineArguments["static.threshold"]) : 0.0f};
+        const int64_t STATIC_MAX_SKIP{((commandlineArguments["static.max-skip"].size() != 0) ? static_cast<int64_t>(std::stoi(commandlineArguments["static.max-skip"])) : 1000) * 1000};
+
+        const uint32_t THREADS_DEFAULT{std::min(std::max(std::thread::hardware_concurrency(), ONE), FOUR) - 1};
+        const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : THREADS_DEFAULT};
+        const std::chrono::microseconds CAPTURE_SPIN{(commandlineArguments["capture.spin"].size() != 0) ? std::stoi(commandlineArguments["capture.spin"]) : 0};
+        auto placementOf = [&commandlineArguments](const std::string &stage) {
+            ThreadPlacement placement;
+            placement.cpus = commandlineArguments[stage + ".cpu"];
+            placement.priority = (commandlineArguments[stage + ".priority"].size() != 0) ? std::stoi(commandlineArguments[stage + ".priority"]) : 0;
+            return placement;
+        };
+        const ThreadPlacement CAPTURE_PLACEMENT{placementOf("capture")};
+        const ThreadPlacement ENCODER_PLACEMENT{placementOf("encoder")};
+        const ThreadPlacement WORKERS_PLACEMENT{placementOf("workers")};
+        const ThreadPlacement OD4_PLACEMENT{placementOf("od4")};
+        const std::string IMPORT{commandlineArguments["import"]};
+        const int32_t NUMA_NODE{(commandlineArguments["numa.node"].size() != 0) ? std::stoi(commandlineArguments["numa.node"]) : -1};
+        auto warnPlacement = [](const char *stage, const ThreadPlacement &placement) {
+            Logger::instance().log(LogLevel::Warning, "Could not place the {} threads on CPUs '{}' with priority {}.", stage, placement.cpus, placement.priority);
+        };
+
+        // The memory policy is inherited by all threads created from now on.
+        if ( (0 <= NUMA_NODE) && !preferNumaNode(static_cast<uint32_t>(NUMA_NODE)) ) {
+            Logger::instance().log(LogLevel::Warning, "Could not prefer NUMA node {} for memory allocations.", NUMA_NODE);
+        }
+
+        if (!TRACE.empty()) {
+            Tracer::instance().enable(TRACE);
+            Tracer::instance().nameThread("capture");
+            Logger::instance().log(LogLevel::Info, "Tracing; send SIGUSR1 to write {}-<n>.json.", TRACE);
+        }
+
         std::unique_ptr<cluon::SharedMemory> sharedMemory(new cluon::SharedMemory{NAME});
         if (sharedMemory && sharedMemory->valid()) {
-            std::clog << "[video-qsv-vp9-recorder]: Attached to '" << sharedMemory->name() << "' (" << sharedMemory->size() << " bytes)." << std::endl;
+            Logger::instance().log(LogLevel::Info, "Attached to '{}' ({} bytes).", sharedMemory->name(), sharedMemory->size());
+            if ( IMPORT.empty() && (sharedMemory->size() < frameSize(FORMAT, WIDTH, HEIGHT)) ) {
+                Logger::instance().log(LogLevel::Error, "Shared memory '{}' is too small for a {}x{} image in format '{}'.", NAME, WIDTH, HEIGHT, commandlineArguments["format"]);
+                return retCode;
+            }
 
-            std::unique_ptr<cluon::OD4Session> od4Session{nullptr};
-            std::mutex recFileMutex{};
-            std::unique_ptr<std::fstream> recFile{nullptr};
-            std::string nameOfRecFile;
+            // Frames reside in the producer's buffers; the shared memory only signals which one holds the newest frame.
+            std::unique_ptr<FrameImport> frameImport{nullptr};
+            if (!IMPORT.empty()) {
+                frameImport.reset(new FrameImport());
+                const std::string ERROR{frameImport->connect(IMPORT)};
+                if (!ERROR.empty()) {
+                    Logger::instance().log(LogLevel::Error, "Failed to import buffers from '{}': {}.", IMPORT, ERROR);
+                    return retCode;
+                }
+                const FrameImport::Description &d{frameImport->description()};
+                if ( (FORMAT != d.fourcc) || (WIDTH != d.width) || (HEIGHT != d.height) || (frameSize(FORMAT, WIDTH, HEIGHT) > d.size) ) {
+                    Logger::instance().log(LogLevel::Error, "Buffers imported from '{}' do not hold {}x{} images in format '{}'.", IMPORT, WIDTH, HEIGHT, commandlineArguments["format"]);
+                    return retCode;
+                }
+                Logger::instance().log(LogLevel::Info, "Imported {} {} buffers from '{}'{}.", frameImport->count(), (FrameImport::DMA_BUF == d.type) ? "DMA-BUF" : "memory", IMPORT,
+                                       frameImport->mapped() ? "" : " that cannot be mapped");
+            }
+
+            // Regions of interest are updated from the OD4Session.
+            std::unique_ptr<ObjectRegions> objectRegions{nullptr};
+            if (ROI) {
+                objectRegions.reset(new ObjectRegions(WIDTH, HEIGHT, ROI_FOV_HORIZONTAL, ROI_FOV_VERTICAL, ROI_TIMEOUT, ROI_QP_DELTA, ROI_BACKGROUND_QP_DELTA));
+            }
+
+            if (REMOTE && (CID == 0)) {
+                Logger::instance().log(LogLevel::Error, "--remote specified but no --cid=? provided.");
+                return retCode;
+            }
+
+            // All file I/O happens on the writer's thread; it outlives the OD4Session and the encoders that queue work for it.
+            RecWriter recWriter{STARTED, CHECKPOINT, PREALLOCATE, STATS};
             if (!REMOTE) {
-                recFile.reset(new std::fstream(NAME_RECFILE.c_str(), std::ios::out|std::ios::binary|std::ios::trunc));
-                std::clog << "[video-qsv-vp9-recorder]: Created " << NAME_RECFILE << "." << std::endl;
+                recWriter.open(NAME_RECFILE, STARTED);
             }
             else {
-                if (CID == 0) {
-                    std::cerr << "[video-qsv-vp9-recorder]: --remote specified but no --cid=? provided." << std::endl;
-                    return retCode;
-                }
+                // The next file is prepared ahead of time so that starting to record only needs to name it.
+                recWriter.prepare(RECDIRECTORY);
+            }
+            std::unique_ptr<cluon::OD4Session> od4Session{nullptr};
 
+            if (REMOTE || ROI) {
+                ObjectRegions *regions{objectRegions.get()};
+                // The OD4Session's threads inherit the placement of this thread while it is constructed.
+                ScopedThreadPlacement od4Placement{OD4_PLACEMENT};
+                if (!od4Placement.good()) {
+                    warnPlacement("od4", OD4_PLACEMENT);
+                }
                 od4Session.reset(new cluon::OD4Session(CID,
-                    [REC, RECSUFFIX, getYYYYMMDD_HHMMSS, &recFileMutex, &recFile, &nameOfRecFile](cluon::data::Envelope &&envelope) noexcept {
-                    if (cluon::data::RecorderCommand::ID() == envelope.dataType()) {
-                        std::lock_guard<std::mutex> lck(recFileMutex);
+                    [REMOTE, REC, RECSUFFIX, getYYYYMMDD_HHMMSS, &recWriter, regions, ROI_HAS_ID, ROI_ID](cluon::data::Envelope &&envelope) noexcept {
+                    if (REMOTE && (cluon::data::RecorderCommand::ID() == envelope.dataType())) {
+                        // Opening and closing files is queued for the writer's thread; it closes an open file first.
                         cluon::data::RecorderCommand rc = cluon::extractMessage<cluon::data::RecorderCommand>(std::move(envelope));
                         if (1 == rc.command()) {
-                            if (recFile && recFile->good()) {
-                                recFile->flush();
-                                recFile->close();
-                                recFile = nullptr;
-                                std::clog << "[video-qsv-vp9-recorder]: Closed " << nameOfRecFile << "." << std::endl;
-                            }
-                            nameOfRecFile = (REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec");
-                            recFile.reset(new std::fstream(nameOfRecFile.c_str(), std::ios::out|std::ios::binary|std::ios::trunc));
-                            std::clog << "[video-qsv-vp9-recorder]: Created " << nameOfRecFile << "." << std::endl;
+                            recWriter.open((REC.size() != 0) ? REC + RECSUFFIX : (getYYYYMMDD_HHMMSS() + RECSUFFIX + ".rec"), std::chrono::steady_clock::now());
                         }
                         else if (2 == rc.command()) {
-                            if (recFile && recFile->good()) {
-                                recFile->flush();
-                                recFile->close();
-                                std::clog << "[video-qsv-vp9-recorder]: Closed " << nameOfRecFile << "." << std::endl;
-                            }
-                            recFile = nullptr;
+                            recWriter.close();
+                        }
+                    }
+                    else if ( (nullptr != regions) && (!ROI_HAS_ID || (ROI_ID == envelope.senderStamp())) ) {
+                        // Frames are encoded by their sample time stamps, so the objects need to be stamped in the same clock.
+                        const int64_t SAMPLED{cluon::time::toMicroseconds(envelope.sampleTimeStamp())};
+                        if (opendlv::logic::perception::ObjectDirection::ID() == envelope.dataType()) {
+                            auto od = cluon::extractMessage<opendlv::logic::perception::ObjectDirection>(std::move(envelope));
+                            regions->direction(od.objectId(), od.azimuthAngle(), od.zenithAngle(), SAMPLED);
+                        }
+                        else if (opendlv::logic::perception::ObjectAngularBlob::ID() == envelope.dataType()) {
+                            auto oab = cluon::extractMessage<opendlv::logic::perception::ObjectAngularBlob>(std::move(envelope));
+                            regions->extent(oab.objectId(), oab.width(), oab.height(), SAMPLED);
                         }
                     }
                 }));
             }
 
-            EncodeHandler encodeHandler = createEncoder(YAMI_MIME_VP9);
-            if (nullptr != encodeHandler) {
-                YamiStatus retVal{YAMI_SUCCESS};
-                {
-                    VideoParamsCommon encVideoParams;
-                    encVideoParams.size = sizeof(VideoParamsCommon);
-                    retVal = encodeGetParameters(encodeHandler, VideoParamsTypeCommon, &encVideoParams);
-                    if (YAMI_SUCCESS != retVal) {
-                        std::cerr << "[video-qsv-vp9-recorder]: Error retrieving parameters 'VideoParamsTypeCommon': " << retVal << std::endl;
-                    }
+            if (!createEncoderBackend(ENCODER)) {
+                Logger::instance().log(LogLevel::Error, "Unknown encoder '{}'.", ENCODER);
+                return retCode;
+            }
+            std::unique_ptr<ThreadPool> threadPool{(0 < THREADS) ? new ThreadPool(THREADS) : nullptr};
+            if (threadPool && !WORKERS_PLACEMENT.empty() && !threadPool->place(WORKERS_PLACEMENT)) {
+                warnPlacement("workers", WORKERS_PLACEMENT);
+            }
 
-                    {
-                        // https://github.com/intel/libyami/blob/apache/interface/VideoEncoderDefs.h
-                        // https://github.com/intel/libyami-utils/blob/master/doc/yamitranscode.1
-                        encVideoParams.resolution.width = WIDTH;
-                        encVideoParams.resolution.height = HEIGHT;
-
-                        encVideoParams.frameRate.frameRateDenom = 1;
-                        encVideoParams.frameRate.frameRateNum = FPS_DEFAULT;
-
-                        encVideoParams.intraPeriod = GOP;
-                        encVideoParams.ipPeriod = IP_PERIOD;
-
-                        encVideoParams.rcParams.bitRate = BITRATE;
-                        encVideoParams.rcParams.initQP = INIT_QP; // Initial quality factor.
-                        encVideoParams.rcParams.minQP = QPMIN;
-                        encVideoParams.rcParams.maxQP = QPMAX;
-                        encVideoParams.rcParams.disableFrameSkip = FRAMESKIP;
-                        encVideoParams.rcParams.diffQPIP = DIFF_QP_IP;
-                        encVideoParams.rcParams.diffQPIB = DIFF_QP_IB;
-
-                        encVideoParams.numRefFrames = NUM_REF_FRAME;
-                        encVideoParams.enableLowPower = false;
-                        encVideoParams.bitDepth = 8;
-
-                        switch (RC_MODE) {
-                            case 0: { encVideoParams.rcMode = RATE_CONTROL_NONE; break; }
-                            case 1: { encVideoParams.rcMode = RATE_CONTROL_CBR; break; }
-                            case 2: { encVideoParams.rcMode = RATE_CONTROL_VBR; break; }
-                            case 3: { encVideoParams.rcMode = RATE_CONTROL_VCM; break; }
-                            case 4: { encVideoParams.rcMode = RATE_CONTROL_CQP; break; }
-                        }
-                        
+            EncoderSettings settings;
+            {
+                settings.fps = FPS_DEFAULT;
+                settings.gop = GOP;
+                settings.ipPeriod = IP_PERIOD;
+                settings.bitrate = BITRATE;
+                settings.initQP = INIT_QP;
+                settings.qpMin = QPMIN;
+                settings.qpMax = QPMAX;
+                settings.disableFrameSkip = FRAMESKIP;
+                settings.diffQPIP = DIFF_QP_IP;
+                settings.diffQPIB = DIFF_QP_IB;
+                settings.numRefFrames = NUM_REF_FRAME;
+                settings.rcMode = RC_MODE;
+                settings.referenceMode = REFERENCE_MODE;
+                settings.lossless = LOSSLESS;
+            }
 
-                        encVideoParams.size = sizeof(VideoParamsCommon);
-                    }
-                    retVal = encodeSetParameters(encodeHandler, VideoParamsTypeCommon, &encVideoParams);
-                    if (YAMI_SUCCESS != retVal) {
-                        std::cerr << "[video-qsv-vp9-recorder]: Error setting parameters 'VideoParamsTypeCommon': " << retVal << std::endl;
+            // Serialize an encoded frame of the given stream and queue it for the writer; called from the branches' threads when using simulcast.
+            auto writeEncodedFrame = [&](const EncoderBranch &branch, const EncodedFrame &encodedFrame) {
+                if (!recWriter.recording()) {
+                    return;
+                }
+                cluon::data::TimeStamp ts{cluon::time::fromMicroseconds(encodedFrame.timeStamp)};
+                FrameRecord record;
+                record.senderStamp = branch.senderStamp();
+                record.timeStamp = encodedFrame.timeStamp;
+                record.repeat = encodedFrame.repeat;
+                if (encodedFrame.repeat) {
+                    // A skipped frame is recorded as TimeStamp with the frame's sample time to keep the timing of the stream.
+                    cluon::data::Envelope envelope;
+                    {
+                        cluon::ToProtoVisitor protoEncoder;
+                        ts.accept(protoEncoder);
+                        envelope.dataType(cluon::data::TimeStamp::ID());
+                        envelope.serializedData(protoEncoder.encodedData());
+                        envelope.sent(cluon::time::now());
+                        envelope.sampleTimeStamp(ts);
+                        envelope.senderStamp(branch.senderStamp());
                     }
+                    recWriter.write(cluon::serializeEnvelope(std::move(envelope)), record);
+                    return;
                 }
 
-                {
-                    VideoParamsVP9 encVideoParams;
-                    retVal = encodeGetParameters(encodeHandler, VideoParamsTypeVP9, &encVideoParams);
-                    if (YAMI_SUCCESS != retVal) {
-                        std::cerr << "[video-qsv-vp9-recorder]: Error retrieving parameters 'VideoParamsTypeVP9': " << retVal << std::endl;
+                // Frames in a buffer of their own are written from there; the writer copies all others as they are only valid until the encoder's next output.
+                TraceScope trace(TraceSpan::Serialize, encodedFrame.timeStamp);
+                ImageReadingEnvelope envelope(branch.encoder().fourcc(), branch.settings().width, branch.settings().height, encodedFrame.data, encodedFrame.size, ts, branch.senderStamp());
+                if (envelope.valid()) {
+                    record.size = encodedFrame.size;
+                    record.keyFrame = encodedFrame.keyFrame;
+                    record.encodingDuration = encodedFrame.encodingDuration;
+                    record.queueDelay = encodedFrame.queueDelay;
+                    if (STATS && ("VP90" == branch.encoder().fourcc())) {
+                        record.qIndex = vp9BaseQIndex(encodedFrame.data, encodedFrame.size);
                     }
+                    TraceScope lock(TraceSpan::Lock, encodedFrame.timeStamp);
+                    recWriter.write(envelope, encodedFrame.buffer, record);
+                }
+                else {
+                    recWriter.failed();
+                }
 
-                    {
-                        encVideoParams.referenceMode = REFERENCE_MODE;
-                    }
-                    retVal = encodeSetParameters(encodeHandler, VideoParamsTypeVP9, &encVideoParams);
-                    if (YAMI_SUCCESS != retVal) {
-                        std::cerr << "[video-qsv-vp9-recorder]: Error setting parameters 'VideoParamsTypeVP9': " << retVal << std::endl;
+                Logger::instance().log(LogLevel::Debug, "Frame size = {} bytes; sample time = {} microseconds; senderStamp = {}; encoding took {} microseconds.",
+                                       encodedFrame.size, encodedFrame.timeStamp, branch.senderStamp(), encodedFrame.encodingDuration);
+            };
+
+            // The main stream and all simulcast streams are fed from a single capture of the shared memory.
+            std::vector<std::unique_ptr<EncoderBranch>> branches;
+            {
+                branches.emplace_back(new EncoderBranch(ID, createEncoderBackend(ENCODER), FORMAT, WIDTH, HEIGHT, PREPROCESSING, settings, threadPool.get(), writeEncodedFrame));
+                for (const auto &stream : SIMULCAST) {
+                    Preprocessing p{PREPROCESSING};
+                    p.scaledWidth = stream.width;
+                    p.scaledHeight = stream.height;
+                    EncoderSettings s{settings};
+                    s.bitrate = (0 < stream.bitrate) ? stream.bitrate : settings.bitrate;
+                    branches.emplace_back(new EncoderBranch(stream.senderStamp, createEncoderBackend(ENCODER), FORMAT, WIDTH, HEIGHT, p, s, threadPool.get(), writeEncodedFrame));
+                }
+            }
+            bool encoding{true};
+            for (auto &branch : branches) {
+                if (objectRegions) {
+                    branch->useRegionsOfInterest(objectRegions.get());
+                }
+                if (0.0f < STATIC_THRESHOLD) {
+                    branch->useStaticSceneDetection(STATIC_THRESHOLD, STATIC_MAX_SKIP);
+                }
+                if (branch->preprocessor().converts()) {
+                    Logger::instance().log(LogLevel::Info, "Preprocessing {}x{} '{}' into {}x{} for encoder '{}' (senderStamp {}).", WIDTH, HEIGHT, commandlineArguments["format"],
+                                           branch->preprocessor().width(), branch->preprocessor().height(), branch->encoder().name(), branch->senderStamp());
+                }
+                if (frameImport && !frameImport->mapped()) {
+                    // Only the hardware encoder reads unmapped DMA-BUFs, and only if no other step needs the pixels.
+                    const bool NEEDS_PIXELS{(1 < branches.size()) || branch->preprocessor().converts() || (0.0f < STATIC_THRESHOLD) || (0 != std::strcmp("qsv", branch->encoder().name()))};
+                    if (NEEDS_PIXELS) {
+                        Logger::instance().log(LogLevel::Error, "Buffers imported from '{}' cannot be mapped; use --encoder=qsv without simulcast, preprocessing, or static scene detection.", IMPORT);
+                        encoding = false;
                     }
                 }
+            }
 
-                retVal = encodeStart(encodeHandler);
-                if (YAMI_SUCCESS != retVal) {
-                    std::cerr << "[video-qsv-vp9-recorder]: Error starting encoder: " << retVal << std::endl;
+            // Open all encoders in parallel while the recording file and the buffers are prepared. Threads that an
+            // encoder starts while opening inherit the placement of the thread that encodes; see --encoder.cpu.
+            const ThreadPlacement &ENCODING_PLACEMENT{(1 < branches.size()) ? ENCODER_PLACEMENT : CAPTURE_PLACEMENT};
+            std::vector<std::future<bool>> encodersOpened;
+            for (auto &branch : branches) {
+                if (encoding) {
+                    EncoderBranch *b{branch.get()};
+                    encodersOpened.push_back(std::async(std::launch::async, [b, &ENCODING_PLACEMENT](){
+                        ScopedThreadPlacement placement{ENCODING_PLACEMENT};
+                        return b->open();
+                    }));
                 }
+            }
+            // With simulcast, each branch encodes on its own thread from a copy of the shared memory.
+            std::unique_ptr<FramePool> capturePool{nullptr};
+            if (1 < branches.size()) {
+                const uint32_t NUMBER_OF_BUFFERS{4};
+                capturePool.reset(new FramePool(frameImport ? frameImport->description().size : frameSize(FORMAT, WIDTH, HEIGHT), NUMBER_OF_BUFFERS));
+            }
+            for (auto &opened : encodersOpened) {
+                encoding = opened.get() && encoding;
+            }
+            Logger::instance().log(LogLevel::Info, "Encoders {} after {} ms.", encoding ? "ready" : "failed",
+                                   std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - STARTED).count());
+
+            // Describe each stream in the metadata of the recording.
+            for (auto &branch : branches) {
+                const EncoderSettings &s{branch->settings()};
+                recorder::StreamSettings streamSettings;
+                streamSettings.encoder(branch->encoder().name()).fourcc(branch->encoder().fourcc()).width(s.width).height(s.height)
+                              .source(NAME).sourceFormat(commandlineArguments["format"].empty() ? "i420" : commandlineArguments["format"]).sourceWidth(WIDTH).sourceHeight(HEIGHT)
+                              .fps(s.fps).gop(s.gop).ipPeriod(s.ipPeriod).bitrate(s.bitrate).rcMode(s.rcMode)
+                              .initQP(s.initQP).qpMin(s.qpMin).qpMax(s.qpMax).lossless(s.lossless);
+                recWriter.describe(branch->senderStamp(), streamSettings);
+            }
 
-                VideoFrameRawData inBuffer;
-                {
-                    inBuffer.memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_POINTER;
-                    inBuffer.size = WIDTH * HEIGHT * 3/2; // I420 is W*H*3/2
-                    inBuffer.handle = reinterpret_cast<intptr_t>(reinterpret_cast<uint8_t*>(sharedMemory->data()));
-                    inBuffer.width = WIDTH;
-                    inBuffer.height = HEIGHT;
-                    inBuffer.pitch[0] = WIDTH;   // Y
-                    inBuffer.pitch[1] = WIDTH/2; // U
-                    inBuffer.pitch[2] = WIDTH/2; // V
-                    inBuffer.offset[0] = 0; // Y
-                    inBuffer.offset[1] = WIDTH*HEIGHT; // U
-                    inBuffer.offset[2] = inBuffer.offset[1] + (WIDTH*HEIGHT)/4; // V
-                    inBuffer.fourcc = YAMI_FOURCC_I420;
-                    inBuffer.internalID = 0;
-                    inBuffer.timeStamp = 0;
-                    inBuffer.flags = VIDEO_FRAME_FLAGS_KEY;
+            if (encoding) {
+                if (capturePool) {
+                    for (auto &branch : branches) {
+                        branch->start();
+                        if (!ENCODER_PLACEMENT.empty() && !branch->place(ENCODER_PLACEMENT)) {
+                            warnPlacement("encoder", ENCODER_PLACEMENT);
+                        }
+                    }
                 }
 
-                // Reserve buffer per frame that should be large enough to hold a lossy-encoded h264 frame.
-                const uint32_t INTERNAL_BUFFER_SIZE{5*1000*1000};
-                uint8_t internalBuffer[INTERNAL_BUFFER_SIZE];
-                VideoEncOutputBuffer outBuffer;
-                {
-                    outBuffer.data = internalBuffer;
-                    outBuffer.bufferSize = INTERNAL_BUFFER_SIZE;
-                    outBuffer.dataSize = 0;
-                    outBuffer.remainingSize = 0;
-                    outBuffer.flag = 0;
-                    outBuffer.format = OUTPUT_EVERYTHING;
-                    outBuffer.temporalID = 0;
-                    outBuffer.timeStamp = 0;
+                FrameHandoff handoff{*sharedMemory, frameImport ? 0 : frameSize(FORMAT, WIDTH, HEIGHT)};
+                handoff.spin(CAPTURE_SPIN);
+                // Place this thread only now so that the threads started before do not inherit its placement.
+                if (!CAPTURE_PLACEMENT.empty() && !placeCurrentThread(CAPTURE_PLACEMENT)) {
+                    warnPlacement("capture", CAPTURE_PLACEMENT);
                 }
-
-                cluon::data::TimeStamp before, after, sampleTimeStamp;
-
-                while ( (YAMI_SUCCESS == retVal) &&
+                cluon::data::TimeStamp sampleTimeStamp;
+                // Imported buffer whose pixels are read while the producer must not write it.
+                int32_t readSlot{-1};
+                auto releaseFrame = [&handoff, &frameImport, &readSlot]() {
+                    if (0 <= readSlot) {
+                        frameImport->endRead(static_cast<uint32_t>(readSlot));
+                        readSlot = -1;
+                    }
+                    handoff.release();
+                };
+                while ( encoding &&
                         (sharedMemory && sharedMemory->valid()) &&
                         !cluon::TerminateHandler::instance().isTerminated.load() ) {
-                    // Wait for incoming frame.
-                    sharedMemory->wait();
+                    // Wait for an incoming frame that was not encoded before; the shared memory is locked afterwards.
+                    {
+                        TraceScope trace(TraceSpan::Wait);
+                        if (!handoff.acquire()) {
+                            continue;
+                        }
+                    }
 
                     sampleTimeStamp = cluon::time::now();
-
-                    sharedMemory->lock();
                     {
                         // Read notification timestamp.
-                        auto r = sharedMemory->getTimeStamp();
-                        sampleTimeStamp = (r.first ? r.second : sampleTimeStamp);
-
-                        {
-                            if (VERBOSE) {
-                                before = cluon::time::now();
-                            }
-
-                            retVal = encodeEncodeRawData(encodeHandler, &inBuffer);
-
-                            if (YAMI_SUCCESS != retVal) {
-                                std::cerr << "[video-qsv-vp9-recorder]: Error encoding frame: " << retVal << std::endl;
+                        const int64_t TIMESTAMP{handoff.timeStamp()};
+                        sampleTimeStamp = ((0 != TIMESTAMP) ? cluon::time::fromMicroseconds(TIMESTAMP) : sampleTimeStamp);
+
+                        Frame source{describeFrame(FORMAT, WIDTH, HEIGHT, handoff.data())};
+                        if (frameImport) {
+                            const int32_t SLOT{handoff.slot()};
+                            if ( (0 > SLOT) || (static_cast<uint32_t>(SLOT) >= frameImport->count()) ) {
+                                Logger::instance().log(LogLevel::Error, "Producer of '{}' needs to use a FrameRing with one slot per imported buffer.", NAME);
+                                encoding = false;
+                                handoff.release();
+                                continue;
                             }
-
-                            if (VERBOSE) {
-                                after = cluon::time::now();
+                            source = frameImport->frame(static_cast<uint32_t>(SLOT), 0);
+                            if (frameImport->mapped()) {
+                                if (!frameImport->beginRead(static_cast<uint32_t>(SLOT))) {
+                                    Logger::instance().log(LogLevel::Warning, "Could not synchronize imported buffer {} for reading: {}.", SLOT, std::strerror(errno));
+                                }
+                                readSlot = SLOT;
                             }
                         }
-
-                        if (YAMI_SUCCESS != retVal) {
-                            sharedMemory->unlock();
-                            break;
-                        }
-
-                        bool withWait = true;
-                        retVal = encodeGetOutput(encodeHandler, &outBuffer, withWait);
-                        if (YAMI_SUCCESS == retVal) {
-                            if ( (0 < outBuffer.dataSize) && (recFile && recFile->good()) ) {
-                                std::string data(reinterpret_cast<char*>(internalBuffer), outBuffer.dataSize);
-
-                                opendlv::proxy::ImageReading ir;
-                                ir.fourcc("VP90").width(WIDTH).height(HEIGHT).data(data);
-                                {
-                                    cluon::data::Envelope envelope;
-                                    {
-                                        cluon::ToProtoVisitor protoEncoder;
-                                        {
-                                            envelope.dataType(ir.ID());
-                                            ir.accept(protoEncoder);
-                                            envelope.serializedData(protoEncoder.encodedData());
-                                            envelope.sent(cluon::time::now());
-                                            envelope.sampleTimeStamp(sampleTimeStamp);
-                                            envelope.senderStamp(ID);
-                                        }
-                                    }
-
-                                    std::lock_guard<std::mutex> lck(recFileMutex);
-                                    std::string serializedData{cluon::serializeEnvelope(std::move(envelope))};
-                                    recFile->write(serializedData.data(), serializedData.size());
-                                    recFile->flush();
-                                }
-
-                                if (VERBOSE) {
-                                    std::clog << "[video-qsv-vp9-recorder]: Frame size = " << data.size() << " bytes; sample time = " << cluon::time::toMicroseconds(sampleTimeStamp) << " microseconds; encoding took " << cluon::time::deltaInMicroseconds(after, before) << " microseconds." << std::endl;
-                                }
+                        source.timeStamp = cluon::time::toMicroseconds(sampleTimeStamp);
+
+                        if (!capturePool) {
+                            EncoderBranch &branch{*branches.front()};
+                            Frame frame;
+                            {
+                                TraceScope trace(TraceSpan::Preprocess, source.timeStamp);
+                                frame = branch.preprocessor().process(source);
+                            }
+                            if (branch.preprocessor().converts()) {
+                                // The converted frame resides in our own buffer; let the producer continue.
+                                releaseFrame();
                             }
+                            encoding = branch.encode(frame);
                         }
                         else {
-                            std::cerr << "[video-qsv-vp9-recorder]: Error getting encoded frame: " << retVal << std::endl;
-                            sharedMemory->unlock();
-                            break;
+                            // Read the shared memory only once; all branches work on this copy.
+                            std::shared_ptr<uint8_t> buffer{capturePool->acquire()};
+                            {
+                                TraceScope trace(TraceSpan::Preprocess, source.timeStamp);
+                                std::memcpy(buffer.get(), source.data, capturePool->bufferSize());
+                            }
+                            releaseFrame();
+
+                            Frame captured{source};
+                            captured.data = buffer.get();
+                            captured.buffer = buffer;
+                            captured.dmaBuf = -1;
+                            for (auto &branch : branches) {
+                                branch->submit(captured);
+                                encoding = encoding && branch->good();
+                            }
                         }
                     }
-                    sharedMemory->unlock();
+                    releaseFrame();
                 }
 
-                encodeStop(encodeHandler);
-                releaseEncoder(encodeHandler);
-            }
-            else {
-                std::cerr << "[video-qsv-vp9-recorder]: Error creating encoding handler." << std::endl;
+                if (cluon::TerminateHandler::instance().isTerminated.load()) {
+                    // Drain all frames still held by the branches and encoders within the given deadline.
+                    const cluon::data::TimeStamp SHUTDOWN_STARTED{cluon::time::now()};
+                    const auto DEADLINE{std::chrono::steady_clock::now() + std::chrono::microseconds(SHUTDOWN_TIMEOUT)};
+                    for (auto &branch : branches) {
+                        branch->stop();
+                    }
+                    uint64_t framesEncoded{0};
+                    uint64_t framesRetrieved{0};
+                    uint64_t framesSkipped{0};
+                    for (auto &branch : branches) {
+                        branch->drain(DEADLINE);
+                        framesEncoded += branch->framesEncoded();
+                        framesRetrieved += branch->framesRetrieved();
+                        framesSkipped += branch->framesSkipped();
+                    }
+
+                    recWriter.stop(DEADLINE);
+                    const uint64_t FRAMES_NOT_WRITTEN{recWriter.framesDropped() + recWriter.framesFailed()};
+                    Logger::instance().log(LogLevel::Info, "Shutdown after {} ms: saved {} frames; skipped {} static frames; dropped {} frames ({} still in encoder, {} behind the writer, {} failed to write).",
+                                           cluon::time::deltaInMicroseconds(cluon::time::now(), SHUTDOWN_STARTED)/1000, recWriter.framesWritten(), framesSkipped,
+                                           (framesEncoded - framesRetrieved) + FRAMES_NOT_WRITTEN, framesEncoded - framesRetrieved, recWriter.framesDropped(), recWriter.framesFailed());
+                    Logger::instance().log(LogLevel::Info, "Captured {} frames ({}); {} while busy-polling; missed {} frames; ignored {} wakeups without a new frame.", handoff.framesAcquired(),
+                                           handoff.mode(), handoff.framesSpun(), handoff.framesMissed(), handoff.duplicateWakeups());
+                }
             }
 
             retCode = 0;
         }
         else {
-            std::cerr << "[video-qsv-vp9-recorder]: Failed to attach to shared memory '" << NAME << "'." << std::endl;
+            Logger::instance().log(LogLevel::Error, "Failed to attach to shared memory '{}'.", NAME);
         }
     }
     return retCode;